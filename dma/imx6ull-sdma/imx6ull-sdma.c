@@ -204,7 +204,10 @@ static void sdma_set_context_switching_mode(sdma_csm_t csm)
 static void sdma_enable_channel(uint8_t channel_id)
 {
 	common.channel[channel_id].active = 1;
-	common.active_mask |= (1 << channel_id);
+
+	/* Only continuous streams are expected to interrupt periodically */
+	if (common.channel[channel_id].auto_bd_done)
+		common.active_mask |= (1 << channel_id);
 	common.regs->HSTART = (1 << channel_id);
 }
 
@@ -377,10 +380,12 @@ static int sdma_intr(unsigned int intr, void *arg)
 
 				/* Set BD_DONE in all buffer descriptors */
 				sdma_buffer_desc_t *current = cmn->channel[i].bd;
-				do {
-					if (!(current->flags & SDMA_BD_DONE))
-						current->flags |= SDMA_BD_DONE;
-				} while (!((current++)->flags & SDMA_BD_WRAP));
+				if (cmn->channel[i].auto_bd_done) {
+					do {
+						if (!(current->flags & SDMA_BD_DONE))
+							current->flags |= SDMA_BD_DONE;
+					} while (!((current++)->flags & SDMA_BD_WRAP));
+				}
 
 				/* Increase interrupt count to notify dispatcher that interrupt for
 				 * this channel occurred */
@@ -637,13 +642,21 @@ static int oid_to_channel(oid_t *oid)
 	return oid->id;
 }
 
-static int dev_read(oid_t *oid, void *data, size_t size)
+static int dev_read(oid_t *oid, const void *idata, size_t isize, void *data, size_t size)
 {
 	int channel = oid_to_channel(oid);
-	unsigned intr_cnt;
+	unsigned intr_cnt, last;
 
 	mutexLock(common.lock);
-	condWait(common.channel[channel].intr_cond, common.lock, 0);
+
+	/* Caller passed the last count it has seen - don't wait if it's already stale */
+	if (idata != NULL && isize == sizeof(unsigned)) {
+		memcpy(&last, idata, sizeof(unsigned));
+		if (common.channel[channel].intr_cnt == last)
+			condWait(common.channel[channel].intr_cond, common.lock, 0);
+	} else {
+		condWait(common.channel[channel].intr_cond, common.lock, 0);
+	}
 
 	intr_cnt = common.channel[channel].intr_cnt;
 
@@ -724,6 +737,12 @@ static int dev_ctl(msg_t *msg)
 			memcpy(msg->o.raw, &dev_ctl, sizeof(sdma_dev_ctl_t));
 			return EOK;
 
+		case sdma_dev_ctl__auto_bd_done:
+			common.channel[channel].auto_bd_done = !!dev_ctl.auto_bd_done;
+			if (!common.channel[channel].auto_bd_done)
+				common.active_mask &= ~(1 << channel);
+			return EOK;
+
 		default:
 			log_error("dev_ctl: unknown type (%d)", dev_ctl.type);
 			return -ENOSYS;
@@ -753,7 +772,7 @@ static void worker_thread(void *arg)
 				break;
 
 			case mtRead:
-				msg.o.io.err = dev_read(&msg.i.io.oid, msg.o.data, msg.o.size);
+				msg.o.io.err = dev_read(&msg.i.io.oid, msg.i.data, msg.i.size, msg.o.data, msg.o.size);
 				break;
 
 			case mtWrite:
@@ -814,6 +833,7 @@ static int init(void)
 	}
 
 	for (i = 0; i < NUM_OF_SDMA_CHANNELS; i++) {
+		common.channel[i].auto_bd_done = 1;
 		common.channel[i].intr_cnt = 0;
 		common.channel[i].read_cnt = 0;
 		common.channel[i].missed_intr_cnt = 0;
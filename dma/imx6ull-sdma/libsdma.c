@@ -143,6 +143,17 @@ int sdma_trigger(sdma_t *s)
 	return sdma_dev_ctl(s, &dev_ctl, NULL, 0);
 }
 
+int sdma_set_auto_bd_done(sdma_t *s, int enable)
+{
+	sdma_dev_ctl_t dev_ctl;
+
+	dev_ctl.oid = s->oid;
+	dev_ctl.type = sdma_dev_ctl__auto_bd_done;
+	dev_ctl.auto_bd_done = enable;
+
+	return sdma_dev_ctl(s, &dev_ctl, NULL, 0);
+}
+
 int sdma_wait_for_intr(sdma_t *s, uint32_t *cnt)
 {
 	int res;
@@ -166,6 +177,30 @@ int sdma_wait_for_intr(sdma_t *s, uint32_t *cnt)
 	return 0;
 }
 
+int sdma_wait_for_new_intr(sdma_t *s, uint32_t *cnt)
+{
+	int res;
+	msg_t msg;
+	uint32_t last = *cnt;
+
+	msg.type = mtRead;
+	msg.o.size = sizeof(uint32_t);
+	msg.o.data = cnt;
+	msg.i.size = sizeof(uint32_t);
+	msg.i.data = &last;
+	msg.i.io.oid = s->oid;
+
+	if ((res = msgSend(s->oid.port, &msg)) < 0) {
+		fprintf(stderr, "msgSend failed (%d)\n\r", res);
+		return -1;
+	} else if (msg.o.io.err != EOK) {
+		fprintf(stderr, "read failed (%d)\n\r", msg.o.io.err);
+		return -2;
+	}
+
+	return 0;
+}
+
 addr_t sdma_ocram_alloc(sdma_t *s, size_t size)
 {
 	int res;
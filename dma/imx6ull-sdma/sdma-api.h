@@ -120,7 +120,8 @@ typedef enum {
 	sdma_dev_ctl__context_set,
 	sdma_dev_ctl__enable,
 	sdma_dev_ctl__trigger,
-	sdma_dev_ctl__ocram_alloc
+	sdma_dev_ctl__ocram_alloc,
+	sdma_dev_ctl__auto_bd_done
 } sdma_dev_ctl_type_t;
 
 typedef struct {
@@ -140,6 +141,10 @@ typedef struct {
 			size_t size;
 			addr_t paddr;
 		} alloc;
+
+		/* 1 - driver sets BD_DONE back on completed descriptors (cyclic streams),
+		 * 0 - client re-arms descriptors itself (e.g. variable length transfers) */
+		int auto_bd_done;
 	};
 } sdma_dev_ctl_t;
 
@@ -34,9 +34,15 @@ int sdma_context_set(sdma_t *s, const sdma_context_t *ctx);
 int sdma_enable(sdma_t *s);
 int sdma_trigger(sdma_t *s);
 
+int sdma_set_auto_bd_done(sdma_t *s, int enable);
+
 /* cnt - number of interrupts for this channel registered up until this point */
 int sdma_wait_for_intr(sdma_t *s, uint32_t *cnt);
 
+/* Like sdma_wait_for_intr, but returns immediately if the interrupt count
+ * differs from *cnt (interrupts which came before the call are not lost) */
+int sdma_wait_for_new_intr(sdma_t *s, uint32_t *cnt);
+
 void *sdma_alloc_uncached(sdma_t *s, size_t size, addr_t *paddr, int ocram);
 int sdma_free_uncached(void *vaddr, size_t size);
 
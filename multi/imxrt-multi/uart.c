@@ -104,6 +104,8 @@ static inline int uart_getTXcount(uart_t *uart)
 static void uart_intrThread(void *arg)
 {
 	uart_t *uart = (uart_t *)arg;
+	unsigned char buff[32];
+	size_t i, n;
 
 	for (;;) {
 		/* wait for character or transmit data */
@@ -124,12 +126,26 @@ static void uart_intrThread(void *arg)
 		mutexUnlock(uart->lock);
 
 		/* RX */
-		while (uart_getRXcount(uart))
-			libtty_putchar(&uart->tty_common, *(uart->base + datar), NULL);
+		while ((n = uart_getRXcount(uart))) {
+			if (n > sizeof(buff))
+				n = sizeof(buff);
+
+			for (i = 0; i < n; ++i)
+				buff[i] = *(uart->base + datar);
+
+			libtty_putchars(&uart->tty_common, buff, n, NULL);
+		}
 
 		/* TX */
-		while (libtty_txready(&uart->tty_common) && uart_getTXcount(uart) < uart->txFifoSz)
-			*(uart->base + datar) = libtty_getchar(&uart->tty_common, NULL);
+		while (libtty_txready(&uart->tty_common) && (n = uart_getTXcount(uart)) < uart->txFifoSz) {
+			n = uart->txFifoSz - n;
+			if (n > sizeof(buff))
+				n = sizeof(buff);
+
+			n = libtty_getchars(&uart->tty_common, buff, n, NULL);
+			for (i = 0; i < n; ++i)
+				*(uart->base + datar) = buff[i];
+		}
 	}
 }
 
@@ -180,34 +196,41 @@ static void set_cflag(void *_uart, tcflag_t* cflag)
 }
 
 
-static uint32_t calculate_baudrate(speed_t baud)
+static uint32_t calculate_baudrate(speed_t baud, int *achieved)
 {
-	int osr, sbr, bestSbr = 0, bestOsr = 0, bestErr = 1000, t, baud_rate = libtty_baudrate_to_int(baud);
+	int osr, sbr, bestSbr = 0, bestOsr = 0, bestErr = -1, bestRate = 0, t, rate, baud_rate = libtty_baudrate_to_int(baud);
 
-	if (!baud_rate)
+	if (baud_rate <= 0)
 		return 0;
 
-	for (osr = 3; osr < 32; ++osr) {
-		sbr = UART_CLK / (baud_rate * (osr + 1));
-		sbr &= 0xfff;
-		t = UART_CLK / (sbr * (osr + 1));
+	/* baud = UART_CLK / ((OSR + 1) * SBR), prefer higher OSR on equal error */
+	for (osr = 31; osr >= 3; --osr) {
+		sbr = (UART_CLK + baud_rate * (osr + 1) / 2) / (baud_rate * (osr + 1));
 
-		if (t > baud_rate)
-			t = ((t - baud_rate) * 1000) / baud_rate;
-		else
-			t = ((baud_rate - t) * 1000) / baud_rate;
+		if (sbr == 0)
+			sbr = 1;
+		else if (sbr > 0x1fff)
+			sbr = 0x1fff;
 
-		if (t < bestErr) {
+		rate = UART_CLK / (sbr * (osr + 1));
+
+		/* error in 1/10000 */
+		t = (int)(((int64_t)((rate > baud_rate) ? rate - baud_rate : baud_rate - rate) * 10000) / baud_rate);
+
+		if (bestErr < 0 || t < bestErr) {
 			bestErr = t;
 			bestOsr = osr;
 			bestSbr = sbr;
+			bestRate = rate;
 		}
 
-		/* Finish if error is < 1% */
-		if (bestErr < 10)
+		if (bestErr == 0)
 			break;
 	}
 
+	if (achieved != NULL)
+		*achieved = bestRate;
+
 	return (bestOsr << 24) | ((bestOsr <= 6) << 17) | bestSbr;
 }
 
@@ -215,14 +238,19 @@ static uint32_t calculate_baudrate(speed_t baud)
 static void set_baudrate(void *_uart, speed_t baud)
 {
 	uint32_t reg, t;
+	int achieved, err, baud_rate = libtty_baudrate_to_int(baud);
 	uart_t *uartptr = (uart_t *)_uart;
 
-	reg = calculate_baudrate(baud);
+	if ((reg = calculate_baudrate(baud, &achieved)) == 0)
+		return;
+
+	err = (int)(((int64_t)((achieved > baud_rate) ? achieved - baud_rate : baud_rate - achieved) * 10000) / baud_rate);
+	printf("imxrt-multi: uart baudrate %d (achieved %d, error %d.%02d%%)\n", baud_rate, achieved, err / 100, err % 100);
 
 	/* disable TX and RX */
 	*(uartptr->base + ctrlr) &= ~((1 << 19) | (1 << 18));
 
-	t = *(uartptr->base + baudr) & ~((0x1f << 24) | (1 << 17) | 0xfff);
+	t = *(uartptr->base + baudr) & ~((0x1f << 24) | (1 << 17) | 0x1fff);
 	*(uartptr->base + baudr) = t | reg;
 
 	/* reenable TX and RX */
@@ -431,7 +459,7 @@ int uart_init(void)
 	int i, dev;
 	uint32_t t;
 	uart_t *uart;
-	libtty_callbacks_t callbacks;
+	libtty_callbacks_t callbacks = { 0 };
 	static const size_t fifoSzLut[] = { 1, 4, 8, 16, 32, 64, 128, 256 };
 	static const struct {
 		volatile uint32_t *base;
@@ -486,8 +514,8 @@ int uart_init(void)
 		*(uart->base + pincfgr) &= ~3;
 
 		/* Set 115200 default baudrate */
-		t = *(uart->base + baudr) & ~((0x1f << 24) | (1 << 17) | 0xfff);
-		*(uart->base + baudr) = t | calculate_baudrate(B115200);
+		t = *(uart->base + baudr) & ~((0x1f << 24) | (1 << 17) | 0x1fff);
+		*(uart->base + baudr) = t | calculate_baudrate(B115200, NULL);
 
 		/* Set 8 bit and no parity mode */
 		*(uart->base + ctrlr) &= ~0x117;
@@ -0,0 +1,785 @@
+/*
+ * Phoenix-RTOS
+ *
+ * AHCI (SATA) host controller driver
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/interrupt.h>
+#include <sys/list.h>
+#include <sys/minmax.h>
+#include <sys/mman.h>
+#include <sys/threads.h>
+
+#include "ahci.h"
+#include "ata.h"
+#include "pci.h"
+
+
+/* Port interrupts used for commands completion */
+#define AHCI_PXIE (PXIS_DHRS | PXIS_SDBS | PXIS_ERR)
+
+
+static void *ahci_alloc(size_t size)
+{
+	void *mem;
+
+	if ((mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS, OID_NULL, 0)) == MAP_FAILED)
+		return NULL;
+
+	/* Touch the pages before they are handed to the HBA */
+	memset(mem, 0, size);
+
+	return mem;
+}
+
+
+/* Waits up to AHCI_TIMEOUT ms until (port register & mask) == val */
+static int ahci_wait(ahci_port_t *port, uint8_t reg, uint32_t mask, uint32_t val)
+{
+	unsigned int i;
+
+	for (i = 0; (port->regs[reg] & mask) != val; i++) {
+		if (i == AHCI_TIMEOUT)
+			return -ETIMEDOUT;
+		usleep(1000);
+	}
+
+	return EOK;
+}
+
+
+static void ahci_stop(ahci_port_t *port)
+{
+	port->regs[PX_CMD] &= ~PXCMD_ST;
+	ahci_wait(port, PX_CMD, PXCMD_CR, 0);
+}
+
+
+/* Stops command list and FIS receive engines, the port memory is in use by the HBA until it succeeds */
+static int ahci_halt(ahci_port_t *port)
+{
+	int err;
+
+	port->regs[PX_CMD] &= ~PXCMD_ST;
+	if ((err = ahci_wait(port, PX_CMD, PXCMD_CR, 0)) < 0)
+		return err;
+
+	port->regs[PX_CMD] &= ~PXCMD_FRE;
+
+	return ahci_wait(port, PX_CMD, PXCMD_FR, 0);
+}
+
+
+/* Halts the port and releases its memory (left mapped if the port doesn't stop) */
+static void ahci_freeport(ahci_port_t *port, unsigned int nslots)
+{
+	if (ahci_halt(port) == EOK) {
+		munmap(port->bufs, nslots * AHCI_SLOTBUFSZ);
+		munmap(port->ctbls, nslots * sizeof(ahci_cmdtbl_t));
+		munmap(port->clist, _PAGE_SIZE);
+	}
+	else {
+		fprintf(stderr, "pc-ata: failed to stop AHCI port, leaking its memory\n");
+	}
+	free(port);
+}
+
+
+/* Resets the link and the device (COMRESET), the port has to be stopped */
+static int ahci_comreset(ahci_port_t *port)
+{
+	int err;
+
+	port->regs[PX_SCTL] = (port->regs[PX_SCTL] & ~0xf) | 0x1;
+	usleep(1000);
+	port->regs[PX_SCTL] &= ~0xf;
+
+	if ((err = ahci_wait(port, PX_SSTS, 0xf, 0x3)) < 0)
+		return err;
+
+	port->regs[PX_SERR] = 0xffffffff;
+
+	return ahci_wait(port, PX_TFD, STATUS_BSY | STATUS_DRQ, 0);
+}
+
+
+static int ahci_start(ahci_port_t *port)
+{
+	int err;
+
+	/* COMRESET if the device doesn't leave BSY/DRQ state */
+	if ((ahci_wait(port, PX_TFD, STATUS_BSY | STATUS_DRQ, 0) < 0) && ((err = ahci_comreset(port)) < 0))
+		return err;
+
+	port->regs[PX_CMD] |= PXCMD_ST;
+
+	return EOK;
+}
+
+
+/* Fills command slot (command header, command FIS and PRDs byte counts) */
+static void ahci_setcmd(ahci_port_t *port, unsigned int slot, uint8_t cmd, uint64_t lba, uint16_t count, uint16_t features, uint8_t device, size_t len, uint8_t dir)
+{
+	ahci_cmdhdr_t *hdr = port->clist + slot;
+	ahci_cmdtbl_t *tbl = port->ctbls + slot;
+	uint8_t *fis = tbl->cfis;
+	unsigned int i;
+
+	/* Register host to device FIS */
+	memset(fis, 0, 20);
+	fis[0] = 0x27;
+	fis[1] = 0x80;
+	fis[2] = cmd;
+	fis[3] = features & 0xff;
+	fis[4] = (lba >> 0) & 0xff;
+	fis[5] = (lba >> 8) & 0xff;
+	fis[6] = (lba >> 16) & 0xff;
+	fis[7] = device;
+	fis[8] = (lba >> 24) & 0xff;
+	fis[9] = (lba >> 32) & 0xff;
+	fis[10] = (lba >> 40) & 0xff;
+	fis[11] = (features >> 8) & 0xff;
+	fis[12] = count & 0xff;
+	fis[13] = (count >> 8) & 0xff;
+
+	/* PRDs point to consecutive slot buffer pages, only byte counts change */
+	for (i = 0; len; i++) {
+		tbl->prdt[i].dbc = htole32(min(len, _PAGE_SIZE) - 1);
+		len -= min(len, _PAGE_SIZE);
+	}
+
+	hdr->flags = htole16((20 / 4) | ((dir == WRITE) ? CMDHDR_WRITE : 0) | ((port->ncq) ? 0 : CMDHDR_PREFETCH));
+	hdr->prdtl = htole16(i);
+	hdr->prdbc = 0;
+}
+
+
+/* Fills command slot with read/write command for sectors starting at lba */
+static void ahci_setrw(ahci_port_t *port, unsigned int slot, uint64_t lba, uint16_t sectors, uint8_t dir, uint8_t fua)
+{
+	ata_dev_t *dev = port->dev;
+	size_t len = (size_t)sectors * dev->sectorsz;
+
+	/* NCQ: sectors count in features, tag in count, FUA in device register */
+	if (port->ncq)
+		ahci_setcmd(port, slot, (dir == READ) ? CMD_READ_FPDMA : CMD_WRITE_FPDMA, lba, slot << 3, sectors, 0x40 | (fua ? 0x80 : 0), len, dir);
+	else if ((dir == WRITE) && fua && dev->fua)
+		ahci_setcmd(port, slot, CMD_WRITE_DMA_FUA_EXT, lba, sectors, 0, 0x40, len, dir);
+	else if (dev->mode == LBA48)
+		ahci_setcmd(port, slot, (dir == READ) ? CMD_READ_DMA_EXT : CMD_WRITE_DMA_EXT, lba, sectors, 0, 0x40, len, dir);
+	else
+		ahci_setcmd(port, slot, (dir == READ) ? CMD_READ_DMA : CMD_WRITE_DMA, lba & 0xffffff, sectors, 0, 0x40 | ((lba >> 24) & 0x0f), len, dir);
+}
+
+
+static void _ahci_issue(ahci_port_t *port, unsigned int slot)
+{
+	gettime(port->stamps + slot, NULL);
+	port->issued |= 1u << slot;
+
+	if (port->ncq)
+		port->regs[PX_SACT] = 1u << slot;
+	port->regs[PX_CI] = 1u << slot;
+}
+
+
+/* Reads NCQ Command Error log in slot (polled), returns its first byte (failed tag) */
+static int ahci_ncqlog(ahci_port_t *port, unsigned int slot)
+{
+	unsigned int i;
+
+	ahci_setcmd(port, slot, CMD_READ_LOG_EXT, LOG_NCQ_ERR, 1, 0, 0, 512, READ);
+	port->regs[PX_CI] = 1u << slot;
+
+	for (i = 0; port->regs[PX_CI] & (1u << slot); i++) {
+		if ((i == AHCI_TIMEOUT) || (port->regs[PX_IS] & PXIS_ERR))
+			return -EIO;
+		usleep(1000);
+	}
+
+	if (port->regs[PX_TFD] & (STATUS_ERR | STATUS_DF))
+		return -EIO;
+
+	return port->bufs[slot * AHCI_SLOTBUFSZ];
+}
+
+
+/* Restarts the port after an error, the failed commands slots are free to use */
+static void ahci_recover(ahci_port_t *port, uint32_t failed, uint32_t is)
+{
+	unsigned int slot;
+	int log;
+
+	fprintf(stderr, "pc-ata: AHCI port error (IS: %#x, TFD: %#x), restarting port\n", is, port->regs[PX_TFD]);
+
+	ahci_stop(port);
+	port->regs[PX_SERR] = 0xffffffff;
+	port->regs[PX_IS] = 0xffffffff;
+
+	if (ahci_start(port) == EOK) {
+		if (!port->ncq)
+			return;
+
+		/* NCQ device rejects new commands until its error log is read */
+		for (slot = 0; !(failed & (1u << slot)); slot++);
+
+		if ((log = ahci_ncqlog(port, slot)) >= 0) {
+			if (!(log & LOG_NCQ_NQ))
+				fprintf(stderr, "pc-ata: NCQ command (tag %d) failed\n", log & LOG_NCQ_TAG);
+			port->regs[PX_IS] = 0xffffffff;
+			return;
+		}
+
+		ahci_stop(port);
+	}
+
+	/* Port didn't recover, reset the device */
+	fprintf(stderr, "pc-ata: AHCI port recovery failed, resetting device\n");
+	ahci_comreset(port);
+	port->regs[PX_SERR] = 0xffffffff;
+	port->regs[PX_IS] = 0xffffffff;
+	ahci_start(port);
+}
+
+
+/* Returns outstanding commands (slots in mask) issued more than AHCI_CMDTIMEOUT ago */
+static uint32_t ahci_expired(ahci_port_t *port, uint32_t mask)
+{
+	uint32_t expired = 0;
+	unsigned int slot;
+	time_t now;
+
+	if (!mask)
+		return 0;
+
+	gettime(&now, NULL);
+	for (slot = 0; mask; slot++) {
+		if (!(mask & (1u << slot)))
+			continue;
+		mask &= ~(1u << slot);
+
+		if (now - port->stamps[slot] > AHCI_CMDTIMEOUT)
+			expired |= 1u << slot;
+	}
+
+	return expired;
+}
+
+
+/* Moves finished commands to done set, fails all outstanding commands on port error or command timeout */
+static void _ahci_complete(ahci_port_t *port)
+{
+	uint32_t is, completed, expired;
+
+	is = port->regs[PX_IS];
+	port->regs[PX_IS] = is;
+	port->regs[PX_IE] = AHCI_PXIE;
+
+	if (!port->issued)
+		return;
+
+	if (is & PXIS_ERR) {
+		/* The device aborts all outstanding NCQ commands on error, fail them all */
+		completed = port->issued;
+		port->err |= completed;
+		ahci_recover(port, completed, is);
+	}
+	else {
+		completed = port->issued & ~(port->regs[PX_CI] | port->regs[PX_SACT]);
+
+		/* The port is polled at least every AHCI_POLL, restarting it aborts the rest of outstanding commands too */
+		if ((expired = ahci_expired(port, port->issued & ~completed)) != 0) {
+			fprintf(stderr, "pc-ata: AHCI command timeout (slots: %#x)\n", expired);
+			port->err |= port->issued & ~completed;
+			completed = port->issued;
+			ahci_recover(port, expired, is);
+		}
+	}
+
+	if (completed) {
+		port->issued &= ~completed;
+		port->done |= completed;
+		condBroadcast(port->cond);
+	}
+}
+
+
+static int ahci_interrupt(unsigned int n, void *arg)
+{
+	ahci_hba_t *hba = (ahci_hba_t *)arg;
+	uint32_t is;
+	unsigned int i;
+
+	if (!(is = hba->regs[HBA_IS]))
+		return -1;
+
+	/* Mask port interrupts until the interrupt thread handles them */
+	for (i = 0; i < AHCI_PORTS; i++) {
+		if ((is & (1u << i)) && (hba->ports[i] != NULL))
+			hba->ports[i]->regs[PX_IE] = 0;
+	}
+	hba->regs[HBA_IS] = is;
+
+	return hba->cond;
+}
+
+
+static void ahci_intthr(void *arg)
+{
+	ahci_hba_t *hba = (ahci_hba_t *)arg;
+	unsigned int i;
+
+	mutexLock(hba->lock);
+	for (;;) {
+		/* Outstanding commands are also polled in case of lost interrupts */
+		condWait(hba->cond, hba->lock, AHCI_POLL);
+
+		for (i = 0; i < AHCI_PORTS; i++) {
+			if (hba->ports[i] != NULL)
+				_ahci_complete(hba->ports[i]);
+		}
+	}
+}
+
+
+/* Collects finished commands of the caller (slots in mask), returns number of collected slots */
+static int _ahci_collect(ahci_port_t *port, uint32_t *mask, uint8_t **bufs, size_t *lens, uint8_t dir, ssize_t *ret)
+{
+	ahci_hba_t *hba = port->hba;
+	uint32_t done = *mask & port->done;
+	unsigned int slot;
+	int n = 0;
+
+	for (slot = 0; done; slot++) {
+		if (!(done & (1u << slot)))
+			continue;
+		done &= ~(1u << slot);
+
+		if (port->err & (1u << slot)) {
+			*ret = -EIO;
+		}
+		else if (dir == READ) {
+			/* The slot is still owned by the caller, copy data without the lock (PRDBC isn't valid for NCQ) */
+			mutexUnlock(hba->lock);
+			memcpy(bufs[slot], port->bufs + slot * AHCI_SLOTBUFSZ, lens[slot]);
+			mutexLock(hba->lock);
+		}
+
+		port->done &= ~(1u << slot);
+		port->err &= ~(1u << slot);
+		port->free |= 1u << slot;
+		*mask &= ~(1u << slot);
+		n++;
+	}
+
+	if (n)
+		condBroadcast(port->cond);
+
+	return n;
+}
+
+
+ssize_t ahci_access(ata_dev_t *dev, uint64_t lba, uint32_t sectors, uint8_t *buff, uint8_t dir, uint8_t fua)
+{
+	ahci_port_t *port = dev->port;
+	ahci_hba_t *hba = port->hba;
+	uint8_t *bufs[AHCI_SLOTS];
+	size_t lens[AHCI_SLOTS];
+	uint32_t n = 0, count, mask = 0;
+	unsigned int slot;
+	ssize_t ret = EOK;
+
+	mutexLock(hba->lock);
+
+	/* Spread the request over free command slots, collect finished ones while waiting for more */
+	while ((n < sectors) || mask) {
+		if (_ahci_collect(port, &mask, bufs, lens, dir, &ret))
+			continue;
+
+		/* Queued and non-queued commands can't be mixed */
+		if ((n < sectors) && port->free && !port->nonq) {
+			for (slot = 0; !(port->free & (1u << slot)); slot++);
+			port->free &= ~(1u << slot);
+			mask |= 1u << slot;
+
+			count = min(sectors - n, AHCI_SLOTBUFSZ / dev->sectorsz);
+			bufs[slot] = buff + (size_t)n * dev->sectorsz;
+			lens[slot] = (size_t)count * dev->sectorsz;
+
+			if (dir == WRITE) {
+				mutexUnlock(hba->lock);
+				memcpy(port->bufs + slot * AHCI_SLOTBUFSZ, bufs[slot], lens[slot]);
+				mutexLock(hba->lock);
+			}
+
+			ahci_setrw(port, slot, lba + n, count, dir, fua);
+			_ahci_issue(port, slot);
+			n += count;
+			continue;
+		}
+
+		condWait(port->cond, hba->lock, 0);
+	}
+
+	mutexUnlock(hba->lock);
+
+	if (ret < 0)
+		return ret;
+
+	/* FUA writes are supported for NCQ and LBA48 devices, others flush the cache */
+	if ((dir == WRITE) && fua && !dev->fua && ((ret = ahci_flush(dev)) < 0))
+		return ret;
+
+	return (ssize_t)sectors * dev->sectorsz;
+}
+
+
+int ahci_flush(ata_dev_t *dev)
+{
+	ahci_port_t *port = dev->port;
+	ahci_hba_t *hba = port->hba;
+	uint8_t *buff = NULL;
+	size_t len = 0;
+	uint32_t mask;
+	unsigned int slot;
+	ssize_t ret = EOK;
+
+	mutexLock(hba->lock);
+
+	/* Wait until queued commands drain, new ones wait for the flush */
+	while (port->nonq)
+		condWait(port->cond, hba->lock, 0);
+	port->nonq = 1;
+
+	/* Slots reserved, but not issued yet (write data being copied) count too */
+	while (port->free != port->slots)
+		condWait(port->cond, hba->lock, 0);
+
+	for (slot = 0; !(port->free & (1u << slot)); slot++);
+	port->free &= ~(1u << slot);
+	mask = 1u << slot;
+
+	ahci_setcmd(port, slot, (dev->mode == LBA48) ? CMD_CACHE_FLUSH_EXT : CMD_CACHE_FLUSH, 0, 0, 0, 0x40, 0, READ);
+	gettime(port->stamps + slot, NULL);
+	port->issued |= mask;
+	port->regs[PX_CI] = mask;
+
+	while (mask) {
+		if (!_ahci_collect(port, &mask, &buff, &len, WRITE, &ret))
+			condWait(port->cond, hba->lock, 0);
+	}
+
+	port->nonq = 0;
+	condBroadcast(port->cond);
+
+	mutexUnlock(hba->lock);
+
+	return ret;
+}
+
+
+/* Issues IDENTIFY DEVICE command (polled, interrupts are not enabled yet) */
+static int ahci_identify(ahci_port_t *port, uint16_t *info)
+{
+	unsigned int i;
+
+	ahci_setcmd(port, 0, CMD_IDENTIFY, 0, 0, 0, 0, 512, READ);
+	port->regs[PX_CI] = 0x1;
+
+	for (i = 0; port->regs[PX_CI] & 0x1; i++) {
+		if ((i == AHCI_TIMEOUT) || (port->regs[PX_IS] & PXIS_TFES))
+			return -EIO;
+		usleep(1000);
+	}
+
+	if (port->regs[PX_TFD] & (STATUS_ERR | STATUS_DF))
+		return -EIO;
+
+	for (i = 0; i < 256; i++)
+		info[i] = le16toh(((uint16_t *)port->bufs)[i]);
+
+	return EOK;
+}
+
+
+static int ahci_initdev(ahci_port_t *port, unsigned int nslots)
+{
+	ata_dev_t *dev;
+	uint16_t info[256];
+	unsigned int depth;
+	int err;
+
+	if ((err = ahci_identify(port, info)) < 0)
+		return err;
+
+	if ((dev = (ata_dev_t *)malloc(sizeof(ata_dev_t))) == NULL)
+		return -ENOMEM;
+
+	dev->pio = PIO_DEFAULT;
+	dev->dma = DMA_NONE;
+	dev->mode = (info[83] & (1 << 10)) ? LBA48 : LBA28;
+	dev->fua = 0;
+	dev->multiple = 0;
+	dev->cylinders = 0;
+	dev->heads = 0;
+	dev->sectors = 0;
+	dev->sectorsz = 512;
+	dev->bus = NULL;
+	dev->port = port;
+
+	/* Logical sector size (in words) */
+	if (((info[106] & 0xc000) == 0x4000) && (info[106] & (1 << 12)))
+		dev->sectorsz = 2 * ((uint32_t)info[117] | ((uint32_t)info[118] << 16));
+
+	if ((dev->sectorsz < 512) || (dev->sectorsz > AHCI_SLOTBUFSZ)) {
+		free(dev);
+		return -ENOTSUP;
+	}
+
+	if (dev->mode == LBA48)
+		dev->size = (uint64_t)info[100] | ((uint64_t)info[101] << 16) | ((uint64_t)info[102] << 32) | ((uint64_t)info[103] << 48);
+	else
+		dev->size = (uint64_t)info[60] | ((uint64_t)info[61] << 16);
+	dev->size *= dev->sectorsz;
+
+	/* WRITE DMA FUA EXT support (word 84 bit 6, valid if bits 15:14 = 01b) */
+	if ((dev->mode == LBA48) && ((info[84] & 0xc000) == 0x4000) && (info[84] & (1 << 6)))
+		dev->fua = 1;
+
+	/* Native command queuing (both HBA and device have to support it) */
+	port->ncq = 0;
+	if ((port->hba->cap & CAP_SNCQ) && (info[76] & (1 << 8))) {
+		port->ncq = 1;
+		dev->fua = 1;
+		depth = (info[75] & 0x1f) + 1;
+		nslots = min(nslots, depth);
+	}
+	/* Non-queued commands issued in several slots are executed one by one */
+	port->slots = (nslots == 32) ? 0xffffffff : ((1u << nslots) - 1);
+	port->free = port->slots;
+
+	port->dev = dev;
+
+	return EOK;
+}
+
+
+static int ahci_initport(ahci_hba_t *hba, unsigned int n)
+{
+	ahci_port_t *port;
+	unsigned int i, nslots = ((hba->cap & CAP_NCS) >> 8) + 1;
+	uint32_t ssts;
+	int err;
+
+	/* Device present and link active */
+	ssts = hba->regs[(0x100 + n * 0x80) / 4 + PX_SSTS];
+	if (((ssts & 0xf) != 0x3) || (((ssts >> 8) & 0xf) != 0x1))
+		return -ENXIO;
+
+	/* ATAPI and port multipliers are not supported */
+	if (hba->regs[(0x100 + n * 0x80) / 4 + PX_SIG] != SIG_ATA)
+		return -ENXIO;
+
+	if ((port = (ahci_port_t *)malloc(sizeof(ahci_port_t))) == NULL)
+		return -ENOMEM;
+
+	port->regs = hba->regs + (0x100 + n * 0x80) / 4;
+	port->hba = hba;
+	port->ncq = 0;
+	port->nonq = 0;
+	port->issued = 0;
+	port->done = 0;
+	port->err = 0;
+
+	if ((err = ahci_halt(port)) < 0) {
+		free(port);
+		return err;
+	}
+
+	/* Command list (1KB) and received FIS area (256B) share one page, each command table lays within one page */
+	if ((port->clist = ahci_alloc(_PAGE_SIZE)) == NULL) {
+		free(port);
+		return -ENOMEM;
+	}
+	port->rfis = (uint8_t *)port->clist + 1024;
+
+	if ((port->ctbls = ahci_alloc(nslots * sizeof(ahci_cmdtbl_t))) == NULL) {
+		munmap(port->clist, _PAGE_SIZE);
+		free(port);
+		return -ENOMEM;
+	}
+
+	if ((port->bufs = ahci_alloc(nslots * AHCI_SLOTBUFSZ)) == NULL) {
+		munmap(port->ctbls, nslots * sizeof(ahci_cmdtbl_t));
+		munmap(port->clist, _PAGE_SIZE);
+		free(port);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nslots * AHCI_PRDS; i++) {
+		port->ctbls[i / AHCI_PRDS].prdt[i % AHCI_PRDS].dba = htole32((uint32_t)va2pa(port->bufs + i * _PAGE_SIZE));
+		port->ctbls[i / AHCI_PRDS].prdt[i % AHCI_PRDS].dbau = 0;
+	}
+
+	for (i = 0; i < nslots; i++) {
+		port->clist[i].ctba = htole32((uint32_t)va2pa(port->ctbls + i));
+		port->clist[i].ctbau = 0;
+	}
+
+	port->regs[PX_CLB] = (uint32_t)va2pa(port->clist);
+	port->regs[PX_CLBU] = 0;
+	port->regs[PX_FB] = (uint32_t)va2pa(port->rfis);
+	port->regs[PX_FBU] = 0;
+	port->regs[PX_CMD] |= PXCMD_FRE;
+
+	/* Clear errors and start the port */
+	port->regs[PX_SERR] = 0xffffffff;
+	port->regs[PX_IS] = 0xffffffff;
+
+	if (((err = ahci_start(port)) < 0) || ((err = condCreate(&port->cond)) < 0)) {
+		ahci_freeport(port, nslots);
+		return err;
+	}
+
+	if ((err = ahci_initdev(port, nslots)) < 0) {
+		resourceDestroy(port->cond);
+		ahci_freeport(port, nslots);
+		return err;
+	}
+
+	port->regs[PX_IS] = 0xffffffff;
+	port->regs[PX_IE] = AHCI_PXIE;
+	hba->ports[n] = port;
+
+	return EOK;
+}
+
+
+static int ahci_inithba(pci_dev_t *pdev)
+{
+	ahci_hba_t *hba;
+	uint32_t abar, pi;
+	unsigned int i, nports = 0, irq = 0;
+	int err;
+
+	if (!(abar = pci_read(pdev, PCI_BAR5) & ~0xf))
+		return -ENXIO;
+
+	/* Enable memory space access and bus mastering, INTx interrupts are used */
+	pci_write(pdev, PCI_CMD, ((pci_read(pdev, PCI_CMD) & 0xffff) | PCI_CMD_MEM | PCI_CMD_MASTER) & ~PCI_CMD_INTDIS);
+
+	if ((hba = (ahci_hba_t *)malloc(sizeof(ahci_hba_t))) == NULL)
+		return -ENOMEM;
+
+	if ((hba->regs = mmap(NULL, 2 * _PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_DEVICE | MAP_UNCACHED, OID_PHYSMEM, abar)) == MAP_FAILED) {
+		free(hba);
+		return -ENOMEM;
+	}
+
+	if ((err = mutexCreate(&hba->lock)) < 0) {
+		munmap((void *)hba->regs, 2 * _PAGE_SIZE);
+		free(hba);
+		return err;
+	}
+
+	if ((err = condCreate(&hba->cond)) < 0) {
+		resourceDestroy(hba->lock);
+		munmap((void *)hba->regs, 2 * _PAGE_SIZE);
+		free(hba);
+		return err;
+	}
+
+	/* Switch HBA to AHCI mode, BIOS/OS handoff is not performed */
+	hba->regs[HBA_GHC] |= GHC_AE;
+	hba->regs[HBA_GHC] &= ~GHC_IE;
+	hba->cap = hba->regs[HBA_CAP];
+	hba->irq = pci_read(pdev, PCI_IRQ) & 0xff;
+
+	pi = hba->regs[HBA_PI];
+	for (i = 0; i < AHCI_PORTS; i++) {
+		hba->ports[i] = NULL;
+
+		if ((pi & (1u << i)) && (ahci_initport(hba, i) == EOK))
+			nports++;
+	}
+
+	if (!nports) {
+		resourceDestroy(hba->cond);
+		resourceDestroy(hba->lock);
+		munmap((void *)hba->regs, 2 * _PAGE_SIZE);
+		free(hba);
+		return -ENXIO;
+	}
+
+	/* Completions are polled if the interrupt can't be attached */
+	hba->regs[HBA_IS] = 0xffffffff;
+	if ((hba->irq == 0) || (hba->irq == 0xff) || (interrupt(hba->irq, ahci_interrupt, hba, hba->cond, &hba->inth) < 0))
+		fprintf(stderr, "pc-ata: failed to attach AHCI interrupt, using polling\n");
+	else {
+		hba->regs[HBA_GHC] |= GHC_IE;
+		irq = 1;
+	}
+
+	if ((err = beginthread(ahci_intthr, 4, hba->istack, sizeof(hba->istack), hba)) < 0) {
+		hba->regs[HBA_GHC] &= ~GHC_IE;
+		if (irq)
+			resourceDestroy(hba->inth);
+
+		for (i = 0; i < AHCI_PORTS; i++) {
+			if (hba->ports[i] == NULL)
+				continue;
+
+			hba->ports[i]->regs[PX_IE] = 0;
+			resourceDestroy(hba->ports[i]->cond);
+			free(hba->ports[i]->dev);
+			ahci_freeport(hba->ports[i], ((hba->cap & CAP_NCS) >> 8) + 1);
+		}
+
+		resourceDestroy(hba->cond);
+		resourceDestroy(hba->lock);
+		munmap((void *)hba->regs, 2 * _PAGE_SIZE);
+		free(hba);
+		return err;
+	}
+
+	/* Add SATA disks to ATA devices */
+	for (i = 0; i < AHCI_PORTS; i++) {
+		if (hba->ports[i] == NULL)
+			continue;
+
+		LIST_ADD(&ata_common.devs, hba->ports[i]->dev);
+		ata_common.ndevs++;
+	}
+
+	return EOK;
+}
+
+
+int ahci_init(void)
+{
+	pci_dev_t pdev;
+	unsigned int i;
+	int err = -ENODEV;
+
+	/* Mass storage controller, SATA, AHCI 1.0 */
+	for (i = 0; pci_find(0x010601, 0xffffff, i, &pdev) == EOK; i++) {
+		if (ahci_inithba(&pdev) == EOK)
+			err = EOK;
+	}
+
+	return err;
+}
@@ -0,0 +1,214 @@
+/*
+ * Phoenix-RTOS
+ *
+ * AHCI (SATA) host controller driver
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _AHCI_H_
+#define _AHCI_H_
+
+#include <stdint.h>
+
+#include <sys/types.h>
+
+#include "ata.h"
+
+
+/* Misc definitions */
+#define AHCI_PORTS      32                          /* Max number of HBA ports */
+#define AHCI_SLOTS      32                          /* Max number of command slots per port */
+#define AHCI_PRDS       4                           /* Number of PRD entries per command table */
+#define AHCI_SLOTBUFSZ  (AHCI_PRDS * _PAGE_SIZE)    /* Command slot bounce buffer size (one PRD entry per page) */
+#define AHCI_POLL       100000                      /* Completion polling interval (lost interrupts) in us */
+#define AHCI_TIMEOUT    500                         /* Port start/stop timeout in ms */
+#define AHCI_CMDTIMEOUT 30000000                    /* Command completion timeout in us */
+
+
+/* ATA commands used with AHCI */
+enum {
+	CMD_READ_LOG_EXT    = 0x2f, /* READ LOG EXT (NCQ error recovery) */
+	CMD_READ_FPDMA      = 0x60, /* READ FPDMA QUEUED (NCQ) */
+	CMD_WRITE_FPDMA     = 0x61  /* WRITE FPDMA QUEUED (NCQ) */
+};
+
+
+/* NCQ Command Error log */
+#define LOG_NCQ_ERR     0x10                        /* Log address */
+#define LOG_NCQ_NQ      0x80                        /* Error not caused by a queued command */
+#define LOG_NCQ_TAG     0x1f                        /* Failed command tag */
+
+
+/* HBA generic host control registers (32-bit words offsets) */
+enum {
+	HBA_CAP             = 0x00, /* Host capabilities */
+	HBA_GHC             = 0x01, /* Global host control */
+	HBA_IS              = 0x02, /* Interrupt status */
+	HBA_PI              = 0x03, /* Ports implemented */
+	HBA_VS              = 0x04  /* Version */
+};
+
+
+/* HBA_CAP layout */
+enum {
+	CAP_NP              = 0x0000001f, /* Number of ports - 1 */
+	CAP_NCS             = 0x00001f00, /* Number of command slots - 1 */
+	CAP_SNCQ            = 0x40000000, /* Native command queuing support */
+	CAP_S64A            = 0x80000000  /* 64-bit addressing support */
+};
+
+
+/* HBA_GHC layout */
+enum {
+	GHC_HR              = 0x00000001, /* HBA reset */
+	GHC_IE              = 0x00000002, /* Interrupt enable */
+	GHC_AE              = 0x80000000  /* AHCI enable */
+};
+
+
+/* Port registers (32-bit words offsets from port registers base) */
+enum {
+	PX_CLB              = 0x00, /* Command list base address */
+	PX_CLBU             = 0x01, /* Command list base address upper 32 bits */
+	PX_FB               = 0x02, /* FIS base address */
+	PX_FBU              = 0x03, /* FIS base address upper 32 bits */
+	PX_IS               = 0x04, /* Interrupt status */
+	PX_IE               = 0x05, /* Interrupt enable */
+	PX_CMD              = 0x06, /* Command and status */
+	PX_TFD              = 0x08, /* Task file data */
+	PX_SIG              = 0x09, /* Signature */
+	PX_SSTS             = 0x0a, /* SATA status */
+	PX_SCTL             = 0x0b, /* SATA control */
+	PX_SERR             = 0x0c, /* SATA error */
+	PX_SACT             = 0x0d, /* SATA active (NCQ tags) */
+	PX_CI               = 0x0e  /* Command issue */
+};
+
+
+/* PX_IS and PX_IE layout */
+enum {
+	PXIS_DHRS           = 0x00000001, /* Device to host register FIS received */
+	PXIS_PSS            = 0x00000002, /* PIO setup FIS received */
+	PXIS_DSS            = 0x00000004, /* DMA setup FIS received */
+	PXIS_SDBS           = 0x00000008, /* Set device bits FIS received */
+	PXIS_IFS            = 0x08000000, /* Interface fatal error */
+	PXIS_HBDS           = 0x10000000, /* Host bus data error */
+	PXIS_HBFS           = 0x20000000, /* Host bus fatal error */
+	PXIS_TFES           = 0x40000000, /* Task file error */
+	PXIS_ERR            = PXIS_IFS | PXIS_HBDS | PXIS_HBFS | PXIS_TFES
+};
+
+
+/* PX_CMD layout */
+enum {
+	PXCMD_ST            = 0x00000001, /* Start command list processing */
+	PXCMD_FRE           = 0x00000010, /* FIS receive enable */
+	PXCMD_FR            = 0x00004000, /* FIS receive running */
+	PXCMD_CR            = 0x00008000  /* Command list running */
+};
+
+
+/* Device signatures */
+enum {
+	SIG_ATA             = 0x00000101  /* SATA disk */
+};
+
+
+/* Command header flags */
+enum {
+	CMDHDR_CFL          = 0x001f, /* Command FIS length in dwords */
+	CMDHDR_WRITE        = 0x0040, /* Host to device data direction */
+	CMDHDR_PREFETCH     = 0x0080  /* Prefetch PRDs */
+};
+
+
+/* Command header (command list entry) */
+typedef struct {
+	uint16_t flags;         /* Command FIS length, direction and other flags */
+	uint16_t prdtl;         /* Number of PRD entries */
+	volatile uint32_t prdbc;/* Number of bytes transferred */
+	uint32_t ctba;          /* Command table base address */
+	uint32_t ctbau;         /* Command table base address upper 32 bits */
+	uint32_t reserved[4];
+} ahci_cmdhdr_t;
+
+
+/* Physical region descriptor */
+typedef struct {
+	uint32_t dba;           /* Data base address */
+	uint32_t dbau;          /* Data base address upper 32 bits */
+	uint32_t reserved;
+	uint32_t dbc;           /* Byte count - 1 (bit 31: interrupt on completion) */
+} ahci_prd_t;
+
+
+/* Command table (128-byte aligned) */
+typedef struct {
+	uint8_t cfis[64];       /* Command FIS */
+	uint8_t acmd[16];       /* ATAPI command */
+	uint8_t reserved[48];
+	ahci_prd_t prdt[AHCI_PRDS];
+} __attribute__((aligned(128))) ahci_cmdtbl_t;
+
+
+typedef struct _ahci_hba_t ahci_hba_t;
+
+
+struct _ahci_port_t {
+	volatile uint32_t *regs;    /* Port registers */
+	ahci_hba_t *hba;            /* HBA the port belongs to */
+	ata_dev_t *dev;             /* Attached device */
+
+	/* DMA memory */
+	ahci_cmdhdr_t *clist;       /* Command list */
+	uint8_t *rfis;              /* Received FIS area */
+	ahci_cmdtbl_t *ctbls;       /* Command tables (one per slot) */
+	uint8_t *bufs;              /* Command slots bounce buffers */
+
+	/* Command slots state (protected by HBA lock) */
+	uint8_t ncq;                /* Use native command queuing */
+	uint8_t nonq;               /* Non-queued command (cache flush) is pending */
+	uint32_t slots;             /* All usable command slots */
+	uint32_t free;              /* Free command slots */
+	uint32_t issued;            /* Issued (outstanding) commands */
+	uint32_t done;              /* Completed commands not yet collected */
+	uint32_t err;               /* Failed commands not yet collected */
+	time_t stamps[AHCI_SLOTS];  /* Commands issue time */
+	handle_t cond;              /* Command slot released/completed */
+};
+
+
+struct _ahci_hba_t {
+	volatile uint32_t *regs;    /* HBA registers */
+	unsigned int irq;           /* Interrupt number */
+	uint32_t cap;               /* HBA capabilities */
+	ahci_port_t *ports[AHCI_PORTS];
+
+	/* Synchronization */
+	handle_t lock;              /* HBA and ports state mutex */
+	handle_t cond;              /* Interrupt condition */
+	handle_t inth;              /* Interrupt handle */
+
+	/* Interrupt thread stack */
+	char istack[2 * _PAGE_SIZE] __attribute__((aligned(8)));
+};
+
+
+/* Transfers sectors from/to AHCI device (up to one command per slot in flight), fua forces writes to the media */
+extern ssize_t ahci_access(ata_dev_t *dev, uint64_t lba, uint32_t sectors, uint8_t *buff, uint8_t dir, uint8_t fua);
+
+
+/* Flushes AHCI device write cache */
+extern int ahci_flush(ata_dev_t *dev);
+
+
+/* Detects AHCI controllers and adds attached SATA disks to ATA devices */
+extern int ahci_init(void);
+
+
+#endif
@@ -14,14 +14,21 @@
 #include <endian.h>
 #include <errno.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <sys/interrupt.h>
 #include <sys/io.h>
 #include <sys/list.h>
+#include <sys/minmax.h>
+#include <sys/mman.h>
 #include <sys/threads.h>
 
+#include "ahci.h"
 #include "ata.h"
+#include "pci.h"
 
 
 ata_common_t ata_common;
@@ -108,6 +115,66 @@ static void ata_writereg(void *base, uint8_t reg, uint32_t val, uint8_t size)
 }
 
 
+/* Reads n 16-bit words from data register (string I/O for IO-ports) */
+static void ata_readdata(void *base, uint8_t *buff, size_t n)
+{
+	uintptr_t addr = (uintptr_t)base;
+	uint16_t data;
+	size_t i;
+
+	if (addr & 0x1) {
+		__asm__ volatile ("rep insw" : "+D" (buff), "+c" (n) : "d" ((uint16_t)((addr & ~0x3) + REG_DATA)) : "memory");
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		data = (uint16_t)ata_readreg(base, REG_DATA, 2);
+		buff[2 * i + 0] = (data >> 0) & 0xff;
+		buff[2 * i + 1] = (data >> 8) & 0xff;
+	}
+}
+
+
+/* Writes n 16-bit words to data register (string I/O for IO-ports) */
+static void ata_writedata(void *base, const uint8_t *buff, size_t n)
+{
+	uintptr_t addr = (uintptr_t)base;
+	size_t i;
+
+	if (addr & 0x1) {
+		__asm__ volatile ("rep outsw" : "+S" (buff), "+c" (n) : "d" ((uint16_t)((addr & ~0x3) + REG_DATA)) : "memory");
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+		ata_writereg(base, REG_DATA, buff[2 * i + 0] | (buff[2 * i + 1] << 8), 2);
+}
+
+
+/* Returns bus master IDE registers of PCI IDE controller serving the standard IO-ports */
+static void *ata_findbmide(void)
+{
+	pci_dev_t pdev;
+	uint32_t class, bar;
+
+	if (pci_find(0x010100, 0xffff00, 0, &pdev) < 0)
+		return NULL;
+
+	/* Both channels in compatibility mode and bus mastering support */
+	class = pci_read(&pdev, PCI_CLASS) >> 8;
+	if ((class & 0x05) || !(class & 0x80))
+		return NULL;
+
+	if (!((bar = pci_read(&pdev, PCI_BAR4)) & 0x1) || !(bar & ~0x3))
+		return NULL;
+
+	/* Enable IO space access and bus mastering */
+	pci_write(&pdev, PCI_CMD, (pci_read(&pdev, PCI_CMD) & 0xffff) | PCI_CMD_IO | PCI_CMD_MASTER);
+
+	return (void *)((bar & ~0x3) | 0x1);
+}
+
+
 static void ata_delay(ata_bus_t *bus)
 {
 	void *ctrl = bus->ctrl;
@@ -134,6 +201,56 @@ static void ata_resetbus(ata_bus_t *bus)
 }
 
 
+static int ata_interrupt(unsigned int n, void *arg)
+{
+	ata_bus_t *bus = (ata_bus_t *)arg;
+	uint8_t status;
+
+	/* Reading status acknowledges the device interrupt */
+	ata_readreg(bus->base, REG_STATUS, 1);
+
+	/* Clear bus master interrupt status (write 1 to clear), error status is left for the transfer */
+	if (bus->bmide != NULL) {
+		status = (uint8_t)ata_readreg(bus->bmide, BM_STATUS, 1);
+		if (status & BM_STATUS_IRQ)
+			ata_writereg(bus->bmide, BM_STATUS, (status & ~BM_STATUS_ERR) | BM_STATUS_IRQ, 1);
+	}
+
+	return bus->icond;
+}
+
+
+/* Sleeps until the device interrupts while it's busy (or transferring DMA data if dma is set) */
+static void ata_sleep(ata_bus_t *bus, uint8_t dma)
+{
+	uint8_t status, bmstatus;
+
+	/* Without the interrupt callers poll the status */
+	if (!bus->irq)
+		return;
+
+	mutexLock(bus->ilock);
+
+	for (;;) {
+		status = (uint8_t)ata_readreg(bus->ctrl, REG_ALTSTATUS, 1);
+
+		if (dma) {
+			bmstatus = (uint8_t)ata_readreg(bus->bmide, BM_STATUS, 1);
+			if (!(bmstatus & BM_STATUS_ACTIVE) || !(status & (STATUS_BSY | STATUS_DRQ)))
+				break;
+		}
+		else if (!(status & STATUS_BSY)) {
+			break;
+		}
+
+		/* Timeout covers lost interrupts */
+		condWait(bus->icond, bus->ilock, ATA_POLL);
+	}
+
+	mutexUnlock(bus->ilock);
+}
+
+
 static int ata_wait(ata_bus_t *bus, uint8_t clear, uint8_t set)
 {
 	uint8_t status;
@@ -153,9 +270,8 @@ static int ata_wait(ata_bus_t *bus, uint8_t clear, uint8_t set)
 }
 
 
-static void ata_select(ata_dev_t *dev, uint64_t lba, uint16_t sectors, uint8_t mode)
+static void ata_select(ata_dev_t *dev, uint64_t lba, uint32_t sectors, uint8_t mode)
 {
-	static ata_dev_t *ldev = NULL;
 	ata_bus_t *bus = dev->bus;
 	void *base = bus->base;
 	uint16_t c = 0, h = 0, s = 0;
@@ -178,9 +294,10 @@ static void ata_select(ata_dev_t *dev, uint64_t lba, uint16_t sectors, uint8_t m
 		break;
 	}
 
-	if (dev != ldev) {
-		/* Select the device */
-		ata_writereg(base, REG_DEVSEL, (h & 0xff) | (dev == bus->devs[SLAVE]) * DEVSEL_DEVNUM | DEVSEL_SET0 | DEVSEL_SET1, 1);
+	/* Select the device (also writes CHS/LBA28 head bits) */
+	ata_writereg(base, REG_DEVSEL, (h & 0xff) | (dev == bus->devs[SLAVE]) * DEVSEL_DEVNUM | DEVSEL_SET0 | DEVSEL_SET1, 1);
+
+	if (dev != bus->sel) {
 		/* Wait for the device to push its status onto the bus */
 		ata_delay(bus);
 
@@ -193,9 +310,9 @@ static void ata_select(ata_dev_t *dev, uint64_t lba, uint16_t sectors, uint8_t m
 		/* Wait until BSY clears */
 		ata_wait(bus, STATUS_BSY, 0);
 
-		/* Don't update ldev on device initialization */
+		/* Don't update selected device on device initialization */
 		if (mode != -1)
-			ldev = dev;
+			bus->sel = dev;
 	}
 
 	/* Write other registers */
@@ -212,44 +329,40 @@ static void ata_select(ata_dev_t *dev, uint64_t lba, uint16_t sectors, uint8_t m
 }
 
 
-static ssize_t ata_pio(ata_dev_t *dev, uint16_t sectors, uint8_t *buff, uint8_t dir)
+static ssize_t ata_pio(ata_dev_t *dev, uint32_t sectors, uint8_t *buff, uint8_t dir)
 {
 	ata_bus_t *bus = dev->bus;
-	void *base = bus->base;
 	ssize_t ret = 0;
-	uint16_t data, i;
-	uint32_t j;
+	size_t len;
+	uint32_t n;
 	int err;
 
-	for (i = 0; i < sectors; i++) {
-		/* Wait until BSY clears and DRQ sets */
+	/* Device requests data transfer (DRQ) once per sector or once per block with READ/WRITE MULTIPLE */
+	for (; sectors > 0; sectors -= n) {
+		n = min(sectors, (dev->multiple) ? dev->multiple : 1);
+		len = (size_t)n * dev->sectorsz;
+
+		/* Wait until BSY clears and DRQ sets (PIO data-out doesn't interrupt before the first block) */
+		if ((dir == READ) || (ret > 0))
+			ata_sleep(bus, 0);
 		if ((err = ata_wait(bus, STATUS_BSY, STATUS_DRQ)) < 0)
 			return err;
 
 		switch (dir) {
 		case READ:
-			/* Read one sector */
-			for (j = 0; j < dev->sectorsz; j += 2) {
-				data = (uint16_t)ata_readreg(base, REG_DATA, 2);
-				(buff + ret)[j + 0] = (data >> 0) & 0xff;
-				(buff + ret)[j + 1] = (data >> 8) & 0xff;
-			}
+			ata_readdata(bus->base, buff + ret, len / 2);
 			break;
 
 		case WRITE:
-			/* Write one sector */
-			for (j = 0; j < dev->sectorsz; j += 2) {
-				data  = (buff + ret)[j + 0] << 0;
-				data |= (buff + ret)[j + 1] << 8;
-				ata_writereg(base, REG_DATA, data, 2);
-			}
+			ata_writedata(bus->base, buff + ret, len / 2);
 			break;
 		}
 
-		ret += dev->sectorsz;
+		ret += len;
 	}
 
 	/* Wait until DRQ clears and RDY sets */
+	ata_sleep(bus, 0);
 	if ((err = ata_wait(bus, STATUS_DRQ, STATUS_RDY)) < 0)
 		return err;
 
@@ -257,7 +370,65 @@ static ssize_t ata_pio(ata_dev_t *dev, uint16_t sectors, uint8_t *buff, uint8_t
 }
 
 
-static ssize_t _ata_access(ata_dev_t *dev, uint64_t lba, uint16_t sectors, uint8_t cmd, uint8_t *buff)
+/* Prepares bus master for DMA transfer of len bytes from/to the bounce buffer */
+static void ata_dmaprep(ata_bus_t *bus, size_t len, uint8_t dir)
+{
+	void *bmide = bus->bmide;
+	unsigned int i;
+	uint8_t status;
+
+	/* PRD entries point to consecutive bounce buffer pages, only byte counts change */
+	for (i = 0; len > _PAGE_SIZE; i++, len -= _PAGE_SIZE)
+		bus->prdt[2 * i + 1] = htole32(_PAGE_SIZE);
+	bus->prdt[2 * i + 1] = htole32(PRD_EOT | len);
+
+	ata_writereg(bmide, BM_CMD, (dir == READ) ? BM_CMD_READ : 0, 1);
+	ata_writereg(bmide, BM_PRDT, (uint32_t)va2pa(bus->prdt), 4);
+
+	/* Clear error and interrupt status (write 1 to clear) */
+	status = (uint8_t)ata_readreg(bmide, BM_STATUS, 1);
+	ata_writereg(bmide, BM_STATUS, status | BM_STATUS_ERR | BM_STATUS_IRQ, 1);
+}
+
+
+static ssize_t ata_dma(ata_dev_t *dev, uint32_t sectors, uint8_t *buff, uint8_t dir)
+{
+	ata_bus_t *bus = dev->bus;
+	void *bmide = bus->bmide;
+	size_t len = (size_t)sectors * dev->sectorsz;
+	uint8_t status, bmstatus;
+	int err;
+
+	/* Start the transfer and let the device assert BSY */
+	ata_writereg(bmide, BM_CMD, ((dir == READ) ? BM_CMD_READ : 0) | BM_CMD_START, 1);
+	ata_delay(bus);
+
+	/* Wait until all PRDs are transferred or the device finishes (also on error) */
+	ata_sleep(bus, 1);
+	do {
+		bmstatus = (uint8_t)ata_readreg(bmide, BM_STATUS, 1);
+		status = (uint8_t)ata_readreg(bus->ctrl, REG_ALTSTATUS, 1);
+	} while ((bmstatus & BM_STATUS_ACTIVE) && (status & (STATUS_BSY | STATUS_DRQ)));
+
+	/* Stop the bus master */
+	ata_writereg(bmide, BM_CMD, (dir == READ) ? BM_CMD_READ : 0, 1);
+	ata_writereg(bmide, BM_STATUS, bmstatus | BM_STATUS_ERR | BM_STATUS_IRQ, 1);
+
+	/* Wait until BSY clears */
+	if ((err = ata_wait(bus, STATUS_BSY, 0)) < 0)
+		return err;
+
+	if ((bmstatus & BM_STATUS_ERR) || (bmstatus & BM_STATUS_ACTIVE))
+		return -EIO;
+
+	if (dir == READ)
+		memcpy(buff, bus->dmabuf, len);
+
+	return len;
+}
+
+
+static ssize_t _ata_access(ata_dev_t *dev, uint64_t lba, uint32_t sectors, uint8_t cmd, uint8_t *buff)
 {
 	ata_bus_t *bus = dev->bus;
 	void *base = bus->base;
@@ -267,26 +438,52 @@ static ssize_t _ata_access(ata_dev_t *dev, uint64_t lba, uint16_t sectors, uint8
 	if ((ret = ata_wait(bus, STATUS_BSY, 0)) < 0)
 		return ret;
 
+	/* Prepare the bus master */
+	switch (cmd) {
+	case CMD_READ_DMA:
+	case CMD_READ_DMA_EXT:
+		ata_dmaprep(bus, (size_t)sectors * dev->sectorsz, READ);
+		break;
+
+	case CMD_WRITE_DMA:
+	case CMD_WRITE_DMA_EXT:
+	case CMD_WRITE_DMA_FUA_EXT:
+		memcpy(bus->dmabuf, buff, (size_t)sectors * dev->sectorsz);
+		ata_dmaprep(bus, (size_t)sectors * dev->sectorsz, WRITE);
+		break;
+	}
+
 	/* Select the device and prepare for the transfer */
 	ata_select(dev, lba, sectors, dev->mode);
-	/* Send the command */
+	/* Send the command and let the device assert BSY */
 	ata_writereg(base, REG_CMD, cmd, 1);
+	ata_delay(bus);
 
 	/* Do the transfer */
 	switch (cmd) {
 	case CMD_READ_PIO:
 	case CMD_READ_PIO_EXT:
+	case CMD_READ_MULT:
+	case CMD_READ_MULT_EXT:
 		ret = ata_pio(dev, sectors, buff, READ);
 		break;
 
+	case CMD_READ_DMA:
+	case CMD_READ_DMA_EXT:
+		ret = ata_dma(dev, sectors, buff, READ);
+		break;
+
 	case CMD_WRITE_PIO:
 	case CMD_WRITE_PIO_EXT:
-		if ((ret = ata_pio(dev, sectors, buff, WRITE)) < 0)
-			break;
+	case CMD_WRITE_MULT:
+	case CMD_WRITE_MULT_EXT:
+		ret = ata_pio(dev, sectors, buff, WRITE);
+		break;
 
-		/* Flush the hardware cache */
-		cmd = (dev->mode == LBA48) ? CMD_CACHE_FLUSH_EXT : CMD_CACHE_FLUSH;
-		ata_writereg(base, REG_CMD, cmd, 1);
+	case CMD_WRITE_DMA:
+	case CMD_WRITE_DMA_EXT:
+	case CMD_WRITE_DMA_FUA_EXT:
+		ret = ata_dma(dev, sectors, buff, WRITE);
 		break;
 	}
 
@@ -294,31 +491,109 @@ static ssize_t _ata_access(ata_dev_t *dev, uint64_t lba, uint16_t sectors, uint8
 }
 
 
-ssize_t ata_read(ata_dev_t *dev, offs_t offs, char *buff, size_t len)
+/* Flushes device write cache */
+static int _ata_flush(ata_dev_t *dev)
+{
+	ata_bus_t *bus = dev->bus;
+	int err;
+
+	/* Wait until BSY clears */
+	if ((err = ata_wait(bus, STATUS_BSY, 0)) < 0)
+		return err;
+
+	ata_select(dev, 0, 0, dev->mode);
+	ata_writereg(bus->base, REG_CMD, (dev->mode == LBA48) ? CMD_CACHE_FLUSH_EXT : CMD_CACHE_FLUSH, 1);
+	ata_delay(bus);
+
+	/* Wait until the cache is written to the media */
+	ata_sleep(bus, 0);
+	if (ata_wait(bus, STATUS_BSY, 0) < 0)
+		return -EIO;
+
+	return EOK;
+}
+
+
+/* Returns read/write command for the device */
+static uint8_t ata_cmd(ata_dev_t *dev, uint8_t dir, uint8_t dma)
 {
+	if (dma) {
+		if (dev->mode == LBA48)
+			return (dir == READ) ? CMD_READ_DMA_EXT : CMD_WRITE_DMA_EXT;
+		return (dir == READ) ? CMD_READ_DMA : CMD_WRITE_DMA;
+	}
+
+	if (dev->multiple) {
+		if (dev->mode == LBA48)
+			return (dir == READ) ? CMD_READ_MULT_EXT : CMD_WRITE_MULT_EXT;
+		return (dir == READ) ? CMD_READ_MULT : CMD_WRITE_MULT;
+	}
+
+	if (dev->mode == LBA48)
+		return (dir == READ) ? CMD_READ_PIO_EXT : CMD_WRITE_PIO_EXT;
+	return (dir == READ) ? CMD_READ_PIO : CMD_WRITE_PIO;
+}
+
+
+/* Transfers sectors using bus master DMA if available, PIO otherwise (split into commands of max sectors) */
+static ssize_t _ata_transfer(ata_dev_t *dev, uint64_t lba, uint32_t sectors, uint8_t *buff, uint8_t dir, uint8_t fua)
+{
+	uint32_t n = 0, count, maxsect = (dev->mode == LBA48) ? ATA_MAXSECT48 : ATA_MAXSECT28;
 	uint8_t cmd;
 	ssize_t ret;
+	int err;
+
+	/* FUA is available only for LBA48 DMA writes, otherwise the write is followed by cache flush */
+	cmd = ata_cmd(dev, dir, 1);
+	if (fua && dev->fua && (cmd == CMD_WRITE_DMA_EXT))
+		cmd = CMD_WRITE_DMA_FUA_EXT;
+
+	/* DMA transfers go through the bounce buffer */
+	while (dev->dma && (n < sectors)) {
+		count = min(sectors - n, min(maxsect, ATA_DMABUFSZ / dev->sectorsz));
+
+		if ((ret = _ata_access(dev, lba + n, count, cmd, buff + (size_t)n * dev->sectorsz)) < 0) {
+			fprintf(stderr, "pc-ata: DMA transfer failed (%d), switching device to PIO mode\n", (int)ret);
+			dev->dma = DMA_NONE;
+			break;
+		}
+		n += count;
+	}
+
+	if (n < sectors)
+		cmd = ata_cmd(dev, dir, 0);
+
+	while (n < sectors) {
+		count = min(sectors - n, maxsect);
+
+		if ((ret = _ata_access(dev, lba + n, count, cmd, buff + (size_t)n * dev->sectorsz)) < 0)
+			return ret;
+		n += count;
+	}
+
+	if (fua && (cmd != CMD_WRITE_DMA_FUA_EXT) && ((err = _ata_flush(dev)) < 0))
+		return err;
+
+	return (ssize_t)sectors * dev->sectorsz;
+}
+
+
+ssize_t ata_read(ata_dev_t *dev, offs_t offs, char *buff, size_t len)
+{
+	ssize_t ret;
 
 	if (!len)
 		return 0;
 
-	switch (dev->mode) {
-	case CHS:
-	case LBA28:
-		cmd = CMD_READ_PIO;
-		break;
-
-	case LBA48:
-		cmd = CMD_READ_PIO_EXT;
-		break;
+	if (dev->port != NULL)
+		return ahci_access(dev, (uint64_t)(offs / dev->sectorsz), (uint32_t)(len / dev->sectorsz), (uint8_t *)buff, READ, 0);
 
-	default:
+	if (dev->mode > LBA48)
 		return -1;
-	}
 
 	mutexLock(dev->bus->lock);
 
-	ret = _ata_access(dev, (uint64_t)(offs / dev->sectorsz), (uint16_t)(len / dev->sectorsz), cmd, (uint8_t *)buff);
+	ret = _ata_transfer(dev, (uint64_t)(offs / dev->sectorsz), (uint32_t)(len / dev->sectorsz), (uint8_t *)buff, READ, 0);
 
 	mutexUnlock(dev->bus->lock);
 
@@ -326,31 +601,22 @@ ssize_t ata_read(ata_dev_t *dev, offs_t offs, char *buff, size_t len)
 }
 
 
-ssize_t ata_write(ata_dev_t *dev, offs_t offs, const char *buff, size_t len)
+static ssize_t ata_dowrite(ata_dev_t *dev, offs_t offs, const char *buff, size_t len, uint8_t fua)
 {
-	uint8_t cmd;
 	ssize_t ret;
 
 	if (!len)
 		return 0;
 
-	switch (dev->mode) {
-	case CHS:
-	case LBA28:
-		cmd = CMD_WRITE_PIO;
-		break;
-
-	case LBA48:
-		cmd = CMD_WRITE_PIO_EXT;
-		break;
+	if (dev->port != NULL)
+		return ahci_access(dev, (uint64_t)(offs / dev->sectorsz), (uint32_t)(len / dev->sectorsz), (uint8_t *)buff, WRITE, fua);
 
-	default:
+	if (dev->mode > LBA48)
 		return -1;
-	}
 
 	mutexLock(dev->bus->lock);
 
-	ret = _ata_access(dev, (uint64_t)(offs / dev->sectorsz), (uint16_t)(len / dev->sectorsz), cmd, (uint8_t *)buff);
+	ret = _ata_transfer(dev, (uint64_t)(offs / dev->sectorsz), (uint32_t)(len / dev->sectorsz), (uint8_t *)buff, WRITE, fua);
 
 	mutexUnlock(dev->bus->lock);
 
@@ -358,6 +624,35 @@ ssize_t ata_write(ata_dev_t *dev, offs_t offs, const char *buff, size_t len)
 }
 
 
+ssize_t ata_write(ata_dev_t *dev, offs_t offs, const char *buff, size_t len)
+{
+	return ata_dowrite(dev, offs, buff, len, 0);
+}
+
+
+ssize_t ata_writefua(ata_dev_t *dev, offs_t offs, const char *buff, size_t len)
+{
+	return ata_dowrite(dev, offs, buff, len, 1);
+}
+
+
+int ata_flush(ata_dev_t *dev)
+{
+	int err;
+
+	if (dev->port != NULL)
+		return ahci_flush(dev);
+
+	mutexLock(dev->bus->lock);
+
+	err = _ata_flush(dev);
+
+	mutexUnlock(dev->bus->lock);
+
+	return err;
+}
+
+
 static int ata_initdev(ata_bus_t *bus, ata_dev_t *dev)
 {
 	void *base = bus->base;
@@ -366,7 +661,11 @@ static int ata_initdev(ata_bus_t *bus, ata_dev_t *dev)
 	int err, i;
 
 	dev->pio = PIO_DEFAULT;
+	dev->dma = DMA_NONE;
+	dev->fua = 0;
+	dev->multiple = 0;
 	dev->bus = bus;
+	dev->port = NULL;
 
 	/* Select the device */
 	ata_select(dev, 0, 0, -1);
@@ -424,6 +723,58 @@ static int ata_initdev(ata_bus_t *bus, ata_dev_t *dev)
 	if (!dev->sectorsz)
 		dev->sectorsz = 512;
 
+	/* Check WRITE DMA FUA EXT support (word 84 bit 6, valid if bits 15:14 = 01b) */
+	if ((dev->mode == LBA48) && ((info[168] & 0xc0) == 0x40) && (info[169] & 0x40))
+		dev->fua = 1;
+
+	/* Check DMA support */
+	if ((bus->bmide != NULL) && (info[98] & 1) && (dev->sectorsz <= ATA_DMABUFSZ)) {
+		/* Select the highest supported UDMA mode (if reported) */
+		if (info[107] & 4) {
+			for (i = 6; i >= 0; i--) {
+				if (info[177] & (1 << i)) {
+					dev->dma = UDMA_0 + i;
+					break;
+				}
+			}
+
+			/* UDMA modes above 2 require 80-conductor cable */
+			if ((dev->dma > UDMA_2) && !(info[186] & 0x20))
+				dev->dma = UDMA_2;
+		}
+
+		/* Select the highest supported MWDMA mode */
+		if (dev->dma == DMA_NONE) {
+			for (i = 2; i >= 0; i--) {
+				if (info[127] & (1 << i)) {
+					dev->dma = MWDMA_0 + i;
+					break;
+				}
+			}
+		}
+
+		if (dev->dma != DMA_NONE) {
+			/* Write features - set DMA mode */
+			ata_writereg(base, REG_FEATURES, 0x03, 1);
+			ata_writereg(base, REG_NSECTORS, dev->dma, 1);
+
+			/* Send set features command */
+			ata_writereg(base, REG_CMD, CMD_SET_FEATUERS, 1);
+			if (ata_wait(bus, STATUS_BSY, 0) < 0)
+				dev->dma = DMA_NONE;
+		}
+	}
+
+	/* Enable READ/WRITE MULTIPLE with the largest supported block (power of 2 sectors, word 47 bits 7:0) */
+	if ((info[94] == 0x80) && (info[95] > 1)) {
+		for (i = 0x80; i > info[95]; i >>= 1);
+
+		ata_writereg(base, REG_NSECTORS, i, 1);
+		ata_writereg(base, REG_CMD, CMD_SET_MULT, 1);
+		if (ata_wait(bus, STATUS_BSY, 0) == EOK)
+			dev->multiple = i;
+	}
+
 	switch (dev->mode) {
 	case CHS:
 		dev->size = (uint64_t)dev->cylinders * dev->heads * dev->sectors;
@@ -455,22 +806,70 @@ static int ata_initdev(ata_bus_t *bus, ata_dev_t *dev)
 }
 
 
-static int ata_initbus(void *base, void *ctrl, ata_bus_t *bus)
+/* Allocates bus master DMA buffers, disables bus mastering on failure */
+static void ata_initdma(ata_bus_t *bus)
+{
+	unsigned int i;
+
+	if (bus->bmide == NULL)
+		return;
+
+	if ((bus->prdt = mmap(NULL, _PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS, OID_NULL, 0)) == MAP_FAILED) {
+		bus->bmide = NULL;
+		return;
+	}
+
+	if ((bus->dmabuf = mmap(NULL, ATA_DMABUFSZ, PROT_READ | PROT_WRITE, MAP_ANONYMOUS, OID_NULL, 0)) == MAP_FAILED) {
+		munmap(bus->prdt, _PAGE_SIZE);
+		bus->bmide = NULL;
+		return;
+	}
+
+	/* Touch the pages, then point one PRD entry at each page */
+	memset(bus->prdt, 0, _PAGE_SIZE);
+	memset(bus->dmabuf, 0, ATA_DMABUFSZ);
+
+	for (i = 0; i < ATA_DMABUFSZ / _PAGE_SIZE; i++) {
+		bus->prdt[2 * i + 0] = htole32((uint32_t)va2pa(bus->dmabuf + i * _PAGE_SIZE));
+		bus->prdt[2 * i + 1] = htole32(_PAGE_SIZE);
+	}
+}
+
+
+static void ata_freedma(ata_bus_t *bus)
+{
+	if (bus->bmide == NULL)
+		return;
+
+	munmap(bus->dmabuf, ATA_DMABUFSZ);
+	munmap(bus->prdt, _PAGE_SIZE);
+}
+
+
+static int ata_initbus(void *base, void *ctrl, void *bmide, unsigned int irq, ata_bus_t *bus)
 {
 	int err;
 
 	bus->base = base;
 	bus->ctrl = ctrl;
+	bus->bmide = bmide;
+	bus->sel = NULL;
+	bus->irq = 0;
 
 	/* Floating bus check */
 	if (ata_readreg(base, REG_STATUS, 1) == 0xff)
 		return -ENXIO;
 
-	if ((bus->devs[MASTER] = (ata_dev_t *)malloc(sizeof(ata_dev_t))) == NULL)
+	ata_initdma(bus);
+
+	if ((bus->devs[MASTER] = (ata_dev_t *)malloc(sizeof(ata_dev_t))) == NULL) {
+		ata_freedma(bus);
 		return -ENOMEM;
+	}
 
 	if ((bus->devs[SLAVE] = (ata_dev_t *)malloc(sizeof(ata_dev_t))) == NULL) {
 		free(bus->devs[MASTER]);
+		ata_freedma(bus);
 		return -ENOMEM;
 	}
 
@@ -487,15 +886,45 @@ static int ata_initbus(void *base, void *ctrl, ata_bus_t *bus)
 		bus->devs[SLAVE] = NULL;
 	}
 
-	if (bus->devs[MASTER] == NULL && bus->devs[SLAVE] == NULL)
+	if (bus->devs[MASTER] == NULL && bus->devs[SLAVE] == NULL) {
+		ata_freedma(bus);
 		return -ENXIO;
+	}
 
 	if ((err = mutexCreate(&bus->lock)) < 0) {
 		free(bus->devs[MASTER]);
 		free(bus->devs[SLAVE]);
+		ata_freedma(bus);
 		return err;
 	}
 
+	if ((err = mutexCreate(&bus->ilock)) < 0) {
+		resourceDestroy(bus->lock);
+		free(bus->devs[MASTER]);
+		free(bus->devs[SLAVE]);
+		ata_freedma(bus);
+		return err;
+	}
+
+	if ((err = condCreate(&bus->icond)) < 0) {
+		resourceDestroy(bus->ilock);
+		resourceDestroy(bus->lock);
+		free(bus->devs[MASTER]);
+		free(bus->devs[SLAVE]);
+		ata_freedma(bus);
+		return err;
+	}
+
+	/* Completions are polled if the interrupt can't be attached */
+	if (interrupt(irq, ata_interrupt, bus, bus->icond, &bus->inth) < 0) {
+		fprintf(stderr, "pc-ata: failed to attach ATA bus interrupt %u, using polling\n", irq);
+	}
+	else {
+		bus->irq = irq;
+		/* Enable device interrupts */
+		ata_writereg(ctrl, REG_CTRL, 0, 1);
+	}
+
 	LIST_ADD(&buses, bus);
 
 	if (bus->devs[MASTER] != NULL) {
@@ -515,6 +944,7 @@ static int ata_initbus(void *base, void *ctrl, ata_bus_t *bus)
 int ata_init(void)
 {
 	ata_bus_t *bus1, *bus2;
+	void *bmide;
 
 	ata_common.ndevs = 0;
 	ata_common.devs = NULL;
@@ -528,11 +958,17 @@ int ata_init(void)
 		return -ENOMEM;
 	}
 
-	if (ata_initbus((void *)(ATA1_BASE | 0x1), (void *)(ATA1_CTRL | 0x1), bus1) < 0)
+	/* Detect bus master IDE (primary channel registers first, secondary at BM_OFFSET) */
+	bmide = ata_findbmide();
+
+	if (ata_initbus((void *)(ATA1_BASE | 0x1), (void *)(ATA1_CTRL | 0x1), bmide, ATA1_IRQ, bus1) < 0)
 		free(bus1);
 
-	if (ata_initbus((void *)(ATA2_BASE | 0x1), (void *)(ATA2_CTRL | 0x1), bus2) < 0)
+	if (ata_initbus((void *)(ATA2_BASE | 0x1), (void *)(ATA2_CTRL | 0x1), (bmide == NULL) ? NULL : (uint8_t *)bmide + BM_OFFSET, ATA2_IRQ, bus2) < 0)
 		free(bus2);
 
+	/* Detect SATA disks attached to AHCI controllers */
+	ahci_init();
+
 	return EOK;
 }
@@ -33,6 +33,23 @@
 #define ATA4_BASE (ATA3_BASE - PORT_OFFSET)
 #define ATA4_CTRL (ATA3_CTRL - PORT_OFFSET)
 
+/* ATA standard IRQs (compatibility mode) */
+#define ATA1_IRQ 14
+#define ATA2_IRQ 15
+
+/* Offset between bus master IDE registers of primary and secondary channel */
+#define BM_OFFSET 0x8
+
+/* DMA bounce buffer size (one PRD entry per page) */
+#define ATA_DMABUFSZ (32 * _PAGE_SIZE)
+
+/* Device interrupt wait timeout (lost interrupts) in us */
+#define ATA_POLL 10000
+
+/* Max number of sectors transferred with one command */
+#define ATA_MAXSECT28 256
+#define ATA_MAXSECT48 65536
+
 
 /* ATA device numbers */
 enum { MASTER, SLAVE };
@@ -57,17 +74,39 @@ enum {
 };
 
 
+/* ATA DMA transfer modes */
+enum {
+	DMA_NONE            = 0x00, /* DMA not used */
+	MWDMA_0             = 0x20, /* max 4,2  MB/s */
+	MWDMA_1             = 0x21, /* max 13,3 MB/s */
+	MWDMA_2             = 0x22, /* max 16,7 MB/s */
+	UDMA_0              = 0x40, /* max 16,7 MB/s */
+	UDMA_1              = 0x41, /* max 25   MB/s */
+	UDMA_2              = 0x42, /* max 33,3 MB/s */
+	UDMA_3              = 0x43, /* max 44,4 MB/s */
+	UDMA_4              = 0x44, /* max 66,7 MB/s */
+	UDMA_5              = 0x45, /* max 100  MB/s */
+	UDMA_6              = 0x46  /* max 133  MB/s */
+};
+
+
 /* ATA commands */
 enum {
 	CMD_NOP             = 0x00,
 	CMD_READ_PIO        = 0x20,
 	CMD_READ_PIO_EXT    = 0x24,
 	CMD_READ_DMA_EXT    = 0x25,
+	CMD_READ_MULT_EXT   = 0x29,
 	CMD_WRITE_PIO       = 0x30,
 	CMD_WRITE_PIO_EXT   = 0x34,
 	CMD_WRITE_DMA_EXT   = 0x35,
+	CMD_WRITE_MULT_EXT  = 0x39,
+	CMD_WRITE_DMA_FUA_EXT = 0x3d,
 	CMD_PACKET          = 0xa0,
 	CMD_IDENTIFY_PACKET = 0xa1,
+	CMD_READ_MULT       = 0xc4,
+	CMD_WRITE_MULT      = 0xc5,
+	CMD_SET_MULT        = 0xc6,
 	CMD_READ_DMA        = 0xc8,
 	CMD_WRITE_DMA       = 0xca,
 	CMD_CACHE_FLUSH     = 0xe7,
@@ -94,6 +133,35 @@ enum {
 };
 
 
+/* Bus master IDE registers */
+enum {
+	BM_CMD              = 0x0, /* Bus master command */
+	BM_STATUS           = 0x2, /* Bus master status */
+	BM_PRDT             = 0x4  /* PRD table physical address */
+};
+
+
+/* BM_CMD layout */
+enum {
+	BM_CMD_START        = 0x01, /* Start bus master transfer */
+	BM_CMD_READ         = 0x08  /* 0: memory -> device, 1: device -> memory */
+};
+
+
+/* BM_STATUS layout */
+enum {
+	BM_STATUS_ACTIVE    = 0x01, /* Bus master transfer in progress */
+	BM_STATUS_ERR       = 0x02, /* Transfer error */
+	BM_STATUS_IRQ       = 0x04  /* Device interrupt asserted */
+};
+
+
+/* PRD entry flags */
+enum {
+	PRD_EOT             = 0x80000000 /* Last PRD table entry */
+};
+
+
 /* REG_CTRL layout */
 enum {
 	CTRL_NIEN           = 0x02, /* Not Interrupt ENabled */
@@ -125,12 +193,16 @@ enum {
 
 typedef struct _ata_dev_t ata_dev_t;
 typedef struct _ata_bus_t ata_bus_t;
+typedef struct _ahci_port_t ahci_port_t;
 
 
 struct _ata_dev_t {
 	/* Device configuration */
 	uint8_t pio;            /* PIO mode: PIO_DEFAULT, PIO_0, PIO_1, PIO_2, PIO_3, PIO_4 */
+	uint8_t dma;            /* DMA mode: DMA_NONE, MWDMA_0 - MWDMA_2, UDMA_0 - UDMA_6 */
 	uint8_t mode;           /* Addressing mode: CHS, LBA28, LBA48 */
+	uint8_t fua;            /* Force Unit Access writes support */
+	uint8_t multiple;       /* Sectors per PIO data block (READ/WRITE MULTIPLE), 0 if not used */
 
 	/* Device geometry */
 	uint16_t cylinders;     /* Number of cylinders */
@@ -139,7 +211,8 @@ struct _ata_dev_t {
 	uint32_t sectorsz;      /* Sector size */
 	uint64_t size;          /* Storage size */
 
-	ata_bus_t *bus;         /* ATA bus the device is attached to */
+	ata_bus_t *bus;         /* ATA bus the device is attached to (NULL for AHCI devices) */
+	ahci_port_t *port;      /* AHCI port the device is attached to (NULL for IDE devices) */
 	ata_dev_t *prev, *next; /* Doubly linked list */
 };
 
@@ -148,10 +221,22 @@ struct _ata_bus_t {
 	/* ATA registers access */
 	void *base;             /* ATA bus base registers */
 	void *ctrl;             /* ATA bus control registers */
+	void *bmide;            /* Bus master IDE registers (NULL if bus mastering is not available) */
+
+	/* DMA buffers */
+	uint32_t *prdt;         /* Physical Region Descriptor table */
+	uint8_t *dmabuf;        /* DMA bounce buffer */
 
 	ata_dev_t *devs[2];     /* ATA devices attached to the bus */
+	ata_dev_t *sel;         /* Last selected device */
 	ata_bus_t *prev, *next; /* Doubly linked list */
 
+	/* Interrupt */
+	unsigned int irq;       /* Bus IRQ number (0 if completions are polled) */
+	handle_t inth;          /* Interrupt handle */
+	handle_t ilock;         /* Interrupt mutex */
+	handle_t icond;         /* Interrupt condition */
+
 	/* Synchronization */
 	handle_t lock;          /* Access mutex */
 };
@@ -170,10 +255,18 @@ extern ata_common_t ata_common;
 extern ssize_t ata_read(ata_dev_t *dev, offs_t offs, char *buff, size_t len);
 
 
-/* Writes to ATA device */
+/* Writes to ATA device (data may stay in device write cache) */
 extern ssize_t ata_write(ata_dev_t *dev, offs_t offs, const char *buff, size_t len);
 
 
+/* Writes to ATA device, data is on the media when it returns (FUA or cache flush) */
+extern ssize_t ata_writefua(ata_dev_t *dev, offs_t offs, const char *buff, size_t len);
+
+
+/* Flushes ATA device write cache */
+extern int ata_flush(ata_dev_t *dev);
+
+
 /* Initializes ATA devices */
 extern int ata_init(void);
 
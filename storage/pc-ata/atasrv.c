@@ -31,11 +31,16 @@
 #include <libext2.h>
 
 #include "ata.h"
+#include "atasrv.h"
+#include "cache.h"
 #include "mbr.h"
+#include "iosched.h"
 
 
 /* Misc definitions */
-#define HDD_BASE "/dev/hd" /* Base name for HDD devices */
+#define HDD_BASE   "/dev/hd"      /* Base name for HDD devices */
+#define CACHE_SIZE (1024 * 1024)  /* Default cache size (shared by all ATA devices) */
+#define REQ_POOL   32             /* Number of preallocated filesystem requests */
 
 
 /* ATA server device types */
@@ -88,6 +93,8 @@ struct _atasrv_base_t {
 	unsigned int npdevs;        /* Number of partitions within the device */
 	atasrv_dev_t *pdevs;        /* Device partitions */
 	ata_dev_t *dev;             /* Underlaying ATA device */
+	iosched_t *sched;           /* Device I/O scheduler (shared by devices on the same IDE bus) */
+	cache_t *cache;             /* Device cache (NULL if disabled) */
 };
 
 
@@ -122,8 +129,11 @@ struct {
 	unsigned int ndevs;         /* Number of registered ATA devices */
 	idtree_t sdevs;             /* Registered ATA server devices */
 	rbtree_t fss;               /* Registered filesystems */
+	atasrv_req_t reqs[REQ_POOL];/* Preallocated requests */
+	atasrv_req_t *rfree;        /* Free requests pool */
 	atasrv_req_t *rqueue;       /* Requests FIFO queue */
 	handle_t rlock, rcond;      /* Requests synchronization */
+	handle_t fcond;             /* Request released */
 
 	/* Pool threads stacks */
 	char pstacks[4][4 * _PAGE_SIZE] __attribute__((aligned(8)));
@@ -190,8 +200,13 @@ static void atasrv_fsthr(void *arg)
 	int umount = 0;
 
 	for (;;) {
-		if ((req = (atasrv_req_t *)malloc(sizeof(atasrv_req_t))) == NULL)
-			continue;
+		mutexLock(atasrv_common.rlock);
+
+		while ((req = atasrv_common.rfree) == NULL)
+			condWait(atasrv_common.fcond, atasrv_common.rlock, 0);
+		LIST_REMOVE(&atasrv_common.rfree, req);
+
+		mutexUnlock(atasrv_common.rlock);
 
 		req->part = part;
 		while (msgRecv(req->part->port, &req->msg, &req->rid) < 0);
@@ -212,6 +227,20 @@ static void atasrv_fsthr(void *arg)
 }
 
 
+/* Writes back device cache and flushes disk write cache */
+static int atasrv_syncbase(atasrv_base_t *base)
+{
+	int err;
+
+	if ((base->cache != NULL) && ((err = cache_flush(base->cache)) < 0)) {
+		ata_flush(base->dev);
+		return err;
+	}
+
+	return ata_flush(base->dev);
+}
+
+
 static void atasrv_poolthr(void *arg)
 {
 	atasrv_req_t *req;
@@ -221,7 +250,7 @@ static void atasrv_poolthr(void *arg)
 
 		while (atasrv_common.rqueue == NULL)
 			condWait(atasrv_common.rcond, atasrv_common.rlock, 0);
-		req = atasrv_common.rqueue->prev;
+		req = atasrv_common.rqueue;
 		LIST_REMOVE(&atasrv_common.rqueue, req);
 
 		mutexUnlock(atasrv_common.rlock);
@@ -235,9 +264,47 @@ static void atasrv_poolthr(void *arg)
 			req->part->fs->handler(req->part->fdata, &req->msg);
 		}
 
+		/* Write back device and disk caches after filesystem sync and umount */
+		if ((req->msg.type == mtSync) || (req->msg.type == mtUmount))
+			atasrv_syncbase(req->part->bdev->base);
+
 		msgRespond(req->part->port, &req->msg, req->rid);
-		free(req);
+
+		mutexLock(atasrv_common.rlock);
+		LIST_ADD(&atasrv_common.rfree, req);
+		mutexUnlock(atasrv_common.rlock);
+		condSignal(atasrv_common.fcond);
+	}
+}
+
+
+/* Returns I/O scheduler for the device, devices on the same IDE bus share one queue and worker */
+static iosched_t *atasrv_getsched(ata_dev_t *dev)
+{
+	atasrv_dev_t *bdev;
+	iosched_t *sched;
+	unsigned int i;
+
+	if (dev->bus != NULL) {
+		for (i = 0; i < atasrv_common.ndevs; i++) {
+			if ((bdev = lib_treeof(atasrv_dev_t, node, idtree_find(&atasrv_common.sdevs, i))) == NULL)
+				continue;
+
+			if (bdev->base->dev->bus == dev->bus)
+				return bdev->base->sched;
+		}
+	}
+
+	if ((sched = (iosched_t *)malloc(sizeof(iosched_t))) == NULL)
+		return NULL;
+
+	/* IDE bus serves one command at a time, AHCI port queues commands in its slots */
+	if (iosched_init(sched, (dev->bus != NULL) ? 1 : IOSCHED_WORKERS) < 0) {
+		free(sched);
+		return NULL;
 	}
+
+	return sched;
 }
 
 
@@ -253,12 +320,19 @@ static int atasrv_initbase(ata_dev_t *dev)
 		return -ENOMEM;
 	}
 
+	if ((sdev->base->sched = atasrv_getsched(dev)) == NULL) {
+		free(sdev->base);
+		free(sdev);
+		return -ENOMEM;
+	}
+
 	sdev->type = DEV_BASE;
 	sdev->prev = NULL;
 	sdev->next = NULL;
 	sdev->base->npdevs = 0;
 	sdev->base->pdevs = NULL;
 	sdev->base->dev = dev;
+	sdev->base->cache = NULL;
 	sdev->base->number = atasrv_common.ndevs++;
 	idtree_alloc(&atasrv_common.sdevs, &sdev->node);
 
@@ -308,6 +382,7 @@ static int atasrv_initpart(atasrv_dev_t *bdev, uint8_t type, uint32_t start, uin
 static ssize_t atasrv_read(id_t id, offs_t offs, char *buff, size_t len)
 {
 	atasrv_dev_t *sdev;
+	atasrv_base_t *base;
 	ata_dev_t *dev;
 
 	if ((sdev = lib_treeof(atasrv_dev_t, node, idtree_find(&atasrv_common.sdevs, id))) == NULL)
@@ -315,7 +390,8 @@ static ssize_t atasrv_read(id_t id, offs_t offs, char *buff, size_t len)
 
 	switch (sdev->type) {
 	case DEV_BASE:
-		dev = sdev->base->dev;
+		base = sdev->base;
+		dev = base->dev;
 		if (offs + len > dev->size) {
 			if (offs > dev->size)
 				return -EINVAL;
@@ -324,7 +400,8 @@ static ssize_t atasrv_read(id_t id, offs_t offs, char *buff, size_t len)
 		break;
 
 	case DEV_PART:
-		dev = sdev->part->bdev->base->dev;
+		base = sdev->part->bdev->base;
+		dev = base->dev;
 		if (offs + len > sdev->part->sectors * dev->sectorsz) {
 			if (offs > sdev->part->sectors * dev->sectorsz)
 				return -EINVAL;
@@ -337,13 +414,18 @@ static ssize_t atasrv_read(id_t id, offs_t offs, char *buff, size_t len)
 		return -1;
 	}
 
-	return ata_read(dev, offs, buff, len);
+	if (base->cache != NULL)
+		return cache_read(base->cache, offs, buff, len);
+
+	return iosched_read(base->sched, dev, offs, buff, len);
 }
 
 
-static ssize_t atasrv_write(id_t id, offs_t offs, const char *buff, size_t len)
+/* Writes to ATA device, fua forces data to the media before returning */
+static ssize_t atasrv_dowrite(id_t id, offs_t offs, const char *buff, size_t len, uint8_t fua)
 {
 	atasrv_dev_t *sdev;
+	atasrv_base_t *base;
 	ata_dev_t *dev;
 
 	if ((sdev = lib_treeof(atasrv_dev_t, node, idtree_find(&atasrv_common.sdevs, id))) == NULL)
@@ -351,7 +433,8 @@ static ssize_t atasrv_write(id_t id, offs_t offs, const char *buff, size_t len)
 
 	switch (sdev->type) {
 	case DEV_BASE:
-		dev = sdev->base->dev;
+		base = sdev->base;
+		dev = base->dev;
 		if (offs + len > dev->size) {
 			if (offs > dev->size)
 				return -EINVAL;
@@ -360,7 +443,8 @@ static ssize_t atasrv_write(id_t id, offs_t offs, const char *buff, size_t len)
 		break;
 
 	case DEV_PART:
-		dev = sdev->part->bdev->base->dev;
+		base = sdev->part->bdev->base;
+		dev = base->dev;
 		if (offs + len > sdev->part->sectors * dev->sectorsz) {
 			if (offs > sdev->part->sectors * dev->sectorsz)
 				return -EINVAL;
@@ -373,7 +457,16 @@ static ssize_t atasrv_write(id_t id, offs_t offs, const char *buff, size_t len)
 		return -1;
 	}
 
-	return ata_write(dev, offs, buff, len);
+	if (base->cache != NULL)
+		return cache_write(base->cache, offs, buff, len, fua);
+
+	return iosched_write(base->sched, dev, offs, buff, len, fua);
+}
+
+
+static ssize_t atasrv_write(id_t id, offs_t offs, const char *buff, size_t len)
+{
+	return atasrv_dowrite(id, offs, buff, len, 0);
 }
 
 
@@ -417,6 +510,87 @@ static int atasrv_mount(id_t id, const char *name, oid_t *oid)
 }
 
 
+/* Writes back all devices caches and flushes disks write caches */
+static int atasrv_sync(void)
+{
+	atasrv_dev_t *bdev;
+	unsigned int i;
+	int ret, err = EOK;
+
+	for (i = 0; i < atasrv_common.ndevs; i++) {
+		if ((bdev = lib_treeof(atasrv_dev_t, node, idtree_find(&atasrv_common.sdevs, i))) == NULL)
+			return -ENODEV;
+
+		if ((ret = atasrv_syncbase(bdev->base)) < 0)
+			err = ret;
+	}
+
+	return err;
+}
+
+
+static void atasrv_devctl(msg_t *msg)
+{
+	atasrv_i_devctl_t *idevctl = (atasrv_i_devctl_t *)msg->i.raw;
+	atasrv_o_devctl_t *odevctl = (atasrv_o_devctl_t *)msg->o.raw;
+	atasrv_dev_t *sdev;
+
+	if ((sdev = lib_treeof(atasrv_dev_t, node, idtree_find(&atasrv_common.sdevs, idevctl->oid.id))) == NULL) {
+		odevctl->err = -ENODEV;
+		return;
+	}
+
+	switch (idevctl->type) {
+	case atasrv_devctl_sync:
+		odevctl->err = atasrv_syncbase((sdev->type == DEV_BASE) ? sdev->base : sdev->part->bdev->base);
+		break;
+
+	case atasrv_devctl_writesync:
+		odevctl->err = atasrv_dowrite(idevctl->oid.id, idevctl->offs, msg->i.data, msg->i.size, 1);
+		break;
+
+	default:
+		odevctl->err = -EINVAL;
+		break;
+	}
+}
+
+
+/* (Re)creates devices caches, size is divided equally between ATA devices */
+static int atasrv_initcaches(size_t size)
+{
+	atasrv_dev_t *bdev;
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < atasrv_common.ndevs; i++) {
+		if ((bdev = lib_treeof(atasrv_dev_t, node, idtree_find(&atasrv_common.sdevs, i))) == NULL)
+			return -ENODEV;
+
+		if (bdev->base->cache != NULL) {
+			cache_flush(bdev->base->cache);
+			cache_destroy(bdev->base->cache);
+			free(bdev->base->cache);
+			bdev->base->cache = NULL;
+		}
+
+		if (!size)
+			continue;
+
+		if ((bdev->base->cache = (cache_t *)malloc(sizeof(cache_t))) == NULL)
+			return -ENOMEM;
+
+		if ((err = cache_init(bdev->base->cache, bdev->base->dev, bdev->base->sched, size / atasrv_common.ndevs)) < 0) {
+			free(bdev->base->cache);
+			bdev->base->cache = NULL;
+			return err;
+		}
+	}
+
+	return EOK;
+}
+
+
 static int atasrv_getattr(id_t id, int type, int *attr)
 {
 	atasrv_dev_t *sdev;
@@ -464,7 +638,7 @@ static void atasrv_msgloop(void *arg)
 			break;
 
 		case mtSync:
-			msg.o.io.err = -ENOSYS;
+			msg.o.io.err = atasrv_sync();
 			break;
 
 		case mtRead:
@@ -479,6 +653,10 @@ static void atasrv_msgloop(void *arg)
 			atasrv_getattr(msg.i.attr.oid.id, msg.i.attr.type, &msg.o.attr.val);
 			break;
 
+		case mtDevCtl:
+			atasrv_devctl(&msg);
+			break;
+
 		default:
 			msg.o.io.err = -EINVAL;
 			break;
@@ -491,7 +669,7 @@ static void atasrv_msgloop(void *arg)
 
 static void atasrv_usage(const char *prog)
 {
-	printf("Usage: %s [options] or no args to mount first MBR partition as root\n", prog);
+	printf("Usage: %s [options], without -p and -r first MBR partition is mounted as root\n", prog);
 	printf("\t-p <id> <type> <start> <size> - registers partition\n");
 	printf("\t\tid:    device id starting at 0\n");
 	printf("\t\ttype:  partition type e.g. 0x83 for native Linux partition\n");
@@ -499,6 +677,8 @@ static void atasrv_usage(const char *prog)
 	printf("\t\tsize:  partition size in sectors\n");
 	printf("\t-r <id>                       - mounts root partition\n");
 	printf("\t\tid:    partition id starting at 0\n");
+	printf("\t-c <size>                     - sets cache size (shared by all devices)\n");
+	printf("\t\tsize:  cache size in KB, 0 disables cache (default: %u)\n", CACHE_SIZE / 1024);
 	printf("\t-h                            - shows this help message\n");
 }
 
@@ -516,7 +696,8 @@ int main(int argc, char **argv)
 	rbnode_t *node;
 	mbr_t *mbr;
 	unsigned int i, j, type, start, sectors;
-	int err, c, argn, id, pid, mroot = 0;
+	int err, c, argn, id, pid, mroot = 0, parts = 0;
+	size_t csize = CACHE_SIZE;
 	oid_t oid;
 	char path[32];
 
@@ -569,8 +750,16 @@ int main(int argc, char **argv)
 		return err;
 	}
 
+	if ((err = condCreate(&atasrv_common.fcond)) < 0) {
+		fprintf(stderr, "pc-ata: failed to create server requests pool condition variable\n");
+		return err;
+	}
+
 	atasrv_common.ndevs = 0;
+	atasrv_common.rfree = NULL;
 	atasrv_common.rqueue = NULL;
+	for (i = 0; i < REQ_POOL; i++)
+		LIST_ADD(&atasrv_common.rfree, atasrv_common.reqs + i);
 	idtree_init(&atasrv_common.sdevs);
 	lib_rbInit(&atasrv_common.fss, atasrv_cmpfs, NULL);
 
@@ -587,57 +776,67 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (argc > 1) {
-		/* Process command line options */
-		while ((c = getopt(argc, argv, "p:r:h")) != -1) {
-			switch (c) {
-			case 'p':
-				if ((argn = optind - 1) > argc - 4) {
-					fprintf(stderr, "pc-ata: missing arg(s) for -p option\n");
-					return -EINVAL;
-				}
-
-				id = strtoul(argv[argn++], NULL, 0);
-				type = strtoul(argv[argn++], NULL, 0);
-				start = strtoul(argv[argn++], NULL, 0);
-				sectors = strtoul(argv[argn++], NULL, 0);
-				optind += 3;
-
-				if (((bdev = lib_treeof(atasrv_dev_t, node, idtree_find(&atasrv_common.sdevs, id))) == NULL) || (bdev->type != DEV_BASE)) {
-					fprintf(stderr, "pc-ata: invalid device id (%d) passed to -p option\n", id);
-					return -EINVAL;
-				}
-
-				if ((err = atasrv_initpart(bdev, (uint8_t)type, (uint32_t)start, (uint32_t)sectors)) < 0) {
-					fprintf(stderr, "pc-ata: failed to register partition on device %d starting at LBA %u\n", id, start);
-					return err;
-				}
-				break;
-
-			case 'r':
-				id = strtoul(optarg, NULL, 0);
-
-				if (mroot) {
-					fprintf(stderr, "pc-ata: root partition is already mounted\n");
-					return -EINVAL;
-				}
-
-				if ((err = atasrv_mount(atasrv_common.ndevs + id, NULL, &oid)) < 0) {
-					fprintf(stderr, "pc-ata: failed to mount root partition %d\n", id);
-					return err;
-				}
-
-				mroot = 1;
-				break;
-
-			case 'h':
-			default:
-				atasrv_usage(argv[0]);
-				return EOK;
+	/* Process command line options */
+	while ((c = getopt(argc, argv, "p:r:c:h")) != -1) {
+		switch (c) {
+		case 'p':
+			if ((argn = optind - 1) > argc - 4) {
+				fprintf(stderr, "pc-ata: missing arg(s) for -p option\n");
+				return -EINVAL;
+			}
+
+			id = strtoul(argv[argn++], NULL, 0);
+			type = strtoul(argv[argn++], NULL, 0);
+			start = strtoul(argv[argn++], NULL, 0);
+			sectors = strtoul(argv[argn++], NULL, 0);
+			optind += 3;
+
+			if (((bdev = lib_treeof(atasrv_dev_t, node, idtree_find(&atasrv_common.sdevs, id))) == NULL) || (bdev->type != DEV_BASE)) {
+				fprintf(stderr, "pc-ata: invalid device id (%d) passed to -p option\n", id);
+				return -EINVAL;
 			}
+
+			if ((err = atasrv_initpart(bdev, (uint8_t)type, (uint32_t)start, (uint32_t)sectors)) < 0) {
+				fprintf(stderr, "pc-ata: failed to register partition on device %d starting at LBA %u\n", id, start);
+				return err;
+			}
+			parts = 1;
+			break;
+
+		case 'r':
+			id = strtoul(optarg, NULL, 0);
+
+			if (mroot) {
+				fprintf(stderr, "pc-ata: root partition is already mounted\n");
+				return -EINVAL;
+			}
+
+			if ((err = atasrv_mount(atasrv_common.ndevs + id, NULL, &oid)) < 0) {
+				fprintf(stderr, "pc-ata: failed to mount root partition %d\n", id);
+				return err;
+			}
+
+			mroot = 1;
+			parts = 1;
+			break;
+
+		case 'c':
+			csize = 1024 * strtoul(optarg, NULL, 0);
+			break;
+
+		case 'h':
+		default:
+			atasrv_usage(argv[0]);
+			return EOK;
 		}
 	}
-	else {
+
+	/* Init devices caches (they start empty, so accesses done without them so far stay coherent) */
+	if ((err = atasrv_initcaches(csize)) < 0)
+		fprintf(stderr, "pc-ata: failed to initialize cache (%d)\n", err);
+
+	/* No partitions given on command line */
+	if (!parts) {
 		/* Init partitions from MBR */
 		if ((mbr = (mbr_t *)malloc(sizeof(mbr_t))) == NULL)
 			return -ENOMEM;
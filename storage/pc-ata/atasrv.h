@@ -0,0 +1,40 @@
+/*
+ * Phoenix-RTOS
+ *
+ * ATA server
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _ATASRV_H_
+#define _ATASRV_H_
+
+#include <stdint.h>
+
+#include <sys/types.h>
+
+
+/* ATA server devctl types */
+enum {
+	atasrv_devctl_sync = 0,     /* Writes back device cache and flushes disk write cache */
+	atasrv_devctl_writesync     /* Writes msg.i.data to the media (FUA if supported), returns number of bytes written */
+};
+
+
+typedef struct {
+	int type;                   /* Devctl type */
+	oid_t oid;                  /* ATA device or partition */
+	offs_t offs;                /* atasrv_devctl_writesync: write offset */
+} __attribute__((packed)) atasrv_i_devctl_t;
+
+
+typedef struct {
+	int err;                    /* Error code (or number of bytes written) */
+} __attribute__((packed)) atasrv_o_devctl_t;
+
+
+#endif
@@ -0,0 +1,491 @@
+/*
+ * Phoenix-RTOS
+ *
+ * ATA device block cache
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/list.h>
+#include <sys/minmax.h>
+#include <sys/threads.h>
+
+#include "ata.h"
+#include "cache.h"
+#include "iosched.h"
+
+
+static inline unsigned int cache_hash(cache_t *cache, offs_t offs)
+{
+	return (unsigned int)(offs / cache->blksz) & cache->hmask;
+}
+
+
+/* Returns length of block at offs (last device block may be shorter) */
+static inline size_t cache_blklen(cache_t *cache, offs_t offs)
+{
+	return (size_t)min((uint64_t)cache->blksz, cache->dev->size - offs);
+}
+
+
+static int cache_cmp(const void *b1, const void *b2)
+{
+	offs_t offs1 = (*(cache_blk_t **)b1)->offs;
+	offs_t offs2 = (*(cache_blk_t **)b2)->offs;
+
+	return (offs1 > offs2) - (offs1 < offs2);
+}
+
+
+static cache_blk_t *_cache_find(cache_t *cache, offs_t offs)
+{
+	cache_blk_t *blk;
+
+	for (blk = cache->htab[cache_hash(cache, offs)]; (blk != NULL) && (blk->offs != offs); blk = blk->hnext);
+
+	return blk;
+}
+
+
+static void _cache_unhash(cache_t *cache, cache_blk_t *blk)
+{
+	cache_blk_t **p;
+
+	for (p = cache->htab + cache_hash(cache, blk->offs); *p != blk; p = &(*p)->hnext);
+	*p = blk->hnext;
+
+	blk->hnext = NULL;
+	blk->flags = 0;
+}
+
+
+/* Moves block to the end of LRU list */
+static void _cache_touch(cache_t *cache, cache_blk_t *blk)
+{
+	LIST_REMOVE(&cache->lru, blk);
+	LIST_ADD(&cache->lru, blk);
+}
+
+
+/* Writes back run of n adjacent dirty blocks, drops the lock during I/O (failed blocks stay dirty and get CACHE_ERROR) */
+static int _cache_writeback(cache_t *cache, cache_blk_t **blks, unsigned int n, uint8_t fua)
+{
+	size_t len = 0;
+	ssize_t ret;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		blks[i]->flags |= CACHE_BUSY;
+		len += cache_blklen(cache, blks[i]->offs);
+	}
+
+	if (n > 1)
+		cache->stagebusy = 1;
+	mutexUnlock(cache->lock);
+
+	if (n > 1) {
+		for (i = 0; i < n; i++)
+			memcpy(cache->stage + i * cache->blksz, blks[i]->data, cache_blklen(cache, blks[i]->offs));
+		ret = iosched_write(cache->sched, cache->dev, blks[0]->offs, cache->stage, len, fua);
+	}
+	else {
+		ret = iosched_write(cache->sched, cache->dev, blks[0]->offs, blks[0]->data, len, fua);
+	}
+
+	mutexLock(cache->lock);
+	if (n > 1)
+		cache->stagebusy = 0;
+
+	for (i = 0; i < n; i++) {
+		if (ret == len)
+			blks[i]->flags &= ~(CACHE_BUSY | CACHE_DIRTY | CACHE_ERROR);
+		else
+			blks[i]->flags = (blks[i]->flags & ~CACHE_BUSY) | CACHE_ERROR;
+	}
+	condBroadcast(cache->cond);
+
+	if (ret != len) {
+		fprintf(stderr, "pc-ata: failed to write back %zu bytes at offset %llu\n", len, (unsigned long long)blks[0]->offs);
+		return (ret < 0) ? (int)ret : -EIO;
+	}
+
+	return EOK;
+}
+
+
+/*
+ * Assigns least recently used block to offs. Returns -EAGAIN if the lock
+ * has been dropped (victim written back or all blocks busy) and the caller
+ * has to look the block up again. With nowait set the lock is never dropped.
+ * Blocks which failed to be written back aren't evicted, they're left for
+ * cache_flush() to retry and report.
+ */
+static int _cache_alloc(cache_t *cache, offs_t offs, int nowait, cache_blk_t **blk)
+{
+	cache_blk_t *victim = cache->lru;
+	unsigned int i, h, nbusy = 0;
+
+	for (i = 0; i < cache->nblks; i++, victim = victim->next) {
+		if (victim->flags & CACHE_BUSY)
+			nbusy++;
+		else if (!(victim->flags & CACHE_ERROR))
+			break;
+	}
+
+	if (i == cache->nblks) {
+		if (nowait)
+			return -EAGAIN;
+
+		/* All blocks hold data which couldn't be written back */
+		if (!nbusy)
+			return -ENOSPC;
+
+		condWait(cache->cond, cache->lock, 0);
+		return -EAGAIN;
+	}
+
+	if (victim->flags & CACHE_DIRTY) {
+		if (nowait)
+			return -EAGAIN;
+		/* Write back error belongs to the block's writer, not to the caller */
+		_cache_writeback(cache, &victim, 1, 0);
+		return -EAGAIN;
+	}
+
+	if (victim->flags & CACHE_USED)
+		_cache_unhash(cache, victim);
+
+	h = cache_hash(cache, offs);
+	victim->offs = offs;
+	victim->flags = CACHE_USED;
+	victim->hnext = cache->htab[h];
+	cache->htab[h] = victim;
+	_cache_touch(cache, victim);
+	*blk = victim;
+
+	return EOK;
+}
+
+
+/* Reads up to n blocks starting at (not cached) offs with single device request, drops the lock during I/O */
+static int _cache_fill(cache_t *cache, offs_t offs, unsigned int n)
+{
+	cache_blk_t *blks[CACHE_RAHEAD];
+	size_t len = 0;
+	ssize_t ret;
+	unsigned int i, j;
+	int err;
+
+	/* Without the staging buffer blocks are read one by one */
+	n = (cache->stagebusy) ? 1 : min(n, CACHE_RAHEAD);
+
+	for (i = 0; i < n; i++, offs += cache->blksz) {
+		if ((offs >= cache->dev->size) || ((i > 0) && (_cache_find(cache, offs) != NULL)))
+			break;
+
+		if ((err = _cache_alloc(cache, offs, i > 0, blks + i)) < 0) {
+			if (i == 0)
+				return err;
+			break;
+		}
+
+		blks[i]->flags |= CACHE_BUSY;
+		len += cache_blklen(cache, offs);
+	}
+
+	if (i == 0)
+		return -EINVAL;
+
+	if (i > 1)
+		cache->stagebusy = 1;
+	mutexUnlock(cache->lock);
+
+	if (i > 1) {
+		if ((ret = iosched_read(cache->sched, cache->dev, blks[0]->offs, cache->stage, len)) == len) {
+			for (j = 0; j < i; j++)
+				memcpy(blks[j]->data, cache->stage + j * cache->blksz, cache_blklen(cache, blks[j]->offs));
+		}
+	}
+	else {
+		ret = iosched_read(cache->sched, cache->dev, blks[0]->offs, blks[0]->data, len);
+	}
+
+	mutexLock(cache->lock);
+	if (i > 1)
+		cache->stagebusy = 0;
+
+	for (j = 0; j < i; j++) {
+		if (ret == len)
+			blks[j]->flags = CACHE_USED | CACHE_VALID;
+		else
+			_cache_unhash(cache, blks[j]);
+	}
+	condBroadcast(cache->cond);
+
+	if (ret != len)
+		return (ret < 0) ? (int)ret : -EIO;
+
+	return EOK;
+}
+
+
+ssize_t cache_read(cache_t *cache, offs_t offs, char *buff, size_t len)
+{
+	cache_blk_t *blk;
+	offs_t boffs;
+	size_t pos, n, done = 0;
+	int err = EOK;
+
+	mutexLock(cache->lock);
+
+	/* Sequential reads detection */
+	cache->seq = (offs == cache->raoffs) ? cache->seq + 1 : 0;
+	cache->raoffs = offs + len;
+
+	while (done < len) {
+		pos = offs % cache->blksz;
+		boffs = offs - pos;
+
+		if ((blk = _cache_find(cache, boffs)) == NULL) {
+			/* Read the rest of the request at once, sequential reads also get the read-ahead window */
+			n = (pos + len - done + cache->blksz - 1) / cache->blksz;
+			if (cache->seq)
+				n += CACHE_RAHEAD;
+
+			if (((err = _cache_fill(cache, boffs, n)) < 0) && (err != -EAGAIN))
+				break;
+			err = EOK;
+			continue;
+		}
+
+		if (blk->flags & CACHE_BUSY) {
+			condWait(cache->cond, cache->lock, 0);
+			continue;
+		}
+
+		n = min(len - done, cache->blksz - pos);
+		memcpy(buff + done, blk->data + pos, n);
+		_cache_touch(cache, blk);
+		done += n;
+		offs += n;
+	}
+
+	mutexUnlock(cache->lock);
+
+	if (err < 0)
+		return err;
+
+	return done;
+}
+
+
+ssize_t cache_write(cache_t *cache, offs_t offs, const char *buff, size_t len, uint8_t fua)
+{
+	cache_blk_t *blk;
+	offs_t boffs;
+	size_t pos, n, done = 0;
+	int err = EOK;
+
+	mutexLock(cache->lock);
+
+	while (done < len) {
+		pos = offs % cache->blksz;
+		boffs = offs - pos;
+		n = min(len - done, cache->blksz - pos);
+
+		if ((blk = _cache_find(cache, boffs)) == NULL) {
+			/* Whole block is overwritten, don't read it */
+			if ((pos == 0) && (n == cache_blklen(cache, boffs)))
+				err = _cache_alloc(cache, boffs, 0, &blk);
+			else
+				err = _cache_fill(cache, boffs, 1);
+
+			if ((err < 0) && (err != -EAGAIN))
+				break;
+			err = EOK;
+
+			if (blk == NULL)
+				continue;
+			blk->flags |= CACHE_VALID;
+		}
+		else if (blk->flags & CACHE_BUSY) {
+			condWait(cache->cond, cache->lock, 0);
+			continue;
+		}
+
+		memcpy(blk->data + pos, buff + done, n);
+		blk->flags |= CACHE_DIRTY;
+		_cache_touch(cache, blk);
+
+		/* Write through, block is marked busy before the lock is dropped so it can't be written back without FUA */
+		if (fua && ((err = _cache_writeback(cache, &blk, 1, 1)) < 0))
+			break;
+
+		done += n;
+		offs += n;
+	}
+
+	mutexUnlock(cache->lock);
+
+	if (err < 0)
+		return err;
+
+	return done;
+}
+
+
+int cache_flush(cache_t *cache)
+{
+	cache_blk_t *blk;
+	unsigned int i, j, ndirty, nbusy, nfailed;
+	int ret, err = EOK;
+
+	mutexLock(cache->lock);
+
+	/* Retry blocks which failed to be written back before, each block is tried once */
+	for (i = 0; i < cache->nblks; i++)
+		cache->blks[i].flags &= ~CACHE_ERROR;
+
+	for (;;) {
+		for (i = 0, ndirty = 0, nbusy = 0, nfailed = 0; i < cache->nblks; i++) {
+			blk = cache->blks + i;
+
+			if (!(blk->flags & CACHE_DIRTY))
+				continue;
+
+			if (blk->flags & CACHE_BUSY)
+				nbusy++;
+			else if (blk->flags & CACHE_ERROR)
+				nfailed++;
+			else
+				cache->sorted[ndirty++] = blk;
+		}
+
+		if (!ndirty) {
+			/* Wait for blocks being written back by others */
+			if (!nbusy) {
+				if (nfailed && (err == EOK))
+					err = -EIO;
+				break;
+			}
+			condWait(cache->cond, cache->lock, 0);
+			continue;
+		}
+
+		/* Write back in offset order, adjacent blocks with single request */
+		qsort(cache->sorted, ndirty, sizeof(cache->sorted[0]), cache_cmp);
+
+		for (i = 0; i < ndirty; i = j) {
+			/* Blocks state might have changed while the lock was dropped */
+			if ((cache->sorted[i]->flags & (CACHE_DIRTY | CACHE_BUSY | CACHE_ERROR)) != CACHE_DIRTY) {
+				j = i + 1;
+				continue;
+			}
+
+			for (j = i + 1; (j < ndirty) && (j - i < CACHE_RAHEAD) && !cache->stagebusy; j++) {
+				if ((cache->sorted[j]->flags & (CACHE_DIRTY | CACHE_BUSY | CACHE_ERROR)) != CACHE_DIRTY)
+					break;
+
+				if (cache->sorted[j]->offs != cache->sorted[j - 1]->offs + cache->blksz)
+					break;
+			}
+
+			if ((ret = _cache_writeback(cache, cache->sorted + i, j - i, 0)) < 0)
+				err = ret;
+		}
+	}
+
+	mutexUnlock(cache->lock);
+
+	return err;
+}
+
+
+void cache_destroy(cache_t *cache)
+{
+	resourceDestroy(cache->cond);
+	resourceDestroy(cache->lock);
+	free(cache->sorted);
+	free(cache->stage);
+	free(cache->htab);
+	free(cache->data);
+	free(cache->blks);
+}
+
+
+int cache_init(cache_t *cache, ata_dev_t *dev, iosched_t *sched, size_t size)
+{
+	unsigned int i;
+	int err;
+
+	cache->dev = dev;
+	cache->sched = sched;
+	cache->blksz = max(CACHE_BLKSZ, dev->sectorsz);
+	cache->nblks = size / cache->blksz;
+
+	if (cache->nblks < CACHE_RAHEAD)
+		return -EINVAL;
+
+	/* Hash table size is the lowest power of 2 not less than number of blocks */
+	for (cache->hmask = 1; cache->hmask < cache->nblks; cache->hmask <<= 1);
+
+	cache->blks = malloc(cache->nblks * sizeof(cache_blk_t));
+	cache->data = malloc(cache->nblks * cache->blksz);
+	cache->htab = calloc(cache->hmask, sizeof(cache_blk_t *));
+	cache->stage = malloc(CACHE_RAHEAD * cache->blksz);
+	cache->sorted = malloc(cache->nblks * sizeof(cache_blk_t *));
+	cache->hmask--;
+
+	if ((cache->blks == NULL) || (cache->data == NULL) || (cache->htab == NULL) || (cache->stage == NULL) || (cache->sorted == NULL)) {
+		free(cache->sorted);
+		free(cache->stage);
+		free(cache->htab);
+		free(cache->data);
+		free(cache->blks);
+		return -ENOMEM;
+	}
+
+	if ((err = mutexCreate(&cache->lock)) < 0) {
+		free(cache->sorted);
+		free(cache->stage);
+		free(cache->htab);
+		free(cache->data);
+		free(cache->blks);
+		return err;
+	}
+
+	if ((err = condCreate(&cache->cond)) < 0) {
+		resourceDestroy(cache->lock);
+		free(cache->sorted);
+		free(cache->stage);
+		free(cache->htab);
+		free(cache->data);
+		free(cache->blks);
+		return err;
+	}
+
+	cache->lru = NULL;
+	for (i = 0; i < cache->nblks; i++) {
+		cache->blks[i].offs = 0;
+		cache->blks[i].flags = 0;
+		cache->blks[i].data = cache->data + i * cache->blksz;
+		cache->blks[i].hnext = NULL;
+		LIST_ADD(&cache->lru, cache->blks + i);
+	}
+
+	cache->stagebusy = 0;
+	cache->raoffs = 0;
+	cache->seq = 0;
+
+	return EOK;
+}
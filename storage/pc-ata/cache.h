@@ -0,0 +1,99 @@
+/*
+ * Phoenix-RTOS
+ *
+ * ATA device block cache
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stdint.h>
+
+#include <sys/types.h>
+
+#include "ata.h"
+#include "iosched.h"
+
+
+/* Misc definitions */
+#define CACHE_BLKSZ  4096 /* Cache block size (at least device sector size) */
+#define CACHE_RAHEAD 16   /* Max number of blocks read/written with one device request (read-ahead window) */
+
+
+/* Cache block flags */
+enum {
+	CACHE_USED  = 0x01, /* Block is assigned to device offset (hashed) */
+	CACHE_VALID = 0x02, /* Block data is valid */
+	CACHE_DIRTY = 0x04, /* Block data has to be written back */
+	CACHE_BUSY  = 0x08, /* Block I/O is in progress */
+	CACHE_ERROR = 0x10  /* Block write back failed (block stays dirty, retried on flush) */
+};
+
+
+typedef struct _cache_blk_t cache_blk_t;
+
+
+struct _cache_blk_t {
+	offs_t offs;                /* Block device offset */
+	uint8_t flags;              /* Block flags */
+	char *data;                 /* Block data */
+	cache_blk_t *hnext;         /* Hash chain */
+	cache_blk_t *prev, *next;   /* LRU list (least recently used first) */
+};
+
+
+typedef struct {
+	ata_dev_t *dev;             /* Cached ATA device */
+	iosched_t *sched;           /* Device I/O scheduler */
+	size_t blksz;               /* Block size */
+	unsigned int nblks;         /* Number of blocks */
+	cache_blk_t *blks;          /* Blocks */
+	char *data;                 /* Blocks data */
+
+	/* Lookup */
+	cache_blk_t **htab;         /* Hash table */
+	unsigned int hmask;         /* Hash table size - 1 */
+	cache_blk_t *lru;           /* LRU list */
+
+	/* Multiple blocks transfers */
+	char *stage;                /* Staging buffer (CACHE_RAHEAD blocks) */
+	uint8_t stagebusy;          /* Staging buffer is in use */
+	cache_blk_t **sorted;       /* Dirty blocks sorted by offset (write-back) */
+
+	/* Sequential read detection */
+	offs_t raoffs;              /* Expected offset of next sequential read */
+	unsigned int seq;           /* Number of sequential reads */
+
+	/* Synchronization */
+	handle_t lock;              /* Cache mutex */
+	handle_t cond;              /* Block I/O finished */
+} cache_t;
+
+
+/* Reads from ATA device through the cache */
+extern ssize_t cache_read(cache_t *cache, offs_t offs, char *buff, size_t len);
+
+
+/* Writes to ATA device through the cache (write-back, with fua set written blocks go directly to the media) */
+extern ssize_t cache_write(cache_t *cache, offs_t offs, const char *buff, size_t len, uint8_t fua);
+
+
+/* Writes back all dirty blocks, retries failed ones and reports any that still can't be written */
+extern int cache_flush(cache_t *cache);
+
+
+/* Destroys cache (doesn't flush it) */
+extern void cache_destroy(cache_t *cache);
+
+
+/* Initializes ATA device cache using size bytes of memory for blocks data */
+extern int cache_init(cache_t *cache, ata_dev_t *dev, iosched_t *sched, size_t size);
+
+
+#endif
@@ -0,0 +1,288 @@
+/*
+ * Phoenix-RTOS
+ *
+ * ATA device I/O scheduler
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/list.h>
+#include <sys/minmax.h>
+#include <sys/threads.h>
+
+#include "ata.h"
+#include "iosched.h"
+
+
+/* Returns true if position (dev1, offs1) precedes (dev2, offs2) in the queue order (device, then offset) */
+static inline int iosched_before(ata_dev_t *dev1, offs_t offs1, ata_dev_t *dev2, offs_t offs2)
+{
+	if (dev1 != dev2)
+		return (uintptr_t)dev1 < (uintptr_t)dev2;
+
+	return offs1 < offs2;
+}
+
+
+/* Adds request to the queue keeping it sorted (FIFO among equal offsets) */
+static void _iosched_enqueue(iosched_t *sched, iosched_req_t *req)
+{
+	iosched_req_t *r = sched->queue;
+
+	if (r != NULL) {
+		do {
+			if (iosched_before(req->dev, req->offs, r->dev, r->offs))
+				break;
+		} while ((r = r->next) != sched->queue);
+	}
+
+	/* Insert before r (at the queue tail if r is the head) */
+	LIST_ADD(&r, req);
+	if ((sched->queue == NULL) || iosched_before(req->dev, req->offs, sched->queue->dev, sched->queue->offs))
+		sched->queue = req;
+}
+
+
+/* Returns true if req directly follows prev and both can be served with one command */
+static inline int iosched_mergeable(iosched_req_t *prev, iosched_req_t *req)
+{
+	return (prev->dev == req->dev) && (prev->offs + prev->len == req->offs) && !(prev->len % prev->dev->sectorsz) && (prev->dir == req->dir) && (prev->fua == req->fua);
+}
+
+
+/* Selects next request: expired one first, then the nearest one in ascending order (C-LOOK) */
+static iosched_req_t *_iosched_select(iosched_t *sched)
+{
+	iosched_req_t *req, *expired = NULL, *next = NULL;
+	time_t now;
+
+	gettime(&now, NULL);
+
+	req = sched->queue;
+	do {
+		if ((req->deadline <= now) && ((expired == NULL) || (req->deadline < expired->deadline)))
+			expired = req;
+
+		if ((next == NULL) && !iosched_before(req->dev, req->offs, sched->posdev, sched->pos))
+			next = req;
+	} while ((req = req->next) != sched->queue);
+
+	if (expired != NULL)
+		return expired;
+
+	return (next != NULL) ? next : sched->queue;
+}
+
+
+/* Dispatches next request merged with adjacent ones, drops the lock during I/O */
+static void _iosched_dispatch(iosched_t *sched)
+{
+	iosched_req_t *reqs[IOSCHED_MERGE], *first, *last;
+	ata_dev_t *dev;
+	size_t len, pos;
+	ssize_t ret;
+	unsigned int i, n;
+
+	first = last = _iosched_select(sched);
+	dev = first->dev;
+	len = first->len;
+	n = 1;
+
+	/* Merge adjacent requests (both directions) while they fit in the staging buffer */
+	if (!sched->stagebusy && (len < IOSCHED_MERGESZ)) {
+		while ((first != sched->queue) && (n < IOSCHED_MERGE) && (len + first->prev->len <= IOSCHED_MERGESZ) && iosched_mergeable(first->prev, first)) {
+			first = first->prev;
+			len += first->len;
+			n++;
+		}
+
+		while ((last->next != sched->queue) && (n < IOSCHED_MERGE) && (len + last->next->len <= IOSCHED_MERGESZ) && iosched_mergeable(last, last->next)) {
+			last = last->next;
+			len += last->len;
+			n++;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		reqs[i] = first;
+		first = first->next;
+		LIST_REMOVE(&sched->queue, reqs[i]);
+	}
+
+	sched->posdev = dev;
+	sched->pos = reqs[n - 1]->offs + reqs[n - 1]->len;
+	if (n > 1)
+		sched->stagebusy = 1;
+	mutexUnlock(sched->lock);
+
+	if (n > 1) {
+		if (reqs[0]->dir == WRITE) {
+			for (i = 0, pos = 0; i < n; pos += reqs[i++]->len)
+				memcpy(sched->stage + pos, reqs[i]->buff, reqs[i]->len);
+			ret = (reqs[0]->fua) ? ata_writefua(dev, reqs[0]->offs, sched->stage, len) : ata_write(dev, reqs[0]->offs, sched->stage, len);
+		}
+		else if ((ret = ata_read(dev, reqs[0]->offs, sched->stage, len)) == len) {
+			for (i = 0, pos = 0; i < n; pos += reqs[i++]->len)
+				memcpy(reqs[i]->buff, sched->stage + pos, reqs[i]->len);
+		}
+	}
+	else if (reqs[0]->dir == WRITE) {
+		ret = (reqs[0]->fua) ? ata_writefua(dev, reqs[0]->offs, reqs[0]->buff, len) : ata_write(dev, reqs[0]->offs, reqs[0]->buff, len);
+	}
+	else {
+		ret = ata_read(dev, reqs[0]->offs, reqs[0]->buff, len);
+	}
+
+	mutexLock(sched->lock);
+	if (n > 1)
+		sched->stagebusy = 0;
+
+	for (i = 0; i < n; i++) {
+		if (n == 1)
+			reqs[i]->ret = ret;
+		else
+			reqs[i]->ret = (ret == len) ? (ssize_t)reqs[i]->len : ((ret < 0) ? ret : -EIO);
+		reqs[i]->done = 1;
+	}
+	condBroadcast(sched->cond);
+}
+
+
+static void iosched_worker(void *arg)
+{
+	iosched_t *sched = (iosched_t *)arg;
+
+	mutexLock(sched->lock);
+
+	for (;;) {
+		while (sched->queue == NULL)
+			condWait(sched->qcond, sched->lock, 0);
+
+		_iosched_dispatch(sched);
+	}
+}
+
+
+/* Queues request and waits until it's served by a worker thread */
+static ssize_t iosched_access(iosched_t *sched, ata_dev_t *dev, offs_t offs, char *buff, size_t len, uint8_t dir, uint8_t fua)
+{
+	iosched_req_t *req;
+	ssize_t ret;
+
+	if (!len)
+		return 0;
+
+	mutexLock(sched->lock);
+
+	while ((req = sched->free) == NULL)
+		condWait(sched->cond, sched->lock, 0);
+	LIST_REMOVE(&sched->free, req);
+
+	req->dev = dev;
+	req->offs = offs;
+	req->len = len;
+	req->buff = buff;
+	req->dir = dir;
+	req->fua = fua;
+	req->done = 0;
+	gettime(&req->deadline, NULL);
+	req->deadline += IOSCHED_DEADLINE;
+	_iosched_enqueue(sched, req);
+	condSignal(sched->qcond);
+
+	while (!req->done)
+		condWait(sched->cond, sched->lock, 0);
+
+	ret = req->ret;
+	LIST_ADD(&sched->free, req);
+	condBroadcast(sched->cond);
+
+	mutexUnlock(sched->lock);
+
+	return ret;
+}
+
+
+ssize_t iosched_read(iosched_t *sched, ata_dev_t *dev, offs_t offs, char *buff, size_t len)
+{
+	return iosched_access(sched, dev, offs, buff, len, READ, 0);
+}
+
+
+ssize_t iosched_write(iosched_t *sched, ata_dev_t *dev, offs_t offs, const char *buff, size_t len, uint8_t fua)
+{
+	return iosched_access(sched, dev, offs, (char *)buff, len, WRITE, fua);
+}
+
+
+int iosched_init(iosched_t *sched, unsigned int nworkers)
+{
+	unsigned int i;
+	int err;
+
+	sched->nworkers = min(nworkers, IOSCHED_WORKERS);
+	sched->posdev = NULL;
+	sched->pos = 0;
+	sched->free = NULL;
+	sched->queue = NULL;
+	sched->stagebusy = 0;
+
+	sched->reqs = malloc(IOSCHED_REQS * sizeof(iosched_req_t));
+	sched->stage = malloc(IOSCHED_MERGESZ);
+
+	if ((sched->reqs == NULL) || (sched->stage == NULL)) {
+		free(sched->stage);
+		free(sched->reqs);
+		return -ENOMEM;
+	}
+
+	if ((err = mutexCreate(&sched->lock)) < 0) {
+		free(sched->stage);
+		free(sched->reqs);
+		return err;
+	}
+
+	if ((err = condCreate(&sched->cond)) < 0) {
+		resourceDestroy(sched->lock);
+		free(sched->stage);
+		free(sched->reqs);
+		return err;
+	}
+
+	if ((err = condCreate(&sched->qcond)) < 0) {
+		resourceDestroy(sched->cond);
+		resourceDestroy(sched->lock);
+		free(sched->stage);
+		free(sched->reqs);
+		return err;
+	}
+
+	for (i = 0; i < IOSCHED_REQS; i++)
+		LIST_ADD(&sched->free, sched->reqs + i);
+
+	/* Keep going with fewer workers if some of them can't be started */
+	for (i = 0; i < sched->nworkers; i++) {
+		if ((err = beginthread(iosched_worker, 4, sched->wstacks[i], sizeof(sched->wstacks[i]), sched)) < 0)
+			break;
+	}
+
+	if (!(sched->nworkers = i)) {
+		resourceDestroy(sched->qcond);
+		resourceDestroy(sched->cond);
+		resourceDestroy(sched->lock);
+		free(sched->stage);
+		free(sched->reqs);
+		return err;
+	}
+
+	return EOK;
+}
@@ -0,0 +1,84 @@
+/*
+ * Phoenix-RTOS
+ *
+ * ATA device I/O scheduler
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _IOSCHED_H_
+#define _IOSCHED_H_
+
+#include <stdint.h>
+
+#include <sys/types.h>
+
+#include "ata.h"
+
+
+/* Misc definitions */
+#define IOSCHED_REQS     32             /* Number of preallocated requests (max number of queued requests) */
+#define IOSCHED_MERGE    16             /* Max number of requests merged into one device command */
+#define IOSCHED_MERGESZ  (64 * 1024)    /* Merged requests staging buffer size */
+#define IOSCHED_DEADLINE 500000         /* Max time a request waits in the queue before it is served out of elevator order (in us) */
+#define IOSCHED_WORKERS  4              /* Max number of worker threads (commands in flight) */
+
+
+typedef struct _iosched_req_t iosched_req_t;
+
+
+struct _iosched_req_t {
+	ata_dev_t *dev;             /* Target ATA device */
+	offs_t offs;                /* Device offset */
+	size_t len;                 /* Transfer length */
+	char *buff;                 /* Transfer buffer */
+	uint8_t dir;                /* Transfer direction (READ or WRITE) */
+	uint8_t fua;                /* Force unit access (write to the media) */
+	uint8_t done;               /* Request has been served */
+	ssize_t ret;                /* Request result */
+	time_t deadline;            /* Request deadline */
+	iosched_req_t *prev, *next; /* Doubly linked list (queue or free pool) */
+};
+
+
+typedef struct {
+	unsigned int nworkers;      /* Number of worker threads */
+	ata_dev_t *posdev;          /* Elevator position device */
+	offs_t pos;                 /* Elevator position (end of last dispatched request) */
+
+	/* Requests */
+	iosched_req_t *reqs;        /* Preallocated requests */
+	iosched_req_t *free;        /* Free requests pool */
+	iosched_req_t *queue;       /* Pending requests sorted by offset */
+
+	/* Merged requests transfers */
+	char *stage;                /* Staging buffer */
+	uint8_t stagebusy;          /* Staging buffer is in use */
+
+	/* Synchronization */
+	handle_t lock;              /* Scheduler mutex */
+	handle_t cond;              /* Request served or released */
+	handle_t qcond;             /* Request queued */
+
+	/* Worker threads stacks */
+	char wstacks[IOSCHED_WORKERS][2 * _PAGE_SIZE] __attribute__((aligned(8)));
+} iosched_t;
+
+
+/* Reads from ATA device through the scheduler */
+extern ssize_t iosched_read(iosched_t *sched, ata_dev_t *dev, offs_t offs, char *buff, size_t len);
+
+
+/* Writes to ATA device through the scheduler, fua forces data to the media */
+extern ssize_t iosched_write(iosched_t *sched, ata_dev_t *dev, offs_t offs, const char *buff, size_t len, uint8_t fua);
+
+
+/* Initializes I/O scheduler and starts nworkers threads dispatching its requests */
+extern int iosched_init(iosched_t *sched, unsigned int nworkers);
+
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * Phoenix-RTOS
+ *
+ * PCI configuration space access
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <errno.h>
+#include <stdint.h>
+
+#include <sys/io.h>
+
+#include "pci.h"
+
+
+uint32_t pci_read(pci_dev_t *pdev, uint8_t reg)
+{
+	outl((void *)PCI_CFGADDR, 0x80000000 | ((uint32_t)pdev->bus << 16) | ((uint32_t)pdev->dev << 11) | ((uint32_t)pdev->func << 8) | (reg & 0xfc));
+
+	return inl((void *)PCI_CFGDATA);
+}
+
+
+void pci_write(pci_dev_t *pdev, uint8_t reg, uint32_t val)
+{
+	outl((void *)PCI_CFGADDR, 0x80000000 | ((uint32_t)pdev->bus << 16) | ((uint32_t)pdev->dev << 11) | ((uint32_t)pdev->func << 8) | (reg & 0xfc));
+	outl((void *)PCI_CFGDATA, val);
+}
+
+
+int pci_find(uint32_t class, uint32_t mask, unsigned int n, pci_dev_t *pdev)
+{
+	unsigned int bus, dev, func;
+
+	for (bus = 0; bus < 256; bus++) {
+		for (dev = 0; dev < 32; dev++) {
+			for (func = 0; func < 8; func++) {
+				pdev->bus = bus;
+				pdev->dev = dev;
+				pdev->func = func;
+
+				/* No device */
+				if ((pci_read(pdev, PCI_ID) & 0xffff) == 0xffff) {
+					if (!func)
+						break;
+					continue;
+				}
+
+				if ((((pci_read(pdev, PCI_CLASS) >> 8) & mask) == class) && !n--)
+					return EOK;
+
+				/* Single function device */
+				if (!func && !(pci_read(pdev, PCI_HEADER) & 0x00800000))
+					break;
+			}
+		}
+	}
+
+	return -ENODEV;
+}
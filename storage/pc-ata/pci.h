@@ -0,0 +1,65 @@
+/*
+ * Phoenix-RTOS
+ *
+ * PCI configuration space access
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _PCI_H_
+#define _PCI_H_
+
+#include <stdint.h>
+
+
+/* PCI configuration space access IO-ports */
+#define PCI_CFGADDR 0xcf8
+#define PCI_CFGDATA 0xcfc
+
+
+/* PCI configuration space registers */
+enum {
+	PCI_ID              = 0x00, /* Device ID, vendor ID */
+	PCI_CMD             = 0x04, /* Status, command */
+	PCI_CLASS           = 0x08, /* Class code, revision ID */
+	PCI_HEADER          = 0x0c, /* BIST, header type, latency timer, cache line size */
+	PCI_BAR0            = 0x10, /* Base address registers */
+	PCI_BAR4            = 0x20,
+	PCI_BAR5            = 0x24,
+	PCI_IRQ             = 0x3c  /* Max latency, min grant, interrupt pin, interrupt line */
+};
+
+
+/* PCI_CMD layout */
+enum {
+	PCI_CMD_IO          = 0x01, /* IO space access enable */
+	PCI_CMD_MEM         = 0x02, /* Memory space access enable */
+	PCI_CMD_MASTER      = 0x04, /* Bus mastering enable */
+	PCI_CMD_INTDIS      = 0x400 /* INTx interrupt disable */
+};
+
+
+typedef struct {
+	uint8_t bus;            /* Bus number */
+	uint8_t dev;            /* Device number */
+	uint8_t func;           /* Function number */
+} pci_dev_t;
+
+
+/* Reads PCI configuration space register */
+extern uint32_t pci_read(pci_dev_t *pdev, uint8_t reg);
+
+
+/* Writes PCI configuration space register */
+extern void pci_write(pci_dev_t *pdev, uint8_t reg, uint32_t val);
+
+
+/* Finds n-th PCI function with (class code & mask) == class (class code is 24-bit: class, subclass, programming interface) */
+extern int pci_find(uint32_t class, uint32_t mask, unsigned int n, pci_dev_t *pdev);
+
+
+#endif
@@ -13,6 +13,7 @@
  * %LICENSE%
  */
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,9 +28,11 @@
 #include <sys/msg.h>
 #include <sys/stat.h>
 #include <sys/debug.h>
+#include <sys/list.h>
 #include <posix/utils.h>
 
 #include <libtty.h>
+#include <sdma.h>
 
 #include <phoenix/arch/imx6ull.h>
 
@@ -71,29 +74,289 @@ uart_pctl_t uart_pctl_isel[8][2] = {
 
 unsigned uart_intr_number[8] = { 58, 59, 60, 61, 62, 49, 71, 72 };
 
+/* SDMA request (event) numbers: RX, TX */
+unsigned uart_sdma_event[8][2] = { { 25, 26 }, { 27, 28 }, { 29, 30 }, { 31, 32 },
+	{ 33, 34 }, { 0, 1 }, { 43, 44 }, { 45, 46 } };
+
+#define UART_DMA_RXBDS   8
+#define UART_DMA_RXBDSZ  256
+#define UART_DMA_TXSZ    2048
+
+#define UART_DMA_RXTL    8
+#define UART_DMA_TXTL    8
+
+/* Each BD array has to start a page (SDMA driver maps it by physical address) */
+typedef struct {
+	sdma_buffer_desc_t bd[UART_DMA_RXBDS];
+	uint8_t buf[UART_DMA_RXBDS][UART_DMA_RXBDSZ];
+} uart_dmarx_t;
+
+typedef struct {
+	sdma_buffer_desc_t bd;
+	uint8_t buf[UART_DMA_TXSZ];
+} uart_dmatx_t;
+
+/* read request waiting for data */
+typedef struct _uart_req_t {
+	struct _uart_req_t *next, *prev;
+	msg_t msg;
+	unsigned int rid;
+	libtty_read_state_t st;
+	time_t deadline; /* VMIN/VTIME timer expiration (us), 0 - none */
+} uart_req_t;
+
+typedef struct _uart_opener_t {
+	struct _uart_opener_t *next, *prev;
+	unsigned int pid;
+	unsigned int cnt;
+} uart_opener_t;
+
 typedef struct {
 	volatile uint32_t *base;
 	uint32_t mode;
 	uint16_t dev_no;
+	unsigned int prio;
 
 	handle_t cond;
 	handle_t inth;
 	handle_t lock;
 
+	int use_dma;
+	sdma_t rx_sdma;
+	sdma_t tx_sdma;
+	uart_dmarx_t *rx_dma;
+	uart_dmatx_t *tx_dma;
+	addr_t rx_dma_paddr;
+	addr_t tx_dma_paddr;
+	unsigned int rx_next;
+
+	unsigned int txtl;
+
+	uart_req_t *rqueue; /* pending reads, only the first one is being served */
+	uart_opener_t *openers; /* open count per client process (uart_common.rlock) */
+
 	libtty_common_t tty_common;
+
+	char __attribute__((aligned(8))) stack0[2048];
+	char __attribute__((aligned(8))) stack1[2048];
 } uart_t;
 
-uart_t uart = { 0 };
+/* port configuration from the command line */
+typedef struct {
+	int dev_no;
+	int is_cooked;
+	int baud;
+	int parity;
+	int use_rts_cts;
+	int dma_channel;
+	int prio;
+} uart_cfg_t;
+
+#define UART_MAXPORTS 8
+#define UART_PRIO 3
 
-#define MODULE_CLK 20000000
+#define POOL_STACKSZ 2048
+
+struct {
+	uint32_t port;
+	uart_t *uarts[UART_MAXPORTS]; /* indexed by device oid id */
+
+	handle_t rlock; /* protects read queues of all ports */
+	handle_t rcond; /* wakes up the VMIN/VTIME timer thread */
+} uart_common;
+
+/* UART_CLK_ROOT (80 MHz) with the reference frequency divider set to 1 */
+#define UART_REFCLK 80000000
 
 #define BUFSIZE 4096
 
+#define UART_FIFOSZ 32
+#define UART_TXWATERMARK 4
+#define UART_RXWATERMARK 16
+#define UART_IDLEFRAMES 4
+
+
+static uart_t *uart_get(id_t id)
+{
+	if (id >= UART_MAXPORTS)
+		return NULL;
+
+	return uart_common.uarts[id];
+}
+
+
+/* serves queued reads of the port in order, responds to those which are complete; uart_common.rlock taken */
+static void uart_rserve(uart_t *uart)
+{
+	uart_req_t *req;
+	ssize_t ret;
+	time_t now;
+
+	while ((req = uart->rqueue) != NULL) {
+		gettime(&now, NULL);
+		if (req->deadline != 0)
+			req->st.timeout_ms = (req->deadline > now) ? (req->deadline - now + 999) / 1000 : 0;
+
+		ret = libtty_read_nonblock(&uart->tty_common, req->msg.o.data, req->msg.o.size, req->msg.i.io.mode, &req->st);
+		if (ret == 0 && req->st.timeout_ms >= 0) {
+			/* waiting for more data, (re)arm the timer */
+			req->deadline = (req->st.timeout_ms > 0) ? now + (time_t)req->st.timeout_ms * 1000 : 0;
+			if (req->deadline != 0)
+				condSignal(uart_common.rcond);
+			break;
+		}
+
+		LIST_REMOVE(&uart->rqueue, req);
+		req->msg.o.io.err = ret;
+		msgRespond(uart_common.port, &req->msg, req->rid);
+		free(req);
+	}
+}
+
+
+/* called from the RX path when libtty woke up readers */
+static void uart_rnotify(uart_t *uart)
+{
+	mutexLock(uart_common.rlock);
+	if (uart->rqueue != NULL)
+		uart_rserve(uart);
+	mutexUnlock(uart_common.rlock);
+}
+
+
+static void uart_timerthr(void *arg)
+{
+	time_t now, wait, t;
+	uart_t *uart;
+	int i;
+
+	mutexLock(uart_common.rlock);
+	for (;;) {
+		wait = 0;
+		gettime(&now, NULL);
+
+		for (i = 0; i < UART_MAXPORTS; ++i) {
+			if ((uart = uart_common.uarts[i]) == NULL || uart->rqueue == NULL || uart->rqueue->deadline == 0)
+				continue;
+
+			if (uart->rqueue->deadline <= now)
+				uart_rserve(uart);
+
+			if (uart->rqueue != NULL && uart->rqueue->deadline != 0) {
+				t = (uart->rqueue->deadline > now) ? uart->rqueue->deadline - now : 1;
+				if (wait == 0 || t < wait)
+					wait = t;
+			}
+		}
+
+		condWait(uart_common.rcond, uart_common.rlock, wait);
+	}
+}
+
+
+/* queues the read, responds right away if it can be completed */
+static void uart_read(uart_t *uart, msg_t *msg, unsigned int rid)
+{
+	uart_req_t *req;
+
+	if ((req = malloc(sizeof(*req))) == NULL) {
+		msg->o.io.err = -ENOMEM;
+		msgRespond(uart_common.port, msg, rid);
+		return;
+	}
+
+	req->msg = *msg;
+	req->rid = rid;
+	req->deadline = 0;
+	libtty_read_state_init(&req->st);
+
+	mutexLock(uart_common.rlock);
+	LIST_ADD(&uart->rqueue, req);
+	if (uart->rqueue == req)
+		uart_rserve(uart);
+	mutexUnlock(uart_common.rlock);
+}
+
+
+static uart_opener_t *uart_opener(uart_t *uart, unsigned int pid)
+{
+	uart_opener_t *op;
+
+	if ((op = uart->openers) != NULL) {
+		do {
+			if (op->pid == pid)
+				return op;
+		} while ((op = op->next) != uart->openers);
+	}
+
+	return NULL;
+}
+
+
+static int uart_open(uart_t *uart, unsigned int pid)
+{
+	uart_opener_t *op;
+	int err = EOK;
+
+	mutexLock(uart_common.rlock);
+	if ((op = uart_opener(uart, pid)) != NULL) {
+		op->cnt++;
+	}
+	else if ((op = malloc(sizeof(*op))) != NULL) {
+		op->pid = pid;
+		op->cnt = 1;
+		LIST_ADD(&uart->openers, op);
+	}
+	else {
+		err = -ENOMEM;
+	}
+	mutexUnlock(uart_common.rlock);
+
+	return err;
+}
+
+
+/* answers parked reads of a client with -EBADF once it closes its last descriptor of the port
+ * (other descriptors of the process may still be reading), their msg/rid would be lost otherwise */
+static void uart_close(uart_t *uart, unsigned int pid)
+{
+	uart_opener_t *op;
+	uart_req_t *req, *next;
+
+	mutexLock(uart_common.rlock);
+	if ((op = uart_opener(uart, pid)) == NULL || --op->cnt > 0) {
+		mutexUnlock(uart_common.rlock);
+		return;
+	}
+
+	LIST_REMOVE(&uart->openers, op);
+	free(op);
+
+	for (req = uart->rqueue; req != NULL; req = next) {
+		next = (req->next != uart->rqueue) ? req->next : NULL;
+		if (req->msg.pid != pid)
+			continue;
+
+		/* the read being served may already hold some data */
+		LIST_REMOVE(&uart->rqueue, req);
+		req->msg.o.io.err = (req->st.timeout_ms >= 0 && req->st.prevlen > 0) ? req->st.prevlen : -EBADF;
+		msgRespond(uart_common.port, &req->msg, req->rid);
+		free(req);
+	}
+
+	/* the read being served might have been aborted */
+	if (uart->rqueue != NULL)
+		uart_rserve(uart);
+	mutexUnlock(uart_common.rlock);
+}
+
+
 void uart_thr(void *arg)
 {
-	uint32_t port = (uint32_t)arg;
+	uint32_t port = uart_common.port;
 	msg_t msg;
 	unsigned int rid;
+	uart_t *uart;
 
 	for (;;) {
 
@@ -106,28 +369,46 @@ void uart_thr(void *arg)
 		switch (msg.type) {
 		case mtOpen:
 			// TODO: set PGID?
+			if ((uart = uart_get(msg.i.openclose.oid.id)) == NULL)
+				msg.o.io.err = -ENOENT;
+			else
+				msg.o.io.err = uart_open(uart, msg.pid);
 			break;
 		case mtWrite:
-			msg.o.io.err = libtty_write(&uart.tty_common, msg.i.data, msg.i.size, msg.i.io.mode);
+			if ((uart = uart_get(msg.i.io.oid.id)) == NULL)
+				msg.o.io.err = -ENOENT;
+			else
+				msg.o.io.err = libtty_write(&uart->tty_common, msg.i.data, msg.i.size, msg.i.io.mode);
 			break;
 		case mtRead:
-			msg.o.io.err = libtty_read(&uart.tty_common, msg.o.data, msg.o.size, msg.i.io.mode);
-			break;
+			if ((uart = uart_get(msg.i.io.oid.id)) == NULL) {
+				msg.o.io.err = -ENOENT;
+				break;
+			}
+			uart_read(uart, &msg, rid); /* responds when data arrives */
+			continue;
 		case mtClose:
+			if ((uart = uart_get(msg.i.openclose.oid.id)) != NULL)
+				uart_close(uart, msg.pid);
 			break;
 		case mtGetAttr:
-			if (msg.i.attr.type == atPollStatus)
-				msg.o.attr.val = libtty_poll_status(&uart.tty_common);
+			if (msg.i.attr.type == atPollStatus && (uart = uart_get(msg.i.attr.oid.id)) != NULL)
+				msg.o.attr.val = libtty_poll_status(&uart->tty_common);
 			else
 				msg.o.attr.val = -EINVAL;
 			break;
 		case mtDevCtl: { /* ioctl */
 				unsigned long request;
-				const void *in_data = ioctl_unpack(&msg, &request, NULL);
+				id_t id;
+				const void *in_data = ioctl_unpack(&msg, &request, &id);
 				const void *out_data = NULL;
 				pid_t pid = ioctl_getSenderPid(&msg);
+				int err;
 
-				int err = libtty_ioctl(&uart.tty_common, pid, request, in_data, &out_data);
+				if ((uart = uart_get(id)) == NULL)
+					err = -ENOENT;
+				else
+					err = libtty_ioctl(&uart->tty_common, pid, request, in_data, &out_data);
 				ioctl_setResponse(&msg, request, err, out_data);
 			}
 			break;
@@ -141,47 +422,237 @@ void uart_thr(void *arg)
 
 static int uart_intr(unsigned int intr, void *data)
 {
-	/* disable tx ready interrupt ASAP to minimize interrupts received */
-	*(uart.base + ucr1) &= ~0x2000;
+	uart_t *uart = (uart_t *)data;
 
-	return uart.cond;
+	/* disable TRDY, RRDY and IDLE interrupts and the aging timer ASAP to minimize interrupts received,
+	 * the thread enables them again once it's done */
+	*(uart->base + ucr1) &= ~((1 << 13) | (1 << 12) | (1 << 9));
+	*(uart->base + ucr2) &= ~(1 << 3);
+
+	return uart->cond;
+}
+
+
+/* RX FIFO above the watermark (RRDY), aging timer expired (AGTIM) or line went idle (IDLE) */
+static int uart_rxpending(uart_t *uart)
+{
+	return (*(uart->base + usr1) & ((1 << 9) | (1 << 8))) || (*(uart->base + usr2) & (1 << 12));
 }
 
 
 static void uart_intrthr(void *arg)
 {
+	uart_t *uart = (uart_t *)arg;
+	unsigned char buff[UART_FIFOSZ];
+	unsigned int i, n;
+	int wake, rwake;
+
 	for (;;) {
-		/* wait for character or transmit data */
-		mutexLock(uart.lock);
-		while (!(*(uart.base + usr2) & (1 << 0))) {  // nothing to RX
-			if (libtty_txready(&uart.tty_common)) { // we something to TX
-				if ((*(uart.base + usr1) & (1 << 13))) // TX ready
+		/* wait for RX watermark/idle gap or transmit data */
+		mutexLock(uart->lock);
+		while (!uart_rxpending(uart)) {
+			if (libtty_txready(&uart->tty_common)) { // we something to TX
+				if ((*(uart->base + usr1) & (1 << 13))) // TX ready
 					break;
 				else
-					*(uart.base + ucr1) |= 0x2000; // wait for TRDY interrupt
+					*(uart->base + ucr1) |= 0x2000; // wait for TRDY interrupt
 			}
-			condWait(uart.cond, uart.lock, 0);
+
+			*(uart->base + ucr1) |= (1 << 12) | (1 << 9);
+			*(uart->base + ucr2) |= (1 << 3);
+			condWait(uart->cond, uart->lock, 0);
 		}
 		/* disable tx ready interrupt again (sticky conds) */
-		*(uart.base + ucr1) &= ~0x2000;
+		*(uart->base + ucr1) &= ~0x2000;
+
+		mutexUnlock(uart->lock);
 
-		mutexUnlock(uart.lock);
+		/* ack aging timer and idle line before draining the FIFO, so that a later gap isn't lost */
+		*(uart->base + usr1) = (1 << 8);
+		*(uart->base + usr2) = (1 << 12);
 
 		/* RX */
-		while ((*(uart.base + usr2) & (1 << 0)))
-			libtty_putchar(&uart.tty_common, *(uart.base + urxd), NULL);
+		rwake = 0;
+		while ((*(uart->base + usr2) & (1 << 0))) {
+			for (n = 0; n < sizeof(buff) && (*(uart->base + usr2) & (1 << 0)); ++n)
+				buff[n] = *(uart->base + urxd);
+
+			libtty_putchars(&uart->tty_common, buff, n, &wake);
+			rwake |= wake;
+		}
+
+		if (rwake)
+			uart_rnotify(uart);
 
 		/* TX */
-		while (libtty_txready(&uart.tty_common)) {
-			if (*(uart.base + uts) & (1 << 4)) { // check TXFULL bit
+		while (libtty_txready(&uart->tty_common)) {
+			if (*(uart->base + uts) & (1 << 4)) { // check TXFULL bit
 				break; /* wait in main loop for TX to be ready before resuming operation */
 			}
-			*(uart.base + utxd) = libtty_getchar(&uart.tty_common, NULL);
+
+			if (*(uart->base + usr1) & (1 << 13)) { // TRDY - less than TXTL chars in TX FIFO
+				n = libtty_getchars(&uart->tty_common, buff, UART_FIFOSZ - uart->txtl + 1, NULL);
+				for (i = 0; i < n; ++i)
+					*(uart->base + utxd) = buff[i];
+			} else {
+				*(uart->base + utxd) = libtty_getchar(&uart->tty_common, NULL);
+			}
+		}
+	}
+}
+
+
+static void uart_dmarx_arm(uart_t *uart, unsigned int i)
+{
+	sdma_buffer_desc_t *bd = &uart->rx_dma->bd[i];
+
+	bd->count = UART_DMA_RXBDSZ;
+	bd->command = SDMA_CMD_MODE_8_BIT;
+	bd->buffer_addr = uart->rx_dma_paddr + offsetof(uart_dmarx_t, buf) + i * UART_DMA_RXBDSZ;
+	bd->ext_buffer_addr = 0;
+	bd->flags = SDMA_BD_DONE | SDMA_BD_INTR | SDMA_BD_CONT | ((i == UART_DMA_RXBDS - 1) ? SDMA_BD_WRAP : 0);
+}
+
+
+static void uart_dmarxthr(void *arg)
+{
+	uart_t *uart = (uart_t *)arg;
+	sdma_buffer_desc_t *bd;
+	uint32_t cnt = 0;
+	unsigned int i;
+	int wake, rwake;
+
+	for (;;) {
+		/* BDs are closed when full or early by the uart_2_mcu script on aging timer/IDLE */
+		if (sdma_wait_for_new_intr(&uart->rx_sdma, &cnt) < 0) {
+			usleep(10000);
+			continue;
+		}
+
+		for (i = 0, rwake = 0; i < UART_DMA_RXBDS; ++i) {
+			bd = &uart->rx_dma->bd[uart->rx_next];
+			if (bd->flags & SDMA_BD_DONE)
+				break;
+
+			if (bd->count > 0) {
+				libtty_putchars(&uart->tty_common, uart->rx_dma->buf[uart->rx_next], bd->count, &wake);
+				rwake |= wake;
+			}
+
+			uart_dmarx_arm(uart, uart->rx_next);
+			uart->rx_next = (uart->rx_next + 1) % UART_DMA_RXBDS;
 		}
+
+		/* whole ring was filled - channel stopped on a busy BD, restart it */
+		if (i == UART_DMA_RXBDS)
+			sdma_enable(&uart->rx_sdma);
+
+		if (rwake)
+			uart_rnotify(uart);
 	}
 }
 
 
+static void uart_dmatxthr(void *arg)
+{
+	uart_t *uart = (uart_t *)arg;
+	sdma_buffer_desc_t *bd = &uart->tx_dma->bd;
+	uint32_t cnt = 0;
+	size_t n;
+
+	for (;;) {
+		mutexLock(uart->lock);
+		while (!libtty_txready(&uart->tty_common))
+			condWait(uart->cond, uart->lock, 0);
+		mutexUnlock(uart->lock);
+
+		/* SDMA needs physically contiguous, uncached source - bounce from the TX ring */
+		if ((n = libtty_getchars(&uart->tty_common, uart->tx_dma->buf, sizeof(uart->tx_dma->buf), NULL)) == 0)
+			continue;
+
+		bd->count = n;
+		bd->command = SDMA_CMD_MODE_8_BIT;
+		bd->buffer_addr = uart->tx_dma_paddr + offsetof(uart_dmatx_t, buf);
+		bd->ext_buffer_addr = 0;
+		bd->flags = SDMA_BD_DONE | SDMA_BD_INTR | SDMA_BD_WRAP;
+
+		*(uart->base + ucr1) |= (1 << 3); /* TXDMAEN */
+		sdma_enable(&uart->tx_sdma);
+
+		while (bd->flags & SDMA_BD_DONE) {
+			if (sdma_wait_for_new_intr(&uart->tx_sdma, &cnt) < 0)
+				usleep(1000);
+		}
+
+		*(uart->base + ucr1) &= ~(1 << 3);
+	}
+}
+
+
+static int uart_dmachannel(sdma_t *sdma, unsigned int channel, addr_t bd_paddr, unsigned int bd_cnt,
+	unsigned int event, sdma_script_t script, uint32_t per_addr, uint32_t watermark)
+{
+	sdma_channel_config_t cfg;
+	sdma_context_t ctx;
+	char path[sizeof("/dev/sdma/chxx")];
+
+	snprintf(path, sizeof(path), "/dev/sdma/ch%02u", channel);
+	if (sdma_open(sdma, path) < 0)
+		return -ENODEV;
+
+	cfg.bd_paddr = bd_paddr;
+	cfg.bd_cnt = bd_cnt;
+	cfg.trig = sdma_trig__event;
+	cfg.event = event;
+	cfg.priority = SDMA_CHANNEL_PRIORITY_MAX - 1;
+
+	if (sdma_channel_configure(sdma, &cfg) < 0 || sdma_set_auto_bd_done(sdma, 0) < 0)
+		return -EIO;
+
+	sdma_context_init(&ctx);
+	sdma_context_set_pc(&ctx, script);
+	ctx.gr[0] = (event >= 32) ? (1 << (event - 32)) : 0;
+	ctx.gr[1] = (event < 32) ? (1 << event) : 0;
+	ctx.gr[2] = per_addr;
+	ctx.gr[7] = watermark;
+
+	if (sdma_context_set(sdma, &ctx) < 0)
+		return -EIO;
+
+	return EOK;
+}
+
+
+/* channel - RX SDMA channel, TX uses the next one */
+static int uart_dmainit(uart_t *uart, unsigned int channel)
+{
+	uint32_t paddr = uart_addr[uart->dev_no - 1];
+	unsigned int i;
+
+	uart->rx_dma = sdma_alloc_uncached(NULL, sizeof(uart_dmarx_t), &uart->rx_dma_paddr, 0);
+	uart->tx_dma = sdma_alloc_uncached(NULL, sizeof(uart_dmatx_t), &uart->tx_dma_paddr, 0);
+	if (uart->rx_dma == NULL || uart->tx_dma == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < UART_DMA_RXBDS; ++i)
+		uart_dmarx_arm(uart, i);
+
+	memset(&uart->tx_dma->bd, 0, sizeof(uart->tx_dma->bd));
+	uart->rx_next = 0;
+
+	/* one byte less than the RX watermark so the aging timer closes partial BDs */
+	if (uart_dmachannel(&uart->rx_sdma, channel, uart->rx_dma_paddr, UART_DMA_RXBDS, uart_sdma_event[uart->dev_no - 1][0],
+			sdma_script__uart_2_mcu, paddr + urxd * sizeof(uint32_t), UART_DMA_RXTL - 1) < 0)
+		return -EIO;
+
+	if (uart_dmachannel(&uart->tx_sdma, channel + 1, uart->tx_dma_paddr, 1, uart_sdma_event[uart->dev_no - 1][1],
+			sdma_script__mcu_2_ap, paddr + utxd * sizeof(uint32_t), UART_DMA_TXTL) < 0)
+		return -EIO;
+
+	return sdma_enable(&uart->rx_sdma);
+}
+
+
 void set_clk(int dev_no)
 {
 	platformctl_t uart_clk;
@@ -222,54 +693,60 @@ void set_mux(int dev_no, int use_rts_cts)
 	}
 }
 
+static uint32_t uart_gcd(uint32_t a, uint32_t b)
+{
+	uint32_t t;
+
+	while (b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
 void set_baudrate(void* _uart, speed_t baud)
 {
-	int md, in, div, res;
+	uint32_t num, den, g, achieved, err;
 
 	int baud_rate = libtty_baudrate_to_int(baud);
 	uart_t* uartptr = (uart_t*) _uart;
 
-	if (!baud_rate)
+	if (baud_rate <= 0)
 		return;
 
-	/* count gcd */
-	md = MODULE_CLK;
-	in = 16 * baud_rate;
-
-	div = 0;
-	while (md % 2 == 0 && in % 2 == 0) {
-		md = md / 2;
-		md = md / 2;
-		div++;
+	/* baud = REFCLK / (16 * (UBMR + 1) / (UBIR + 1)), so UBIR + 1 must not exceed UBMR + 1 */
+	if (baud_rate > UART_REFCLK / 16) {
+		printf("imx6ull-uart: baudrate %d not supported (max %d)\n", baud_rate, UART_REFCLK / 16);
+		return;
 	}
 
-	while (md != in) {
-		if (md % 2 == 0)
-			md = md / 2;
-		else if (in % 2 == 0)
-			in = in / 2;
-		else if (md > in)
-			md = (md - in) / 2;
-		else in = (in - md) / 2;
+	/* (UBIR + 1) / (UBMR + 1) = 16 * baud / REFCLK, reduced to the lowest terms */
+	num = 16 * baud_rate;
+	den = UART_REFCLK;
+	g = uart_gcd(num, den);
+	num /= g;
+	den /= g;
+
+	/* no exact 16-bit ratio - take the closest one with the largest modulator */
+	if (den > 0x10000) {
+		num = (uint32_t)(((uint64_t)num * 0x10000 + den / 2) / den);
+		den = 0x10000;
+		if (num == 0)
+			num = 1;
 	}
-	res = md;
 
-	/* pow */
-	md = 1;
-	in = 2;
-	while (div) {
-		if (div & 1)
-			md *= in;
-		div /= 2;
-		in *= in;
-	}
+	achieved = (uint32_t)(((uint64_t)UART_REFCLK * num) / (16 * (uint64_t)den));
+	err = (achieved > (uint32_t)baud_rate) ? achieved - baud_rate : baud_rate - achieved;
+	err = (uint32_t)(((uint64_t)err * 10000) / baud_rate);
 
-	res = md * res;
+	printf("imx6ull-uart: baudrate %d (achieved %u, error %u.%02u%%)\n", baud_rate, achieved, err / 100, err % 100);
 
 	/* set baud rate */
 	*(uartptr->base + ucr1) &= ~(1 << 14);
-	*(uartptr->base + ubir) = ((baud_rate * 16) / res) - 1;
-	*(uartptr->base + ubmr) = (MODULE_CLK / res) - 1;
+	*(uartptr->base + ubir) = num - 1;
+	*(uartptr->base + ubmr) = den - 1;
 }
 
 void set_cflag(void* _uart, tcflag_t* cflag)
@@ -297,139 +774,345 @@ void set_cflag(void* _uart, tcflag_t* cflag)
 		*(uartptr->base + ucr2) &= ~(1 << 6);
 }
 
-static void signal_txready(void* _uart)
+static int set_hwfifo(void* _uart, libtty_hwfifo_t* hwfifo)
 {
 	uart_t* uartptr = (uart_t*) _uart;
+	uint32_t icd;
+
+	if (uartptr->use_dma) {
+		/* levels are tied to the SDMA script watermarks */
+		hwfifo->rx = UART_DMA_RXTL;
+		hwfifo->tx = UART_DMA_TXTL;
+	} else {
+		if (hwfifo->rx == 0)
+			hwfifo->rx = UART_RXWATERMARK;
+		else if (hwfifo->rx > UART_FIFOSZ)
+			hwfifo->rx = UART_FIFOSZ;
+
+		/* TXTL below 2 is reserved */
+		if (hwfifo->tx == 0)
+			hwfifo->tx = UART_TXWATERMARK;
+		else if (hwfifo->tx < 2)
+			hwfifo->tx = 2;
+		else if (hwfifo->tx > UART_FIFOSZ)
+			hwfifo->tx = UART_FIFOSZ;
+	}
+
+	/* idle condition detect: 4, 8, 16 or 32 frames */
+	if (hwfifo->idle == 0)
+		hwfifo->idle = UART_IDLEFRAMES;
+
+	for (icd = 0; icd < 3 && (4u << icd) < hwfifo->idle; ++icd)
+		;
+	hwfifo->idle = 4u << icd;
 
 	mutexLock(uartptr->lock);
-	condSignal(uartptr->cond);
+	if (!uartptr->use_dma) {
+		*(uartptr->base + ufcr) &= ~((0x3f << 10) | 0x3f);
+		*(uartptr->base + ufcr) |= (hwfifo->tx << 10) | hwfifo->rx;
+		uartptr->txtl = hwfifo->tx;
+	}
+
+	*(uartptr->base + ucr1) &= ~(0x3 << 10);
+	*(uartptr->base + ucr1) |= icd << 10;
 	mutexUnlock(uartptr->lock);
-}
 
+	return EOK;
+}
 
-char __attribute__((aligned(8))) stack[2048];
-char __attribute__((aligned(8))) stack0[2048];
+static void signal_txready(void* _uart)
+{
+	uart_t* uartptr = (uart_t*) _uart;
 
-static void print_usage(const char* progname) {
-	printf("Usage: %s [mode] [device] [speed] [parity] [use_rts_cts] or no args for default settings (cooked, uart1, B115200, 8N1)\n", progname);
-	printf("\tmode: 0 - raw, 1 - cooked\n\tdevice: 1 to 8\n");
-	printf("\tspeed: baud_rate\n\tparity: 0 - none, 1 - odd, 2 - even\n");
-	printf("\tuse_rts_cts: 0 - no hardware flow control, 1 - use hardware flow control\n");
+	mutexLock(uartptr->lock);
+	condSignal(uartptr->cond);
+	mutexUnlock(uartptr->lock);
 }
 
-int main(int argc, char **argv)
+
+static int uart_init(uart_t *uart, const uart_cfg_t *cfg)
 {
-	uint32_t port;
-	char uartn[sizeof("uartx") + 1];
-	oid_t dev;
 	int err;
-	speed_t baud = B115200;
-	int parity = 0;
-	int is_cooked = 1;
-	int use_rts_cts = 0;
+	speed_t baud;
 
 	libtty_callbacks_t callbacks = {
-		.arg = &uart,
+		.arg = uart,
 		.set_baudrate = &set_baudrate,
 		.set_cflag = &set_cflag,
+		.set_hwfifo = &set_hwfifo,
 		.signal_txready = &signal_txready,
 	};
 
-	if (libtty_init(&uart.tty_common, &callbacks, BUFSIZE) < 0)
-		return -1;
+	if (libtty_init(&uart->tty_common, &callbacks, BUFSIZE) < 0)
+		return -ENOMEM;
 
-	if (argc == 1) {
-		uart.dev_no = 1;
-	} else if (argc == 6) {
-		is_cooked = atoi(argv[1]);
-		uart.dev_no = atoi(argv[2]);
-		parity = atoi(argv[4]);
-		baud = libtty_int_to_baudrate(atoi(argv[3]));
-		use_rts_cts = atoi(argv[5]);
+	uart->dev_no = cfg->dev_no;
+	uart->prio = cfg->prio;
+
+	baud = libtty_int_to_baudrate(cfg->baud);
+	uart->tty_common.term.c_ispeed = uart->tty_common.term.c_ospeed = baud;
+
+	if (cfg->parity > 0)
+		uart->tty_common.term.c_cflag = PARENB | ((cfg->parity == 1) ? PARODD : 0);
+
+	if (!cfg->is_cooked)
+		libtty_set_mode_raw(&uart->tty_common);
+
+	uart->base = mmap(NULL, 0x1000, PROT_WRITE | PROT_READ, MAP_DEVICE, OID_PHYSMEM, uart_addr[uart->dev_no - 1]);
+
+	if (uart->base == MAP_FAILED)
+		return -ENOMEM;
+
+	set_clk(uart->dev_no);
+	*(uart->base + ucr2) &= ~0;
+
+	/* set correct daisy for rx input */
+	set_mux(uart->dev_no, cfg->use_rts_cts);
+
+	while (!(*(uart->base + ucr2) & 1));
+
+	if (mutexCreate(&uart->lock) != EOK)
+		return -ENOMEM;
+
+	if (condCreate(&uart->cond) != EOK)
+		return -ENOMEM;
+
+	interrupt(uart_intr_number[uart->dev_no - 1], uart_intr, uart, uart->cond, &uart->inth);
+
+
+	/* set TX & RX FIFO watermark, DCE mode */
+	*(uart->base + ufcr) = (UART_TXWATERMARK << 10) | (0 << 6) | UART_RXWATERMARK;
+	uart->txtl = UART_TXWATERMARK;
+
+	/* set Reference Frequency Divider to 1, needed for rates above 1.25 Mbps */
+	*(uart->base + ufcr) &= ~(0b111 << 7);
+	*(uart->base + ufcr) |= 0b101 << 7;
+	*(uart->base + onems) = UART_REFCLK / 1000;
+
+	/* enable uart and rx ready interrupt */
+	*(uart->base + ucr1) |= 0x0201;
+
+	/* soft reset, tx&rx enable, 8bit transmit */
+	*(uart->base + ucr2) = 0x4027;
+
+	set_cflag(uart, &uart->tty_common.term.c_cflag);
+	set_baudrate(uart, baud);
+
+	*(uart->base + ucr3) = 0x704;
+
+	if (cfg->dma_channel != 0) {
+		if ((err = uart_dmainit(uart, cfg->dma_channel)) == EOK)
+			uart->use_dma = 1;
+		else
+			printf("imx6ull-uart: uart%u SDMA init failed (%d), using PIO\n", uart->dev_no, err);
+	}
+
+	set_hwfifo(uart, &uart->tty_common.hwfifo);
+
+	if (uart->use_dma) {
+		/* FIFO levels at which the SDMA scripts are requested */
+		*(uart->base + ufcr) &= ~((0x3f << 10) | 0x3f);
+		*(uart->base + ufcr) |= (UART_DMA_TXTL << 10) | UART_DMA_RXTL;
+
+		/* RX by DMA (also on aging timer and IDLE), no RRDY interrupt */
+		*(uart->base + ucr1) &= ~(1 << 9);
+		*(uart->base + ucr1) |= (1 << 8) | (1 << 2);
+		*(uart->base + ucr4) |= (1 << 6);
+
+		beginthread(uart_dmarxthr, uart->prio, uart->stack0, sizeof(uart->stack0), uart);
+		beginthread(uart_dmatxthr, uart->prio, uart->stack1, sizeof(uart->stack1), uart);
 	} else {
-		print_usage(argv[0]);
-		return 0;
+		beginthread(uart_intrthr, uart->prio, uart->stack0, sizeof(uart->stack0), uart);
 	}
 
-	if (baud < 0) {
+	return EOK;
+}
+
+
+static int uart_checkcfg(const uart_cfg_t *cfg)
+{
+	if (libtty_int_to_baudrate(cfg->baud) < 0) {
 		printf("Invalid baud rate!\n");
-		print_usage(argv[0]);
-		return 1;
+		return -EINVAL;
 	}
-	uart.tty_common.term.c_ispeed = uart.tty_common.term.c_ospeed = baud;
 
-	if (parity < 0 || parity > 2) {
+	if (cfg->parity < 0 || cfg->parity > 2) {
 		printf("Invalid parity!\n");
-		print_usage(argv[0]);
-		return 1;
+		return -EINVAL;
 	}
-	if (parity > 0)
-		uart.tty_common.term.c_cflag = PARENB | ((parity == 1) ? PARODD : 0);
-
-	if (!is_cooked)
-		libtty_set_mode_raw(&uart.tty_common);
 
-	if (uart.dev_no <= 0 || uart.dev_no > 8) {
+	if (cfg->dev_no <= 0 || cfg->dev_no > UART_MAXPORTS) {
 		printf("device number must be value 1-8\n");
-		print_usage(argv[0]);
-		return 1;
+		return -EINVAL;
 	}
 
-	if (portCreate(&port) != EOK)
-		return 2;
+	/* channel 0 is reserved by the SDMA driver, TX takes the next one */
+	if (cfg->dma_channel < 0 || cfg->dma_channel > 30) {
+		printf("SDMA channel must be value 1-30 (0 - PIO)\n");
+		return -EINVAL;
+	}
 
-	uart.base = mmap(NULL, 0x1000, PROT_WRITE | PROT_READ, MAP_DEVICE, OID_PHYSMEM, uart_addr[uart.dev_no - 1]);
+	if (cfg->prio < 0 || cfg->prio > 7) {
+		printf("priority must be value 0-7\n");
+		return -EINVAL;
+	}
 
-	if (uart.base == MAP_FAILED)
-		return 2;
+	return EOK;
+}
 
-	set_clk(uart.dev_no);
-	*(uart.base + ucr2) &= ~0;
 
-	/* set correct daisy for rx input */
-	set_mux(uart.dev_no, use_rts_cts);
+static void uart_defcfg(uart_cfg_t *cfg)
+{
+	cfg->dev_no = 1;
+	cfg->is_cooked = 1;
+	cfg->baud = 115200;
+	cfg->parity = 0;
+	cfg->use_rts_cts = 0;
+	cfg->dma_channel = 0;
+	cfg->prio = UART_PRIO;
+}
+
+
+/* device[:mode[:speed[:parity[:use_rts_cts[:dma[:priority]]]]]] */
+static int uart_parsecfg(char *arg, uart_cfg_t *cfg)
+{
+	int *fields[] = { &cfg->dev_no, &cfg->is_cooked, &cfg->baud, &cfg->parity, &cfg->use_rts_cts, &cfg->dma_channel, &cfg->prio };
+	unsigned int i;
+	char *tok;
 
-	while (!(*(uart.base + ucr2) & 1));
+	uart_defcfg(cfg);
+
+	for (i = 0, tok = strtok(arg, ":"); tok != NULL; ++i, tok = strtok(NULL, ":")) {
+		if (i >= sizeof(fields) / sizeof(fields[0]))
+			return -EINVAL;
+		*fields[i] = atoi(tok);
+	}
+
+	return (i == 0) ? -EINVAL : EOK;
+}
 
-	if (mutexCreate(&uart.lock) != EOK)
+
+static void print_usage(const char* progname) {
+	printf("Usage: %s [mode] [device] [speed] [parity] [use_rts_cts] [dma] or no args for default settings (cooked, uart1, B115200, 8N1)\n", progname);
+	printf("       %s -p device[:mode[:speed[:parity[:use_rts_cts[:dma[:priority]]]]]] [-p ...] [-t threads]\n", progname);
+	printf("\tmode: 0 - raw, 1 - cooked\n\tdevice: 1 to 8\n");
+	printf("\tspeed: baud_rate\n\tparity: 0 - none, 1 - odd, 2 - even\n");
+	printf("\tuse_rts_cts: 0 - no hardware flow control, 1 - use hardware flow control\n");
+	printf("\tdma: 0 - PIO (default), n - use SDMA channels n (RX) and n + 1 (TX)\n");
+	printf("\tpriority: priority of the port's interrupt threads (default %d)\n", UART_PRIO);
+	printf("\t-p: serve a port (may be repeated), -t: number of message threads shared by all ports (default: ports + 1)\n");
+}
+
+int main(int argc, char **argv)
+{
+	char uartn[sizeof("uartx") + 1];
+	oid_t dev;
+	int err, c, i, nthreads = 0, ncfgs = 0;
+	unsigned int used = 0;
+	uart_cfg_t cfgs[UART_MAXPORTS];
+	uart_t *uart;
+	void *stack;
+
+	if (argc == 1) {
+		uart_defcfg(&cfgs[ncfgs++]);
+	} else if (argv[1][0] != '-') {
+		if (argc != 6 && argc != 7) {
+			print_usage(argv[0]);
+			return 0;
+		}
+
+		uart_defcfg(&cfgs[0]);
+		cfgs[0].is_cooked = atoi(argv[1]);
+		cfgs[0].dev_no = atoi(argv[2]);
+		cfgs[0].baud = atoi(argv[3]);
+		cfgs[0].parity = atoi(argv[4]);
+		cfgs[0].use_rts_cts = atoi(argv[5]);
+		if (argc == 7)
+			cfgs[0].dma_channel = atoi(argv[6]);
+		ncfgs = 1;
+	} else {
+		while ((c = getopt(argc, argv, "p:t:h")) != -1) {
+			switch (c) {
+			case 'p':
+				if (ncfgs >= UART_MAXPORTS || uart_parsecfg(optarg, &cfgs[ncfgs]) < 0) {
+					print_usage(argv[0]);
+					return 1;
+				}
+				++ncfgs;
+				break;
+			case 't':
+				nthreads = atoi(optarg);
+				break;
+			default:
+				print_usage(argv[0]);
+				return (c == 'h') ? 0 : 1;
+			}
+		}
+
+		if (ncfgs == 0 || nthreads < 0) {
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < ncfgs; ++i) {
+		if (uart_checkcfg(&cfgs[i]) < 0) {
+			print_usage(argv[0]);
+			return 1;
+		}
+
+		if (used & (1 << cfgs[i].dev_no)) {
+			printf("uart%d given more than once\n", cfgs[i].dev_no);
+			return 1;
+		}
+		used |= 1 << cfgs[i].dev_no;
+	}
+
+	if (portCreate(&uart_common.port) != EOK)
 		return 2;
 
-	if (condCreate(&uart.cond) != EOK)
+	if (mutexCreate(&uart_common.rlock) != EOK || condCreate(&uart_common.rcond) != EOK)
 		return 2;
 
-	interrupt(uart_intr_number[uart.dev_no - 1], uart_intr, NULL, uart.cond, &uart.inth);
+	for (i = 0; i < ncfgs; ++i) {
+		if ((uart = malloc(sizeof(*uart))) == NULL)
+			return 2;
 
+		memset(uart, 0, sizeof(*uart));
 
-	/* set TX & RX FIFO watermark, DCE mode */
-	*(uart.base + ufcr) = (0x04 << 10) | (0 << 6) | (0x1);
+		if ((err = uart_init(uart, &cfgs[i])) < 0) {
+			printf("imx6ull-uart: uart%d init failed (%d)\n", cfgs[i].dev_no, err);
+			return 2;
+		}
 
-	/* set Reference Frequency Divider */
-	*(uart.base + ufcr) &= ~(0b111 << 7);
-	*(uart.base + ufcr) |= 0b010 << 7;
+		uart_common.uarts[uart->dev_no - 1] = uart;
 
-	/* enable uart and rx ready interrupt */
-	*(uart.base + ucr1) |= 0x0201;
+		sprintf(uartn, "uart%u", uart->dev_no % 10);
 
-	/* soft reset, tx&rx enable, 8bit transmit */
-	*(uart.base + ucr2) = 0x4027;
+		dev.port = uart_common.port;
+		dev.id = uart->dev_no - 1;
 
-	set_cflag(&uart, &uart.tty_common.term.c_cflag);
-	set_baudrate(&uart, baud);
+		if ((err = create_dev(&dev, uartn)))
+			debug("imx6ull-uart: Could not create device file\n");
+	}
 
-	*(uart.base + ucr3) = 0x704;
+	if ((stack = malloc(POOL_STACKSZ)) == NULL)
+		return 2;
 
-	beginthread(uart_intrthr, 3, &stack0, 2048, NULL);
-	beginthread(uart_thr, 3, &stack, 2048, (void *)port);
+	beginthread(uart_timerthr, UART_PRIO, stack, POOL_STACKSZ, NULL);
 
-	sprintf(uartn, "uart%u", uart.dev_no % 10);
+	/* reads don't block, but writes wait for space in the TX buffer - one thread per port plus a spare */
+	if (nthreads == 0)
+		nthreads = ncfgs + 1;
 
-	dev.port = port;
-	dev.id = 0;
+	for (i = 1; i < nthreads; ++i) {
+		if ((stack = malloc(POOL_STACKSZ)) == NULL)
+			return 2;
 
-	if ((err = create_dev(&dev, uartn)))
-		debug("imx6ull-uart: Could not create device file\n");
+		beginthread(uart_thr, UART_PRIO, stack, POOL_STACKSZ, NULL);
+	}
 
-	uart_thr((void *)port);
+	uart_thr(NULL);
 
 	return 0;
 }
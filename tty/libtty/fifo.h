@@ -1,6 +1,9 @@
 #ifndef _LIBTTY_FIFO_H
 #define _LIBTTY_FIFO_H
 
+#include <stdint.h>
+#include <string.h>
+
 typedef struct fifo_s fifo_t;
 
 struct fifo_s {
@@ -59,6 +62,27 @@ static inline void fifo_push(fifo_t *f, uint8_t byte)
 }
 
 
+/* push up to len bytes (as many as fit), returns number of bytes pushed */
+static inline unsigned int fifo_push_many(fifo_t *f, const uint8_t *data, unsigned int len)
+{
+	unsigned int part, free = fifo_freespace(f);
+
+	if (len > free)
+		len = free;
+
+	/* at most two copies - up to the end of the buffer and from its begining */
+	part = f->size_mask + 1 - f->head;
+	if (part > len)
+		part = len;
+
+	memcpy(&f->data[f->head], data, part);
+	memcpy(&f->data[0], data + part, len - part);
+	f->head = (f->head + len) & f->size_mask;
+
+	return len;
+}
+
+
 static inline uint8_t fifo_pop_back(fifo_t *f)
 {
 	uint8_t ret = f->data[f->tail];
@@ -68,6 +92,26 @@ static inline uint8_t fifo_pop_back(fifo_t *f)
 }
 
 
+/* pop up to len oldest bytes, returns number of bytes copied out */
+static inline unsigned int fifo_pop_back_many(fifo_t *f, uint8_t *data, unsigned int len)
+{
+	unsigned int part, cnt = fifo_count(f);
+
+	if (len > cnt)
+		len = cnt;
+
+	part = f->size_mask + 1 - f->tail;
+	if (part > len)
+		part = len;
+
+	memcpy(data, &f->data[f->tail], part);
+	memcpy(data + part, &f->data[0], len - part);
+	f->tail = (f->tail + len) & f->size_mask;
+
+	return len;
+}
+
+
 static inline uint8_t fifo_pop_front(fifo_t *f)
 {
 	unsigned int new_head = (f->head - 1) & f->size_mask;
@@ -84,6 +128,12 @@ static inline uint8_t fifo_peek_front(fifo_t *f)
 	return ret;
 }
 
+/* n-th byte counting from the oldest one */
+static inline uint8_t fifo_peek_back(fifo_t *f, unsigned int n)
+{
+	return f->data[(f->tail + n) & f->size_mask];
+}
+
 static inline int fifo_has_char(fifo_t *f, char byte)
 {
 	unsigned int tail = f->tail;
@@ -68,26 +68,95 @@
 
 #define TX_FIFO_NOTFULL_WATERMARK	16  // amount of free space in fifo before we will wake up the writer
 
+static inline void rx_special_set(uint32_t *special, unsigned char c)
+{
+	special[c >> 5] |= 1u << (c & 0x1f);
+}
+
+static inline void rx_special_set_cc(libtty_common_t* tty, uint32_t *special, int idx)
+{
+	if (tty->term.c_cc[idx] != _POSIX_VDISABLE)
+		rx_special_set(special, tty->term.c_cc[idx]);
+}
+
 static void termios_optimize(libtty_common_t* tty)
 {
+	uint32_t special, rx_special[sizeof(tty->rx_special) / sizeof(tty->rx_special[0])];
+	char breakchars[sizeof(tty->breakchars)] = { 0 };
+	unsigned int n = 1;
+	int changed;
+
 	// check break characters list
-	tty->breakchars[0] = CNL;
-	int n = 1;
+	breakchars[0] = CNL;
 
 	if (tty->term.c_cc[VEOF] != _POSIX_VDISABLE)
-		tty->breakchars[n++] = tty->term.c_cc[VEOF];
+		breakchars[n++] = tty->term.c_cc[VEOF];
 
 	if (tty->term.c_cc[VEOL] != _POSIX_VDISABLE)
-		tty->breakchars[n++] = tty->term.c_cc[VEOL];
+		breakchars[n++] = tty->term.c_cc[VEOL];
+
+	breakchars[n] = '\0';
+
+	// input chars which can't be copied directly into the RX FIFO
+	memset(rx_special, 0, sizeof(rx_special));
+
+	if (CMP_FLAG(i, ISTRIP))
+		memset(&rx_special[4], 0xff, 4 * sizeof(rx_special[0]));
+
+	if (CMP_FLAG(i, IGNCR | ICRNL))
+		rx_special_set(rx_special, CCR);
+
+	if (CMP_FLAG(i, INLCR) || CMP_FLAG(l, ECHONL))
+		rx_special_set(rx_special, CNL);
+
+	if (CMP_FLAG(l, ECHO)) {
+		/* control chars may need ^X notation or output processing on echo */
+		rx_special[0] = 0xffffffff;
+		rx_special_set(rx_special, 0x7f);
+	}
 
-	tty->breakchars[n] = '\0';
+	if (CMP_FLAG(l, ISIG)) {
+		rx_special_set_cc(tty, rx_special, VINTR);
+		rx_special_set_cc(tty, rx_special, VQUIT);
+		rx_special_set_cc(tty, rx_special, VSUSP);
+	}
+
+	if (CMP_FLAG(l, IEXTEN))
+		rx_special_set_cc(tty, rx_special, VLNEXT);
 
-	// check if we have break char in the RX FIFO
-	tty->t_flags &= ~TF_HAVEBREAK;
 	if (CMP_FLAG(l, ICANON)) {
-		if (libttydisc_rx_have_breakchar(tty))
-			tty->t_flags |= TF_HAVEBREAK;
+		rx_special_set(rx_special, CNL);
+		rx_special_set_cc(tty, rx_special, VEOF);
+		rx_special_set_cc(tty, rx_special, VEOL);
+		rx_special_set_cc(tty, rx_special, VERASE);
+		rx_special_set_cc(tty, rx_special, VERASE2);
+		rx_special_set_cc(tty, rx_special, VKILL);
+	}
+
+	// no special chars at all - input can bypass the line discipline
+	for (n = 0, special = 0; n < sizeof(rx_special) / sizeof(rx_special[0]); ++n)
+		special |= rx_special[n];
+
+	// publish under rx_mutex - the RX path (libtty_putchar(s)) uses these without other locking
+	mutexLock(tty->rx_mutex);
+	memcpy(tty->rx_special, rx_special, sizeof(rx_special));
+
+	tty->t_flags &= ~TF_BYPASS;
+	if (special == 0)
+		tty->t_flags |= TF_BYPASS;
+
+	changed = memcmp(breakchars, tty->breakchars, sizeof(breakchars)) != 0;
+	memcpy(tty->breakchars, breakchars, sizeof(breakchars));
+
+	// count break chars in the RX FIFO only when entering ICANON or when they have changed
+	if (!CMP_FLAG(l, ICANON)) {
+		tty->t_flags &= ~TF_BREAKCNT;
+		tty->rx_breaks = 0;
+	} else if (!(tty->t_flags & TF_BREAKCNT) || changed) {
+		tty->rx_breaks = libttydisc_rx_count_breakchars(tty);
+		tty->t_flags |= TF_BREAKCNT;
 	}
+	mutexUnlock(tty->rx_mutex);
 }
 
 static void termios_init(struct termios* term)
@@ -172,26 +241,61 @@ ssize_t libtty_read_nonblock(libtty_common_t *tty, char *data, size_t size, unsi
 
 unsigned char libtty_getchar(libtty_common_t *tty, int *wake_writer)
 {
+	fifo_t *f = tty->tx_fifo; /* swapped by libtty_resize() only when drained */
+	unsigned char ret;
+
 	if (wake_writer)
 		*wake_writer = 0;
 
-	unsigned char ret = fifo_pop_back(tty->tx_fifo);
-	if (fifo_freespace(tty->rx_fifo) >= TX_FIFO_NOTFULL_WATERMARK) {
+	ret = fifo_pop_back(f);
+	tty->stats.tx_bytes += 1;
+	if (fifo_freespace(f) >= TX_FIFO_NOTFULL_WATERMARK) {
 		if (wake_writer)
 			*wake_writer = 1;
+		tty->stats.writer_wakeups += 1;
 		condSignal(tty->tx_waitq);
 	}
 
 	return ret;
 }
 
+size_t libtty_getchars(libtty_common_t *tty, unsigned char *data, size_t size, int *wake_writer)
+{
+	fifo_t *f = tty->tx_fifo; /* swapped by libtty_resize() only when drained */
+	size_t len;
+
+	if (wake_writer)
+		*wake_writer = 0;
+
+	len = fifo_pop_back_many(f, data, size);
+	tty->stats.tx_bytes += len;
+	if (len > 0 && fifo_freespace(f) >= TX_FIFO_NOTFULL_WATERMARK) {
+		if (wake_writer)
+			*wake_writer = 1;
+		tty->stats.writer_wakeups += 1;
+		condSignal(tty->tx_waitq);
+	}
+
+	return len;
+}
+
+static fifo_t *fifo_alloc(unsigned int size)
+{
+	fifo_t *f = malloc(sizeof(fifo_t) + size * sizeof(f->data[0]));
+
+	if (f != NULL)
+		fifo_init(f, size);
+
+	return f;
+}
+
 int libtty_init(libtty_common_t* tty, libtty_callbacks_t* callbacks, unsigned int bufsize)
 {
 	memset(tty, 0, sizeof(*tty));
 	tty->cb = *callbacks;
 
-	tty->tx_fifo = malloc(sizeof(fifo_t) + bufsize * sizeof(tty->tx_fifo->data[0]));
-	tty->rx_fifo = malloc(sizeof(fifo_t) + bufsize * sizeof(tty->tx_fifo->data[0]));
+	tty->tx_fifo = fifo_alloc(bufsize);
+	tty->rx_fifo = fifo_alloc(bufsize);
 	if (tty->tx_fifo == NULL || tty->rx_fifo == NULL) {
 		free(tty->tx_fifo);
 		free(tty->rx_fifo);
@@ -210,12 +314,13 @@ int libtty_init(libtty_common_t* tty, libtty_callbacks_t* callbacks, unsigned in
 	if (mutexCreate(&tty->rx_mutex) != EOK)
 		return -1;
 
-	fifo_init(tty->tx_fifo, bufsize);
-	fifo_init(tty->rx_fifo, bufsize);
+	tty->bufsz.tx = tty->bufsz.rx = bufsize;
 
 	termios_init(&tty->term);
 	termios_optimize(tty);
 
+	tty->rx_wake_thr = 1;
+
 	tty->ws.ws_row = 25;
 	tty->ws.ws_col = 80;
 	tty->pgrp = -1;
@@ -249,6 +354,7 @@ int libtty_destroy(libtty_common_t* tty)
 
 	free(tty->tx_fifo);
 	free(tty->rx_fifo);
+	free(tty->tx_retired);
 
 	return 0;
 }
@@ -269,10 +375,12 @@ ssize_t libtty_write(libtty_common_t *tty, const char *data, size_t size, unsign
 	mutexLock(tty->tx_mutex);
 
 	int fifo_freespace_for_single_char = CMP_FLAG(o, OPOST) ? LIBTTYDISC_WRITE_OPROC_MAXLEN : 1;
+	size_t n, maxlen;
+	time_t start, end;
 
 	/* write contents of the buffer */
 	while (len < size) {
-		while (fifo_freespace(tty->tx_fifo) < fifo_freespace_for_single_char) {
+		while ((maxlen = fifo_freespace(tty->tx_fifo)) < fifo_freespace_for_single_char) {
 			if (tty->t_flags & TF_CLOSING)
 				goto exit;
 
@@ -280,17 +388,38 @@ ssize_t libtty_write(libtty_common_t *tty, const char *data, size_t size, unsign
 				goto exit;
 
 			CALLBACK(signal_txready);
-			condWait(tty->tx_waitq, tty->tx_mutex, 0);
+
+			/* the callback may have already consumed the data (synchronous HW) */
+			if (fifo_freespace(tty->tx_fifo) < fifo_freespace_for_single_char) {
+				gettime(&start, NULL);
+				condWait(tty->tx_waitq, tty->tx_mutex, 0);
+				gettime(&end, NULL);
+				tty->stats.write_blocked_us += end - start;
+			}
 		}
 
-		if (CMP_FLAG(o, OPOST) && (CTL_VALID(*data))) { // we need to process this char
+		if (maxlen > size - len)
+			maxlen = size - len;
+
+		/* find a run of chars which don't need output processing */
+		if (CMP_FLAG(o, OPOST)) {
+			for (n = 0; n < maxlen && !CTL_VALID(data[n]); ++n)
+				;
+		} else {
+			n = maxlen;
+		}
+
+		if (n == 0) { // we need to process this char
 			libttydisc_write_oproc(tty, *data);
+			n = 1;
 		} else {
-			fifo_push(tty->tx_fifo, *data);
+			fifo_push_many(tty->tx_fifo, (const uint8_t *)data, n);
 		}
 
-		len += 1;
-		data += 1;
+		libttydisc_stats_fill(&tty->stats.tx_maxfill, tty->tx_fifo);
+
+		len += n;
+		data += n;
 	}
 
 	//DEBUG_CHAR('W');
@@ -333,7 +462,13 @@ int libtty_txfull(libtty_common_t* tty)
 
 int libtty_rxready(libtty_common_t* tty)
 {
-	return !fifo_is_empty(tty->rx_fifo);
+	int ret;
+
+	mutexLock(tty->rx_mutex);
+	ret = !fifo_is_empty(tty->rx_fifo);
+	mutexUnlock(tty->rx_mutex);
+
+	return ret;
 }
 
 int libtty_poll_status(libtty_common_t* tty)
@@ -345,8 +480,10 @@ int libtty_poll_status(libtty_common_t* tty)
 		if (libtty_rxready(tty))
 			revents |= POLLIN|POLLRDNORM;
 	} else {
-		if (tty->t_flags & TF_HAVEBREAK)
+		mutexLock(tty->rx_mutex);
+		if (libttydisc_rx_have_line(tty))
 			revents |= POLLIN|POLLRDNORM;
+		mutexUnlock(tty->rx_mutex);
 	}
 
 	if (!libtty_txfull(tty))
@@ -378,6 +515,7 @@ void libtty_flush(libtty_common_t* tty, int type)
 	if (type == TCIFLUSH || type == TCIOFLUSH) {
 		mutexLock(tty->rx_mutex);
 		fifo_remove_all(tty->rx_fifo);
+		tty->rx_breaks = 0;
 		mutexUnlock(tty->rx_mutex);
 	}
 
@@ -393,6 +531,91 @@ void libtty_flush(libtty_common_t* tty, int type)
 	termios_optimize(tty);
 }
 
+static unsigned int bufsz_roundup(unsigned int size, unsigned int curr)
+{
+	unsigned int ret = LIBTTY_BUFSZ_MIN;
+
+	if (size == 0)
+		return curr;
+
+	if (size > LIBTTY_BUFSZ_MAX)
+		return 0;
+
+	while (ret < size)
+		ret <<= 1;
+
+	return ret;
+}
+
+static int libtty_resize(libtty_common_t* tty, const libtty_bufsz_t *req)
+{
+	libtty_bufsz_t sz;
+	fifo_t *tx = NULL, *rx = NULL, *old;
+	int ret = 0;
+
+	sz.tx = bufsz_roundup(req->tx, tty->bufsz.tx);
+	sz.rx = bufsz_roundup(req->rx, tty->bufsz.rx);
+	if (sz.tx == 0 || sz.rx == 0)
+		return -EINVAL;
+
+	if ((sz.tx != tty->bufsz.tx && (tx = fifo_alloc(sz.tx)) == NULL) ||
+			(sz.rx != tty->bufsz.rx && (rx = fifo_alloc(sz.rx)) == NULL)) {
+		free(tx);
+		return -ENOMEM;
+	}
+
+	mutexLock(tty->tx_mutex);
+	mutexLock(tty->rx_mutex);
+
+	/* TX fifo is consumed by the HW without locking - swap it only when drained
+	 * (echo pushes to it under rx_mutex, so check it with both mutexes held) */
+	while (tx != NULL && !fifo_is_empty(tty->tx_fifo)) {
+		if (tty->t_flags & TF_CLOSING) {
+			ret = -EBADF;
+			break;
+		}
+
+		mutexUnlock(tty->rx_mutex);
+		CALLBACK(signal_txready);
+		if (!fifo_is_empty(tty->tx_fifo))
+			condWait(tty->tx_waitq, tty->tx_mutex, 0);
+		mutexLock(tty->rx_mutex);
+	}
+
+	/* RX fifo is accessed only under rx_mutex - move the pending data, the old one can go right away */
+	if (ret == 0 && rx != NULL) {
+		if (fifo_count(tty->rx_fifo) < sz.rx) {
+			rx->head = fifo_pop_back_many(tty->rx_fifo, rx->data, fifo_count(tty->rx_fifo));
+
+			old = tty->rx_fifo;
+			tty->rx_fifo = rx;
+			tty->bufsz.rx = sz.rx;
+			rx = old;
+		} else {
+			ret = -EBUSY;
+		}
+	}
+
+	/* the drained TX fifo may still be seen by a lock-free HW reader - keep it until the next swap
+	 * (the reader has moved to the current fifo since, it's drained before swapping too) */
+	if (ret == 0 && tx != NULL) {
+		old = tty->tx_fifo;
+		tty->tx_fifo = tx;
+		tty->bufsz.tx = sz.tx;
+		tx = tty->tx_retired;
+		tty->tx_retired = old;
+	}
+
+	mutexUnlock(tty->rx_mutex);
+	mutexUnlock(tty->tx_mutex);
+
+	/* old buffers or the new ones if resizing failed */
+	free(tx);
+	free(rx);
+
+	return ret;
+}
+
 int libtty_ioctl(libtty_common_t* tty, pid_t sender_pid, unsigned int cmd, const void* in_arg, const void** out_arg)
 {
 	struct termios *termios_p = (struct termios *)in_arg;
@@ -460,6 +683,52 @@ int libtty_ioctl(libtty_common_t* tty, pid_t sender_pid, unsigned int cmd, const
 			termios_print_flags(&tty->term);
 			break;
 		}
+		case LIBTTY_IOCSRXWAKE: {
+			const libtty_rxwake_t *rxwake = (const libtty_rxwake_t *)in_arg;
+
+			log_ioctl("LIBTTY_IOCSRXWAKE(min=%u, idle_us=%u, highwater=%u)", rxwake->min, rxwake->idle_us, rxwake->highwater);
+			mutexLock(tty->rx_mutex);
+			tty->rxwake = *rxwake;
+			mutexUnlock(tty->rx_mutex);
+			break;
+		}
+		case LIBTTY_IOCGRXWAKE:
+			log_ioctl("LIBTTY_IOCGRXWAKE");
+			*out_arg = (const void*) &tty->rxwake;
+			break;
+		case LIBTTY_IOCSBUFSZ: {
+			const libtty_bufsz_t *bufsz = (const libtty_bufsz_t *)in_arg;
+
+			log_ioctl("LIBTTY_IOCSBUFSZ(tx=%u, rx=%u)", bufsz->tx, bufsz->rx);
+			ret = libtty_resize(tty, bufsz);
+			break;
+		}
+		case LIBTTY_IOCGBUFSZ:
+			log_ioctl("LIBTTY_IOCGBUFSZ");
+			*out_arg = (const void*) &tty->bufsz;
+			break;
+		case LIBTTY_IOCGSTATS:
+			log_ioctl("LIBTTY_IOCGSTATS");
+			*out_arg = (const void*) &tty->stats;
+			break;
+		case LIBTTY_IOCRSTATS:
+			log_ioctl("LIBTTY_IOCRSTATS");
+			memset(&tty->stats, 0, sizeof(tty->stats));
+			break;
+		case LIBTTY_IOCSHWFIFO: {
+			libtty_hwfifo_t hwfifo = *(const libtty_hwfifo_t *)in_arg;
+
+			log_ioctl("LIBTTY_IOCSHWFIFO(rx=%u, tx=%u, idle=%u)", hwfifo.rx, hwfifo.tx, hwfifo.idle);
+			if (tty->cb.set_hwfifo == NULL)
+				ret = -EINVAL;
+			else if ((ret = tty->cb.set_hwfifo(tty->cb.arg, &hwfifo)) == EOK)
+				tty->hwfifo = hwfifo;
+			break;
+		}
+		case LIBTTY_IOCGHWFIFO:
+			log_ioctl("LIBTTY_IOCGHWFIFO");
+			*out_arg = (const void*) &tty->hwfifo;
+			break;
 		case TCGETS:
 			log_ioctl("TCGETS (%s)", ((tty->term.c_lflag & ICANON) ? "cooked" : "raw"));
 			*out_arg = (const void*) &tty->term;
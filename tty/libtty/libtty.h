@@ -18,11 +18,80 @@
 
 #include <stdint.h>
 #include <termios.h>
+#include <sys/ioctl.h>
+
+
+/* high speed rates missing in libc - values equal to the rate can't clash with the standard speed codes */
+#ifndef B921600
+#define B921600		921600
+#endif
+#ifndef B1000000
+#define B1000000	1000000
+#endif
+#ifndef B1500000
+#define B1500000	1500000
+#endif
+#ifndef B2000000
+#define B2000000	2000000
+#endif
+#ifndef B3000000
+#define B3000000	3000000
+#endif
+#ifndef B4000000
+#define B4000000	4000000
+#endif
 
 typedef struct libtty_common_s libtty_common_t;
 typedef struct libtty_callbacks_s libtty_callbacks_t;
 typedef struct fifo_s fifo_t;
 typedef struct libtty_read_state_s libtty_read_state_t;
+typedef struct libtty_rxwake_s libtty_rxwake_t;
+
+/* reader wake-up configuration (raw mode) */
+struct libtty_rxwake_s {
+	unsigned int min;	/* wake up blocked reader when that many bytes are available (0 - use VMIN) */
+	unsigned int idle_us;	/* or when the line was idle for that long (0 - use VTIME) */
+	unsigned int highwater;	/* always wake up the reader at this RX fifo fill level (0 - disabled) */
+};
+
+/* TX/RX buffer sizes, rounded up to the power of 2 (0 - don't change) */
+typedef struct {
+	unsigned int tx;
+	unsigned int rx;
+} libtty_bufsz_t;
+
+/* performance counters */
+typedef struct {
+	uint64_t rx_bytes;	/* bytes stored in RX fifo */
+	uint64_t tx_bytes;	/* bytes taken out of TX fifo by the HW */
+	uint32_t rx_overruns;	/* RX fifo overrun events */
+	uint32_t rx_dropped;	/* bytes lost due to RX overruns */
+	uint32_t reader_wakeups;	/* wake-ups issued to readers */
+	uint32_t writer_wakeups;	/* wake-ups issued to writers */
+	uint32_t rx_maxfill;	/* RX fifo high-water mark */
+	uint32_t tx_maxfill;	/* TX fifo high-water mark */
+	uint64_t write_blocked_us;	/* time writers spent waiting for TX fifo space */
+} libtty_stats_t;
+
+/* HW FIFO trigger levels in characters, adjusted by the driver to what the HW supports (0 - driver default) */
+typedef struct {
+	unsigned int rx;	/* RX FIFO level which wakes up the driver */
+	unsigned int tx;	/* TX FIFO level below which the driver refills it */
+	unsigned int idle;	/* idle line time which flushes the RX FIFO */
+} libtty_hwfifo_t;
+
+/* libtty specific ioctls */
+#define LIBTTY_IOCSRXWAKE	_IOW('T', 0xa0, libtty_rxwake_t)
+#define LIBTTY_IOCGRXWAKE	_IOR('T', 0xa1, libtty_rxwake_t)
+#define LIBTTY_IOCSBUFSZ	_IOW('T', 0xa2, libtty_bufsz_t)
+#define LIBTTY_IOCGBUFSZ	_IOR('T', 0xa3, libtty_bufsz_t)
+#define LIBTTY_IOCGSTATS	_IOR('T', 0xa4, libtty_stats_t)
+#define LIBTTY_IOCRSTATS	_IO('T', 0xa5)	/* reset statistics */
+#define LIBTTY_IOCSHWFIFO	_IOW('T', 0xa6, libtty_hwfifo_t)
+#define LIBTTY_IOCGHWFIFO	_IOR('T', 0xa7, libtty_hwfifo_t)
+
+#define LIBTTY_BUFSZ_MIN	32
+#define LIBTTY_BUFSZ_MAX	(1 << 20)
 
 struct libtty_callbacks_s {
 	void* arg; /* argument to be passed to each of the callbacks */
@@ -30,6 +99,7 @@ struct libtty_callbacks_s {
 	/* HW configuration */
 	void (*set_baudrate)(void* arg, speed_t baudrate);
 	void (*set_cflag)(void* arg, tcflag_t* cflag);
+	int (*set_hwfifo)(void* arg, libtty_hwfifo_t* hwfifo); /* optional, updates hwfifo with the applied levels */
 
 	/* at least one character ready to be sent */
 	void (*signal_txready)(void* arg);
@@ -43,6 +113,8 @@ struct libtty_common_s {
 
 	fifo_t *tx_fifo;
 	fifo_t *rx_fifo;
+	libtty_bufsz_t bufsz;
+	fifo_t *tx_retired;	/* previous TX fifo, lock-free HW reader may still see it after resizing */
 
 	handle_t tx_waitq;
 	handle_t rx_waitq;
@@ -52,8 +124,18 @@ struct libtty_common_s {
 
 	// cached optimizations
 	char breakchars[4];	/* enough to hold \n, VEOF and VEOL. */
+	uint32_t rx_special[8];	/* bitmap of input chars which need line discipline processing */
+	unsigned int rx_breaks;	/* number of breakchars in RX fifo (ICANON only) */
 	unsigned int t_flags;
 
+	libtty_stats_t stats;
+	libtty_hwfifo_t hwfifo;	/* current HW FIFO levels (maintained by the driver) */
+
+	libtty_rxwake_t rxwake;
+	unsigned int rx_wake_thr;	/* wake up blocked readers at this RX fifo fill level */
+	unsigned int rx_waiters;	/* number of readers blocked in raw mode */
+	time_t rx_stamp;	/* last RX input while readers were blocked (us), restarts interchar timer */
+
 	// TODO: remove
 	volatile uint32_t* debug;
 };
@@ -70,7 +152,7 @@ static inline void libtty_read_state_init(libtty_read_state_t *st) {
 
 
 // t_flags
-#define	TF_HAVEBREAK	0x00001	/* There is a breakchar present in RX fifo */
+#define	TF_BREAKCNT	0x00001	/* rx_breaks is up to date */
 #define	TF_LITERAL	0x00200	/* Accept the next character literally. */
 #define	TF_BYPASS	0x04000	/* Optimized input path. */
 #define TF_CLOSING  0x08000 /* TTY is being closed */
@@ -100,6 +182,9 @@ ssize_t libtty_read_nonblock(libtty_common_t *tty, char *data, size_t size, unsi
 /* internal (HW) interface */
 int libtty_putchar(libtty_common_t *tty, unsigned char c, int *wake_reader);
 unsigned char libtty_getchar(libtty_common_t *tty, int *wake_writer);
+/* bulk variants - lock and wake up the other side once per burst */
+int libtty_putchars(libtty_common_t *tty, const unsigned char *data, size_t size, int *wake_reader);
+size_t libtty_getchars(libtty_common_t *tty, unsigned char *data, size_t size, int *wake_writer);
 void libtty_signal_pgrp(libtty_common_t* tty, int signal);
 
 int libtty_txready(libtty_common_t *tty);	// at least 1 character ready to be sent
@@ -131,6 +216,12 @@ static inline int libtty_baudrate_to_int(speed_t baudrate)
 	case B115200:	return 115200;
 	case B230400:	return 230400;
 	case B460800:	return 460800;
+	case B921600:	return 921600;
+	case B1000000:	return 1000000;
+	case B1500000:	return 1500000;
+	case B2000000:	return 2000000;
+	case B3000000:	return 3000000;
+	case B4000000:	return 4000000;
 	}
 
 	return -1;
@@ -152,6 +243,12 @@ static inline speed_t libtty_int_to_baudrate(int baudrate) {
 	case 115200:	return B115200;
 	case 230400:	return B230400;
 	case 460800:	return B460800;
+	case 921600:	return B921600;
+	case 1000000:	return B1000000;
+	case 1500000:	return B1500000;
+	case 2000000:	return B2000000;
+	case 3000000:	return B3000000;
+	case 4000000:	return B4000000;
 	}
 
 	return -1;
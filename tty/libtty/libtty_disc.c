@@ -91,17 +91,20 @@
 #define CTL_ALNUM(c)	(((c) >= '0' && (c) <= '9') || \
     ((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z'))
 
-/* writing chars to TX buffer without any futher processing */
-static int tx_write_ifspace(libtty_common_t* tty, const char* data, size_t len)
+/* storing chars in TX buffer without any futher processing and without notifying the HW */
+static int tx_push_ifspace(libtty_common_t* tty, const char* data, size_t len)
 {
 	// WARN: no locking
-	const char* data_end = data + len;
+	return fifo_push_many(tty->tx_fifo, (const uint8_t *)data, len);
+}
 
-	while ((data < data_end) && !fifo_is_full(tty->tx_fifo))
-		fifo_push(tty->tx_fifo, (uint8_t) *data++);
+/* writing chars to TX buffer without any futher processing */
+static int tx_write_ifspace(libtty_common_t* tty, const char* data, size_t len)
+{
+	int ret = tx_push_ifspace(tty, data, len);
 
 	CALLBACK(signal_txready);
-	return len - (data_end - data);
+	return ret;
 }
 
 static int libttydisc_echo(libtty_common_t *tty, char c)
@@ -118,7 +121,10 @@ static int libttydisc_echo(libtty_common_t *tty, char c)
 		 * Only perform postprocessing when OPOST is turned on
 		 * and the character is an unquoted BS/TB/NL/CR.
 		 */
-		return libttydisc_write_oproc(tty, c);
+		int ret = libttydisc_write_oproc(tty, c);
+
+		CALLBACK(signal_txready);
+		return ret;
 	} else if (CMP_FLAG(l, ECHOCTL) && CTL_PRINT(c)) {
 		/*
 		 * Only use ^X notation when ECHOCTL is turned on and
@@ -183,10 +189,10 @@ static int libttydisc_rubchar(libtty_common_t* tty)
 	return 0;
 }
 
-int libtty_putchar(libtty_common_t *tty, unsigned char c, int *wake_reader)
+/* full input processing of a single char, rx_mutex has to be taken by the caller */
+static void libttydisc_putchar_locked(libtty_common_t *tty, unsigned char c, int *wake_reader)
 {
-	if (wake_reader)
-		*wake_reader = 0;
+	unsigned int pushed = 1;
 
 	/* ISTRIP: removing the top bit */
 	if (CMP_FLAG(i, ISTRIP))
@@ -207,7 +213,7 @@ int libtty_putchar(libtty_common_t *tty, unsigned char c, int *wake_reader)
 			/* echo the character before signalling the processes */
 			libttydisc_echo(tty, c);
 			libtty_signal_pgrp(tty, signal);
-			return 0;
+			return;
 		}
 	}
 
@@ -228,7 +234,7 @@ int libtty_putchar(libtty_common_t *tty, unsigned char c, int *wake_reader)
 					libttydisc_echo(tty, c);
 			}
 			tty->t_flags |= TF_LITERAL;
-			return (0);
+			return;
 		}
 	}
 
@@ -236,7 +242,7 @@ int libtty_putchar(libtty_common_t *tty, unsigned char c, int *wake_reader)
 	switch (c) {
 	case CCR:
 		if (CMP_FLAG(i, IGNCR))
-			return (0);
+			return;
 		if (CMP_FLAG(i, ICRNL))
 			c = CNL;
 		break;
@@ -250,18 +256,18 @@ int libtty_putchar(libtty_common_t *tty, unsigned char c, int *wake_reader)
 	if (CMP_FLAG(l, ICANON)) {
 		if (CMP_CC(VERASE, c) || CMP_CC(VERASE2, c)) {
 			libttydisc_rubchar(tty);
-			return 0;
+			return;
 		} else if (CMP_CC(VKILL, c)) {
 			while (libttydisc_rubchar(tty) == 0);
-			return 0;
+			return;
 #if 0
 		} else if (CMP_FLAG(l, IEXTEN)) {
 			if (CMP_CC(VWERASE, c)) {
 				ttydisc_rubword(tp);
-				return (0);
+				return;
 			} else if (CMP_CC(VREPRINT, c)) {
 				ttydisc_reprint(tp);
-				return (0);
+				return;
 			}
 #endif
 		}
@@ -269,31 +275,112 @@ int libtty_putchar(libtty_common_t *tty, unsigned char c, int *wake_reader)
 
 
 processed:
-	mutexLock(tty->rx_mutex);
 	if (!fifo_is_full(tty->rx_fifo)) {
 		fifo_push(tty->rx_fifo, c);
+		tty->stats.rx_bytes += 1;
+		libttydisc_stats_fill(&tty->stats.rx_maxfill, tty->rx_fifo);
 	} else {
 		log_warn("RX OVERRUN!");
+		tty->stats.rx_overruns += 1;
+		tty->stats.rx_dropped += 1;
+		pushed = 0;
 	}
 
 	libttydisc_echo(tty, c);
 
 	if (CMP_FLAG(l, ICANON)) {
-		// signal only when the line ends
+		// signal only when the line ends (or when the FIFO is full - it's read out as a line then)
 		if (libttydisc_is_breakchar(tty, c)) {
-			tty->t_flags |= TF_HAVEBREAK;
+			tty->rx_breaks += pushed;
+			*wake_reader = 1;
+		} else if (fifo_is_full(tty->rx_fifo)) {
+			*wake_reader = 1;
+		}
+	} else if (libttydisc_rx_wake_needed(tty)) {
+		*wake_reader = 1;
+	}
+}
+
 
-			if (wake_reader)
-				*wake_reader = 1;
-			condSignal(tty->rx_waitq);
+int libtty_putchar(libtty_common_t *tty, unsigned char c, int *wake_reader)
+{
+	int wake = 0;
+
+	mutexLock(tty->rx_mutex);
+	libttydisc_putchar_locked(tty, c, &wake);
+	if (tty->rx_waiters != 0)
+		gettime(&tty->rx_stamp, NULL);
+	if (wake) {
+		tty->stats.reader_wakeups += 1;
+		condSignal(tty->rx_waitq);
+	}
+	mutexUnlock(tty->rx_mutex);
+
+	if (wake_reader)
+		*wake_reader = wake;
+
+	return 0;
+}
+
+
+int libtty_putchars(libtty_common_t *tty, const unsigned char *data, size_t size, int *wake_reader)
+{
+	size_t len, pushed;
+	int wake = 0;
+
+	mutexLock(tty->rx_mutex);
+
+	while (size > 0) {
+		/* find a run of chars which can be stored without any processing */
+		len = 0;
+		if (!(tty->t_flags & TF_LITERAL)) {
+			if (tty->t_flags & TF_BYPASS)
+				len = size;
+			else
+				while (len < size && !libttydisc_is_special(tty, data[len]))
+					++len;
 		}
-	} else {
-		if (wake_reader)
-			*wake_reader = 1;
+
+		if (len > 0) {
+			pushed = fifo_push_many(tty->rx_fifo, data, len);
+			tty->stats.rx_bytes += pushed;
+			libttydisc_stats_fill(&tty->stats.rx_maxfill, tty->rx_fifo);
+			if (pushed < len) {
+				log_warn("RX OVERRUN!");
+				tty->stats.rx_overruns += 1;
+				tty->stats.rx_dropped += len - pushed;
+			}
+
+			/* regular chars are echoed as they are */
+			if (CMP_FLAG(l, ECHO))
+				tx_write_ifspace(tty, (const char *)data, len);
+
+			/* in canonical mode plain chars never end the line, but a full FIFO is read out as one */
+			if (CMP_FLAG(l, ICANON) ? fifo_is_full(tty->rx_fifo) : libttydisc_rx_wake_needed(tty))
+				wake = 1;
+
+			data += len;
+			size -= len;
+			continue;
+		}
+
+		libttydisc_putchar_locked(tty, *data++, &wake);
+		size -= 1;
+	}
+
+	if (tty->rx_waiters != 0)
+		gettime(&tty->rx_stamp, NULL);
+
+	/* wake up the reader once per burst */
+	if (wake) {
+		tty->stats.reader_wakeups += 1;
 		condSignal(tty->rx_waitq);
 	}
 	mutexUnlock(tty->rx_mutex);
 
+	if (wake_reader)
+		*wake_reader = wake;
+
 	return 0;
 }
 
@@ -309,7 +396,7 @@ int libttydisc_write_oproc(libtty_common_t *tty, char c)
 		log_error("%s: not a valid control char: 0x%02x", __func__, c);
 #endif
 
-#define PRINT_NORMAL() tx_write_ifspace(tty, &c, 1)
+#define PRINT_NORMAL() tx_push_ifspace(tty, &c, 1)
 	switch (c) {
 	case CEOF:
 		return PRINT_NORMAL();
@@ -317,7 +404,7 @@ int libttydisc_write_oproc(libtty_common_t *tty, char c)
 	case CTAB:
 		/* Tab expansion. */
 		if (CMP_FLAG(o, TAB3)) {
-			ret = tx_write_ifspace(tty, "        ", 8);
+			ret = tx_push_ifspace(tty, "        ", 8);
 		} else {
 			ret = PRINT_NORMAL();
 		}
@@ -327,7 +414,7 @@ int libttydisc_write_oproc(libtty_common_t *tty, char c)
 		/* Newline conversion. */
 		if (CMP_FLAG(o, ONLCR)) {
 			/* Convert \n to \r\n. */
-			ret = tx_write_ifspace(tty, "\r\n", 2);
+			ret = tx_push_ifspace(tty, "\r\n", 2);
 		} else {
 			ret = PRINT_NORMAL();
 		}
@@ -356,7 +443,8 @@ int libttydisc_write_oproc(libtty_common_t *tty, char c)
 ssize_t libttydisc_read_canonical(libtty_common_t *tty, char *data, size_t size, unsigned mode, libtty_read_state_t* st)
 {
 	char byte = 0xff;
-	size_t len = 0;
+	size_t len, cnt;
+	int eol = 0;
 
 	if (st)
 		st->timeout_ms = -1; // default (finished)
@@ -364,7 +452,7 @@ ssize_t libttydisc_read_canonical(libtty_common_t *tty, char *data, size_t size,
 	// check if we have break char in RX fifo
 	mutexLock(tty->rx_mutex);
 	do {
-		if (tty->t_flags & TF_HAVEBREAK)
+		if (libttydisc_rx_have_line(tty))
 			break;
 
 		if (tty->t_flags & TF_CLOSING) {
@@ -387,41 +475,127 @@ ssize_t libttydisc_read_canonical(libtty_common_t *tty, char *data, size_t size,
 		}
 	} while (1);
 
-	while (len < size) {
-		byte = (char) fifo_pop_back(tty->rx_fifo);
-		if (CMP_CC(VEOF, byte))
-			break; // EOF - dropping and exiting
+	// find the end of the first line (no further than the caller wants)
+	cnt = fifo_count(tty->rx_fifo);
+	if (cnt > size)
+		cnt = size;
+
+	for (len = 0; len < cnt && !eol; ++len) {
+		byte = (char) fifo_peek_back(tty->rx_fifo, len);
+		eol = libttydisc_is_breakchar(tty, byte);
+	}
 
-		*data++ = byte;
-		len += 1;
+	if (eol && CMP_CC(VEOF, byte))
+		len -= 1; // EOF - not returned to the caller
+
+	len = fifo_pop_back_many(tty->rx_fifo, (uint8_t *)data, len);
+
+	if (eol) { // whole line read out
+		if (CMP_CC(VEOF, byte))
+			fifo_pop_back(tty->rx_fifo);
 
-		if (libttydisc_is_breakchar(tty, byte))
-			break; // EOL - exiting after the byte was added
+		if (tty->rx_breaks > 0)
+			tty->rx_breaks -= 1;
 	}
 
-	if (libttydisc_is_breakchar(tty, byte)) { // loop ended due to breakchar
-		// check if we have another break char in the RX FIFO
-		tty->t_flags &= ~TF_HAVEBREAK;
-		if (CMP_FLAG(l, ICANON)) {
-			if (libttydisc_rx_have_breakchar(tty))
-				tty->t_flags |= TF_HAVEBREAK;
+	mutexUnlock(tty->rx_mutex);
+	return len;
+}
+
+/* blocking wait for RX data (timeout in us, 0 - no timeout),
+ * returns 0 if there is something to read, 1 if the timer expired after some data arrived */
+static int libttydisc_wait_raw(libtty_common_t *tty, size_t need, time_t timeout)
+{
+	time_t start, now, last, wait;
+	int ret = 0;
+
+	gettime(&start, NULL);
+
+	mutexLock(tty->rx_mutex);
+
+	/* coalesce wake-ups - the producer signals only when we'll have enough data */
+	if (tty->rx_waiters++ == 0 || need < tty->rx_wake_thr)
+		tty->rx_wake_thr = need;
+
+	while (fifo_is_empty(tty->rx_fifo) || (!ret && !libttydisc_rx_wake_needed(tty))) {
+		if (tty->t_flags & TF_CLOSING) {
+			ret = -EBADF;
+			break;
+		}
+
+		wait = 0;
+		if (timeout != 0) {
+			/* the timer restarts with every char received (wake-ups are coalesced, so check the RX stamp) */
+			gettime(&now, NULL);
+			last = (tty->rx_stamp > start) ? tty->rx_stamp : start;
+			if (now >= last + timeout) {
+				/* timer expired - return what we have if the line was idle */
+				if (fifo_is_empty(tty->rx_fifo)) {
+					ret = -ETIME;
+					break;
+				}
+				ret = 1;
+				continue;
+			}
+			wait = last + timeout - now;
 		}
+
+		condWait(tty->rx_waitq, tty->rx_mutex, wait);
 	}
 
+	if (--tty->rx_waiters == 0)
+		tty->rx_wake_thr = 1;
+
 	mutexUnlock(tty->rx_mutex);
-	return len;
+
+	return ret;
+}
+
+/* RX fifo may be swapped by libtty_resize() - raw reader accesses it only under the lock */
+static int libttydisc_rx_empty(libtty_common_t *tty)
+{
+	int ret;
+
+	mutexLock(tty->rx_mutex);
+	ret = fifo_is_empty(tty->rx_fifo);
+	mutexUnlock(tty->rx_mutex);
+
+	return ret;
+}
+
+static size_t libttydisc_rx_pop(libtty_common_t *tty, char *data, size_t size)
+{
+	size_t ret;
+
+	mutexLock(tty->rx_mutex);
+	ret = fifo_pop_back_many(tty->rx_fifo, (uint8_t *)data, size);
+	mutexUnlock(tty->rx_mutex);
+
+	return ret;
 }
 
 ssize_t libttydisc_read_raw(libtty_common_t *tty, char *data, size_t size, unsigned mode, libtty_read_state_t *st)
 {
 	size_t vmin = tty->term.c_cc[VMIN];
-	time_t vtime = (time_t)tty->term.c_cc[VTIME] * 100; // deciseconds to ms
-	time_t first_char_timeout = (vmin == 0) ? vtime : 0;
+	time_t vtime_us = (time_t)tty->term.c_cc[VTIME] * 100000; // deciseconds to us (blocking wait)
+	time_t vtime, first_char_timeout, first_char_timeout_us;
 	ssize_t len = 0;
+	int expired = 0;
+	size_t n, need, wake_min = (tty->rxwake.min != 0) ? tty->rxwake.min : vmin;
+
+	if (tty->rxwake.idle_us != 0)
+		vtime_us = tty->rxwake.idle_us;
+
+	vtime = (vtime_us + 999) / 1000; // rounded up to ms (non-blocking read state)
+	first_char_timeout = (vmin == 0) ? vtime : 0;
+	first_char_timeout_us = (vmin == 0) ? vtime_us : 0;
+
+	if (wake_min > size)
+		wake_min = size;
 
 	if (st && st->timeout_ms >= 0) { /* continuing previous read */
 		int we_wanted_to_sleep_ms = (st->prevlen == 0) ? first_char_timeout : vtime;
-		if (fifo_is_empty(tty->rx_fifo)) {
+		if (libttydisc_rx_empty(tty)) {
 			if (we_wanted_to_sleep_ms == 0) // blocking read without timeout
 				return 0;
 			else if (st->timeout_ms > 0) { // no new data, wait some more time
@@ -438,7 +612,10 @@ ssize_t libttydisc_read_raw(libtty_common_t *tty, char *data, size_t size, unsig
 	}
 
 	while (len < size) {
-		if (fifo_is_empty(tty->rx_fifo)) {
+		if ((n = libttydisc_rx_pop(tty, data, size - len)) > 0) {
+			data += n;
+			len += n;
+		} else {
 			if (mode & O_NONBLOCK) {
 				if (len == 0)
 					return -EWOULDBLOCK;
@@ -453,29 +630,22 @@ ssize_t libttydisc_read_raw(libtty_common_t *tty, char *data, size_t size, unsig
 						st->timeout_ms = (len == 0) ? first_char_timeout : vtime;
 						return 0;
 					} else { // blocking wait
-						mutexLock(tty->rx_mutex);
-						while (fifo_is_empty(tty->rx_fifo)) {
-							if (tty->t_flags & TF_CLOSING) {
-								mutexUnlock(tty->rx_mutex);
-								return len;
-							}
-
-							int ret = condWait(tty->rx_waitq, tty->rx_mutex, (len == 0) ? first_char_timeout : vtime);
-							if (ret == -ETIME) {
-								mutexUnlock(tty->rx_mutex);
-								return len; // timer expired
-							}
-						}
-						mutexUnlock(tty->rx_mutex);
+						if (expired)
+							break; // interchar timer expired - return what we have
+
+						/* interchar timer starts with the first char - coalesce wake-ups only once it runs */
+						need = (wake_min > len + 1) ? wake_min - len : 1;
+						if (len == 0 && first_char_timeout_us == 0 && vtime_us != 0)
+							need = 1;
+
+						if ((expired = libttydisc_wait_raw(tty, need, (len == 0) ? first_char_timeout_us : vtime_us)) < 0)
+							return len; // timer expired or closing
 					}
 				}
 				else
 					break; // at least vmin chars present
 			}
 		}
-
-		*data++ = fifo_pop_back(tty->rx_fifo);
-		len += 1;
 	}
 
 	return len;
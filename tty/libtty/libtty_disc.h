@@ -36,6 +36,7 @@
 #define LIBTTYDISC_WRITE_OPROC_MAXLEN 8
 
 /* internal interface - line discipline */
+/* NOTE: doesn't call signal_txready, it's up to the caller */
 int libttydisc_write_oproc(libtty_common_t *tty, char c);
 
 ssize_t libttydisc_read_canonical(libtty_common_t *tty, char *data, size_t size, unsigned mode, libtty_read_state_t *st);
@@ -51,17 +52,45 @@ static inline int libttydisc_is_breakchar(libtty_common_t *tty, char c)
 	return 0;
 }
 
-static inline int libttydisc_rx_have_breakchar(libtty_common_t *tty)
+/* input char has to go through the full line discipline (see termios_optimize) */
+static inline int libttydisc_is_special(libtty_common_t *tty, unsigned char c)
 {
-	char* breakc = tty->breakchars;
-	while (*breakc) {
-		if (fifo_has_char(tty->rx_fifo, *breakc))
-			return 1;
+	return (tty->rx_special[c >> 5] >> (c & 0x1f)) & 1;
+}
 
-		++breakc;
-	}
+static inline unsigned int libttydisc_rx_count_breakchars(libtty_common_t *tty)
+{
+	unsigned int i, cnt = 0, len = fifo_count(tty->rx_fifo);
 
-	return 0;
+	for (i = 0; i < len; ++i)
+		cnt += libttydisc_is_breakchar(tty, fifo_peek_back(tty->rx_fifo, i));
+
+	return cnt;
+}
+
+static inline void libttydisc_stats_fill(uint32_t *maxfill, fifo_t *f)
+{
+	unsigned int cnt = fifo_count(f);
+
+	if (cnt > *maxfill)
+		*maxfill = cnt;
+}
+
+/* raw mode: enough data for the blocked readers (or the fifo is filling up) */
+static inline int libttydisc_rx_wake_needed(libtty_common_t *tty)
+{
+	unsigned int cnt = fifo_count(tty->rx_fifo);
+
+	if (cnt >= tty->rx_wake_thr || fifo_is_full(tty->rx_fifo))
+		return 1;
+
+	return (tty->rxwake.highwater != 0) && (cnt >= tty->rxwake.highwater);
+}
+
+/* ICANON: full line is ready to be read out (a full FIFO is treated as a line too) */
+static inline int libttydisc_rx_have_line(libtty_common_t *tty)
+{
+	return (tty->rx_breaks > 0) || fifo_is_full(tty->rx_fifo);
 }
 
 
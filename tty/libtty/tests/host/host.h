@@ -0,0 +1,44 @@
+/*
+ * Phoenix-RTOS
+ *
+ * TTY abstraction layer - host build compatibility header
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _LIBTTY_HOST_H_
+#define _LIBTTY_HOST_H_
+
+/* libtty provides its own defaults */
+#define _SYS_TTYDEFAULTS_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <termios.h>
+
+#include <sys/threads.h>
+
+#ifndef EOK
+#define EOK 0
+#endif
+
+#ifndef _POSIX_VDISABLE
+#define _POSIX_VDISABLE 0
+#endif
+
+#ifndef VERASE2
+#define VERASE2 VEOL2
+#endif
+
+#ifndef TCDRAIN
+#define TCDRAIN 0x5409
+#endif
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * Phoenix-RTOS
+ *
+ * TTY abstraction layer - Phoenix-RTOS threads API on top of pthreads
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _LIBTTY_HOST_SYS_THREADS_H_
+#define _LIBTTY_HOST_SYS_THREADS_H_
+
+#include <stdint.h>
+#include <time.h>
+
+
+typedef uintptr_t handle_t;
+
+
+extern int mutexCreate(handle_t *h);
+
+
+extern int mutexLock(handle_t h);
+
+
+extern int mutexLock2(handle_t h1, handle_t h2);
+
+
+extern int mutexUnlock(handle_t h);
+
+
+extern int condCreate(handle_t *h);
+
+
+/* timeout in microseconds, 0 - wait indefinitely */
+extern int condWait(handle_t h, handle_t m, time_t timeout);
+
+
+extern int condSignal(handle_t h);
+
+
+extern int condBroadcast(handle_t h);
+
+
+extern int resourceDestroy(handle_t h);
+
+
+/* time in microseconds */
+extern int gettime(time_t *raw, time_t *offs);
+
+
+/* host only: number of times condWait() returned on the condition */
+extern unsigned long host_condWakeups(handle_t h);
+
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * Phoenix-RTOS
+ *
+ * TTY abstraction layer - Phoenix-RTOS threads API on top of pthreads
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/threads.h>
+
+
+enum { res_mutex, res_cond };
+
+
+typedef struct {
+	int type;
+	union {
+		pthread_mutex_t mutex;
+		struct {
+			pthread_cond_t cond;
+			unsigned long wakeups;
+		};
+	};
+} resource_t;
+
+
+static resource_t *resource_alloc(int type)
+{
+	resource_t *r;
+
+	if ((r = calloc(1, sizeof(*r))) != NULL)
+		r->type = type;
+
+	return r;
+}
+
+
+int mutexCreate(handle_t *h)
+{
+	resource_t *r;
+
+	if ((r = resource_alloc(res_mutex)) == NULL)
+		return -ENOMEM;
+
+	pthread_mutex_init(&r->mutex, NULL);
+	*h = (handle_t)r;
+
+	return EOK;
+}
+
+
+int mutexLock(handle_t h)
+{
+	return -pthread_mutex_lock(&((resource_t *)h)->mutex);
+}
+
+
+int mutexLock2(handle_t h1, handle_t h2)
+{
+	mutexLock(h1);
+	return mutexLock(h2);
+}
+
+
+int mutexUnlock(handle_t h)
+{
+	return -pthread_mutex_unlock(&((resource_t *)h)->mutex);
+}
+
+
+int condCreate(handle_t *h)
+{
+	resource_t *r;
+	pthread_condattr_t attr;
+
+	if ((r = resource_alloc(res_cond)) == NULL)
+		return -ENOMEM;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&r->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	*h = (handle_t)r;
+
+	return EOK;
+}
+
+
+int condWait(handle_t h, handle_t m, time_t timeout)
+{
+	resource_t *c = (resource_t *)h, *mx = (resource_t *)m;
+	struct timespec ts;
+	int err;
+
+	if (timeout == 0) {
+		err = pthread_cond_wait(&c->cond, &mx->mutex);
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ts.tv_sec += timeout / 1000000;
+		ts.tv_nsec += (timeout % 1000000) * 1000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec += 1;
+			ts.tv_nsec -= 1000000000;
+		}
+		err = pthread_cond_timedwait(&c->cond, &mx->mutex, &ts);
+	}
+
+	c->wakeups++;
+
+	return (err == ETIMEDOUT) ? -ETIME : -err;
+}
+
+
+int condSignal(handle_t h)
+{
+	return -pthread_cond_signal(&((resource_t *)h)->cond);
+}
+
+
+int condBroadcast(handle_t h)
+{
+	return -pthread_cond_broadcast(&((resource_t *)h)->cond);
+}
+
+
+int resourceDestroy(handle_t h)
+{
+	resource_t *r = (resource_t *)h;
+
+	if (r->type == res_mutex)
+		pthread_mutex_destroy(&r->mutex);
+	else
+		pthread_cond_destroy(&r->cond);
+
+	free(r);
+
+	return EOK;
+}
+
+
+int gettime(time_t *raw, time_t *offs)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	if (raw != NULL)
+		*raw = (time_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+	if (offs != NULL)
+		*offs = 0;
+
+	return EOK;
+}
+
+
+unsigned long host_condWakeups(handle_t h)
+{
+	return ((resource_t *)h)->wakeups;
+}
@@ -0,0 +1,588 @@
+/*
+ * Phoenix-RTOS
+ *
+ * TTY abstraction layer - host throughput/latency benchmark
+ *
+ * Producer thread stands in for the UART interrupt thread (libtty_putchars
+ * in HW FIFO sized bursts), consumer uses libtty_read/libtty_read_nonblock
+ * like the device servers do.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libtty.h"
+#include "fifo.h"
+
+
+#define LAT_SAMPLES (1 << 20)
+
+
+enum { mode_raw, mode_raw_nonblock, mode_canonical, mode_echo, mode_opost };
+
+
+static const char *mode_names[] = { "raw", "raw-nonblock", "canonical", "echo", "opost" };
+
+
+static struct {
+	libtty_common_t tty;
+	int mode;
+
+	size_t total;
+	size_t burst;
+	size_t linelen;
+	unsigned int bufsz;
+	unsigned int vmin;
+
+	uint8_t *pattern;
+	uint64_t *stamps;
+
+	uint64_t *lat;
+	size_t nlat;
+
+	/* TX drain (HW side of the TX ring) */
+	pthread_t tx_thr;
+	pthread_mutex_t tx_lock;
+	pthread_cond_t tx_cond;
+	int tx_pending;
+	int tx_done;
+	size_t tx_bytes;
+
+	/* notification of non-blocking reader (server side) */
+	pthread_mutex_t rx_lock;
+	pthread_cond_t rx_cond;
+	int rx_pending;
+	unsigned long rx_wakeups;
+} bench;
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void lat_add(uint64_t ns)
+{
+	bench.lat[bench.nlat++ % LAT_SAMPLES] = ns;
+}
+
+
+static int lat_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+
+static double lat_percentile(unsigned int p)
+{
+	size_t n = (bench.nlat < LAT_SAMPLES) ? bench.nlat : LAT_SAMPLES;
+
+	if (n == 0)
+		return 0.0;
+
+	return bench.lat[(n - 1) * p / 100] / 1000.0;
+}
+
+
+static void signal_txready(void *arg)
+{
+	pthread_mutex_lock(&bench.tx_lock);
+	bench.tx_pending = 1;
+	pthread_cond_signal(&bench.tx_cond);
+	pthread_mutex_unlock(&bench.tx_lock);
+}
+
+
+static void *tx_thr(void *arg)
+{
+	uint8_t buff[64];
+	size_t n;
+
+	for (;;) {
+		pthread_mutex_lock(&bench.tx_lock);
+		while (!bench.tx_pending && !bench.tx_done)
+			pthread_cond_wait(&bench.tx_cond, &bench.tx_lock);
+		bench.tx_pending = 0;
+		pthread_mutex_unlock(&bench.tx_lock);
+
+		while ((n = libtty_getchars(&bench.tty, buff, sizeof(buff), NULL)) > 0)
+			bench.tx_bytes += n;
+
+		if (bench.tx_done)
+			break;
+	}
+
+	return NULL;
+}
+
+
+static void *rx_producer_thr(void *arg)
+{
+	size_t off, n;
+	int wake;
+
+	for (off = 0; off < bench.total; off += n) {
+		n = bench.total - off;
+		if (n > bench.burst)
+			n = bench.burst;
+
+		/* HW flow control - don't overrun the RX ring */
+		while (fifo_freespace(bench.tty.rx_fifo) < n)
+			sched_yield();
+
+		bench.stamps[off / bench.burst] = now_ns();
+		libtty_putchars(&bench.tty, bench.pattern + off, n, &wake);
+
+		if (wake && bench.mode == mode_raw_nonblock) {
+			pthread_mutex_lock(&bench.rx_lock);
+			bench.rx_pending = 1;
+			pthread_cond_signal(&bench.rx_cond);
+			pthread_mutex_unlock(&bench.rx_lock);
+		}
+	}
+
+	return NULL;
+}
+
+
+/* waits for the producer like a server waits for the RX path notification */
+static void rx_wait_nonblock(libtty_read_state_t *st)
+{
+	struct timespec ts;
+	int err = 0;
+
+	pthread_mutex_lock(&bench.rx_lock);
+	if (st->timeout_ms > 0) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += st->timeout_ms / 1000;
+		ts.tv_nsec += (st->timeout_ms % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec += 1;
+			ts.tv_nsec -= 1000000000;
+		}
+	}
+
+	while (!bench.rx_pending && err == 0) {
+		if (st->timeout_ms > 0)
+			err = pthread_cond_timedwait(&bench.rx_cond, &bench.rx_lock, &ts);
+		else
+			err = pthread_cond_wait(&bench.rx_cond, &bench.rx_lock);
+	}
+
+	bench.rx_pending = 0;
+	bench.rx_wakeups++;
+	pthread_mutex_unlock(&bench.rx_lock);
+
+	if (err == ETIMEDOUT)
+		st->timeout_ms = 0;
+}
+
+
+static int run_rx(void)
+{
+	static char buff[4096];
+	libtty_read_state_t st;
+	pthread_t thr;
+	size_t recvd = 0;
+	ssize_t ret;
+	uint64_t now;
+
+	libtty_read_state_init(&st);
+	pthread_create(&thr, NULL, rx_producer_thr, NULL);
+
+	while (recvd < bench.total) {
+		if (bench.mode == mode_raw_nonblock) {
+			ret = libtty_read_nonblock(&bench.tty, buff, sizeof(buff), 0, &st);
+			if (ret == 0 && st.timeout_ms >= 0) {
+				rx_wait_nonblock(&st);
+				continue;
+			}
+		} else {
+			ret = libtty_read(&bench.tty, buff, sizeof(buff), 0);
+		}
+
+		if (ret < 0) {
+			fprintf(stderr, "ttybench: read failed (%zd)\n", ret);
+			return -1;
+		}
+
+		if (ret == 0)
+			continue;
+
+		if (memcmp(buff, bench.pattern + recvd, ret) != 0) {
+			fprintf(stderr, "ttybench: data mismatch at offset %zu\n", recvd);
+			return -1;
+		}
+
+		recvd += ret;
+		now = now_ns();
+		lat_add(now - bench.stamps[(recvd - 1) / bench.burst]);
+	}
+
+	pthread_join(thr, NULL);
+
+	return 0;
+}
+
+
+static int run_tx(void)
+{
+	size_t off, n;
+	ssize_t ret;
+	uint64_t start;
+
+	for (off = 0; off < bench.total; off += ret) {
+		n = bench.total - off;
+		if (n > 4096)
+			n = 4096;
+
+		start = now_ns();
+		if ((ret = libtty_write(&bench.tty, (const char *)bench.pattern + off, n, 0)) <= 0) {
+			fprintf(stderr, "ttybench: write failed (%zd)\n", ret);
+			return -1;
+		}
+		lat_add(now_ns() - start);
+	}
+
+	return 0;
+}
+
+
+static void pattern_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < bench.total; ++i) {
+		if (bench.mode == mode_raw || bench.mode == mode_raw_nonblock)
+			bench.pattern[i] = (uint8_t)(i * 7);
+		else if ((i % bench.linelen) == bench.linelen - 1)
+			bench.pattern[i] = '\n';
+		else
+			bench.pattern[i] = 'a' + (i % 26);
+	}
+}
+
+
+static int bench_run(int mode)
+{
+	libtty_callbacks_t callbacks = { .arg = NULL, .signal_txready = signal_txready };
+	struct termios t;
+	const void *out;
+	uint64_t start, elapsed;
+	unsigned long wakeups;
+	int err;
+
+	bench.mode = mode;
+	bench.nlat = 0;
+	bench.tx_bytes = 0;
+	bench.tx_done = 0;
+	bench.tx_pending = 0;
+	bench.rx_pending = 0;
+	bench.rx_wakeups = 0;
+
+	if (libtty_init(&bench.tty, &callbacks, bench.bufsz) < 0)
+		return -1;
+
+	t = bench.tty.term;
+	if (mode == mode_raw || mode == mode_raw_nonblock) {
+		t.c_iflag &= ~(IGNBRK | BRKINT | INLCR | IGNCR | ICRNL | ISTRIP);
+		t.c_oflag &= ~OPOST;
+		t.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+		t.c_cc[VMIN] = bench.vmin;
+		t.c_cc[VTIME] = 1;
+	} else if (mode == mode_canonical) {
+		t.c_lflag &= ~(ECHO | ECHONL);
+	} else if (mode == mode_opost) {
+		t.c_lflag &= ~(ECHO | ECHONL);
+		t.c_oflag |= OPOST | ONLCR;
+	}
+	libtty_ioctl(&bench.tty, 0, TCSETS, &t, &out);
+
+	pattern_init();
+	pthread_create(&bench.tx_thr, NULL, tx_thr, NULL);
+
+	start = now_ns();
+	err = (mode == mode_opost) ? run_tx() : run_rx();
+
+	/* wait for the TX path to drain */
+	while (libtty_txready(&bench.tty))
+		signal_txready(NULL);
+	elapsed = now_ns() - start;
+
+	pthread_mutex_lock(&bench.tx_lock);
+	bench.tx_done = 1;
+	pthread_cond_signal(&bench.tx_cond);
+	pthread_mutex_unlock(&bench.tx_lock);
+	pthread_join(bench.tx_thr, NULL);
+
+	if (mode == mode_opost)
+		wakeups = host_condWakeups(bench.tty.tx_waitq);
+	else if (mode == mode_raw_nonblock)
+		wakeups = bench.rx_wakeups;
+	else
+		wakeups = host_condWakeups(bench.tty.rx_waitq);
+
+	libtty_destroy(&bench.tty);
+
+	if (err < 0)
+		return err;
+
+	qsort(bench.lat, (bench.nlat < LAT_SAMPLES) ? bench.nlat : LAT_SAMPLES, sizeof(bench.lat[0]), lat_cmp);
+
+	printf("%-14s %10.2f %10.1f %10.1f %12.3f\n", mode_names[mode],
+		(bench.total / 1e6) / (elapsed / 1e9), lat_percentile(50), lat_percentile(99),
+		wakeups / (bench.total / 1024.0));
+
+	return 0;
+}
+
+
+/* checks that raw read with VMIN=0 and no input waits for VTIME (or the RX wake-up idle time) */
+static int check_timeout(unsigned int vtime, unsigned int idle_us, uint64_t expect_us)
+{
+	libtty_callbacks_t callbacks = { .arg = NULL, .signal_txready = signal_txready };
+	libtty_rxwake_t rxwake = { 0 };
+	struct termios t;
+	const void *out;
+	uint64_t start, elapsed;
+	ssize_t ret;
+	char c;
+
+	if (libtty_init(&bench.tty, &callbacks, bench.bufsz) < 0)
+		return -1;
+
+	t = bench.tty.term;
+	t.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+	t.c_cc[VMIN] = 0;
+	t.c_cc[VTIME] = vtime;
+	libtty_ioctl(&bench.tty, 0, TCSETS, &t, &out);
+
+	rxwake.idle_us = idle_us;
+	libtty_ioctl(&bench.tty, 0, LIBTTY_IOCSRXWAKE, &rxwake, &out);
+
+	start = now_ns();
+	ret = libtty_read(&bench.tty, &c, 1, 0);
+	elapsed = (now_ns() - start) / 1000;
+
+	libtty_destroy(&bench.tty);
+
+	printf("read timeout VTIME=%u idle=%uus: %llu us (expected %llu us) %s\n", vtime, idle_us,
+		(unsigned long long)elapsed, (unsigned long long)expect_us,
+		(ret == 0 && elapsed >= expect_us && elapsed < expect_us + 500000) ? "ok" : "FAIL");
+
+	return (ret == 0 && elapsed >= expect_us && elapsed < expect_us + 500000) ? 0 : -1;
+}
+
+
+static void *interchar_thr(void *arg)
+{
+	int i, wake;
+
+	/* chars come slower than the reader's wake-up threshold, but faster than VTIME */
+	usleep(50000);
+	for (i = 0; i < 5; ++i) {
+		if (i > 0)
+			usleep(80000);
+		libtty_putchars(&bench.tty, (const unsigned char *)"01234" + i, 1, &wake);
+	}
+
+	return NULL;
+}
+
+
+/* checks that raw read with VMIN > 0 and VTIME > 0 returns less than VMIN chars once the interchar timer expires
+ * (the timer restarts with every char) */
+static int check_interchar(void)
+{
+	libtty_callbacks_t callbacks = { .arg = NULL, .signal_txready = signal_txready };
+	struct termios t;
+	const void *out;
+	pthread_t thr;
+	uint64_t start, elapsed;
+	ssize_t ret;
+	char buff[64];
+
+	if (libtty_init(&bench.tty, &callbacks, bench.bufsz) < 0)
+		return -1;
+
+	t = bench.tty.term;
+	t.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+	t.c_cc[VMIN] = sizeof(buff);
+	t.c_cc[VTIME] = 1;
+	libtty_ioctl(&bench.tty, 0, TCSETS, &t, &out);
+
+	pthread_create(&thr, NULL, interchar_thr, NULL);
+
+	start = now_ns();
+	ret = libtty_read(&bench.tty, buff, sizeof(buff), 0);
+	elapsed = (now_ns() - start) / 1000;
+
+	pthread_join(thr, NULL);
+	libtty_destroy(&bench.tty);
+
+	printf("read interchar timeout VMIN=%zu VTIME=1: %zd B in %llu us (expected 5 B in 470000 us) %s\n", sizeof(buff), ret,
+		(unsigned long long)elapsed, (ret == 5 && elapsed >= 470000 && elapsed < 540000) ? "ok" : "FAIL");
+
+	return (ret == 5 && elapsed >= 470000 && elapsed < 540000) ? 0 : -1;
+}
+
+
+static void *fullline_thr(void *arg)
+{
+	unsigned char line[LIBTTY_BUFSZ_MIN - 1];
+	int wake;
+
+	memset(line, 'a', sizeof(line));
+	usleep(50000);
+	libtty_putchars(&bench.tty, line, sizeof(line), &wake);
+
+	/* don't let a missed wake-up hang the check */
+	usleep(1000000);
+	libtty_close(&bench.tty);
+
+	return NULL;
+}
+
+
+/* checks that canonical read returns when the RX fifo fills up without a line end */
+static int check_fullline(void)
+{
+	libtty_callbacks_t callbacks = { .arg = NULL, .signal_txready = signal_txready };
+	struct termios t;
+	const void *out;
+	pthread_t thr;
+	uint64_t start, elapsed;
+	ssize_t ret;
+	char buff[LIBTTY_BUFSZ_MIN];
+
+	if (libtty_init(&bench.tty, &callbacks, LIBTTY_BUFSZ_MIN) < 0)
+		return -1;
+
+	t = bench.tty.term;
+	t.c_lflag &= ~(ECHO | ECHONL);
+	libtty_ioctl(&bench.tty, 0, TCSETS, &t, &out);
+
+	pthread_create(&thr, NULL, fullline_thr, NULL);
+
+	start = now_ns();
+	ret = libtty_read(&bench.tty, buff, sizeof(buff), 0);
+	elapsed = (now_ns() - start) / 1000;
+
+	pthread_join(thr, NULL);
+	libtty_destroy(&bench.tty);
+
+	printf("read canonical full fifo: %zd B in %llu us (expected %d B in 50000 us) %s\n", ret,
+		(unsigned long long)elapsed, LIBTTY_BUFSZ_MIN - 1,
+		(ret == LIBTTY_BUFSZ_MIN - 1 && elapsed < 550000) ? "ok" : "FAIL");
+
+	return (ret == LIBTTY_BUFSZ_MIN - 1 && elapsed < 550000) ? 0 : -1;
+}
+
+
+static void usage(const char *progname)
+{
+	printf("Usage: %s [-s total_bytes] [-b burst] [-n bufsz] [-m vmin] [-l line_length] [mode...]\n", progname);
+	printf("\tmodes: raw, raw-nonblock, canonical, echo, opost (default: all)\n");
+	printf("\tlatency is measured per read (RX modes) or per write call (opost)\n");
+}
+
+
+int main(int argc, char **argv)
+{
+	int c, i, mode, err = 0, selected[sizeof(mode_names) / sizeof(mode_names[0])] = { 0 }, any = 0;
+
+	bench.total = 16 << 20;
+	bench.burst = 32;
+	bench.bufsz = 4096;
+	bench.vmin = 64;
+	bench.linelen = 64;
+
+	while ((c = getopt(argc, argv, "s:b:n:m:l:h")) != -1) {
+		switch (c) {
+		case 's': bench.total = strtoul(optarg, NULL, 0); break;
+		case 'b': bench.burst = strtoul(optarg, NULL, 0); break;
+		case 'n': bench.bufsz = strtoul(optarg, NULL, 0); break;
+		case 'm': bench.vmin = strtoul(optarg, NULL, 0); break;
+		case 'l': bench.linelen = strtoul(optarg, NULL, 0); break;
+		default:
+			usage(argv[0]);
+			return (c == 'h') ? 0 : 1;
+		}
+	}
+
+	if (bench.burst == 0 || bench.burst >= bench.bufsz || bench.linelen < 2 || bench.linelen >= bench.bufsz ||
+			bench.vmin > 255 || (bench.bufsz & (bench.bufsz - 1)) != 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (i = optind; i < argc; ++i) {
+		for (mode = 0; mode < sizeof(mode_names) / sizeof(mode_names[0]); ++mode) {
+			if (strcmp(argv[i], mode_names[mode]) == 0)
+				break;
+		}
+
+		if (mode == sizeof(mode_names) / sizeof(mode_names[0])) {
+			usage(argv[0]);
+			return 1;
+		}
+
+		selected[mode] = any = 1;
+	}
+
+	bench.pattern = malloc(bench.total);
+	bench.stamps = malloc((bench.total / bench.burst + 1) * sizeof(bench.stamps[0]));
+	bench.lat = malloc(LAT_SAMPLES * sizeof(bench.lat[0]));
+	if (bench.pattern == NULL || bench.stamps == NULL || bench.lat == NULL) {
+		fprintf(stderr, "ttybench: out of memory\n");
+		return 1;
+	}
+
+	pthread_mutex_init(&bench.tx_lock, NULL);
+	pthread_cond_init(&bench.tx_cond, NULL);
+	pthread_mutex_init(&bench.rx_lock, NULL);
+	pthread_cond_init(&bench.rx_cond, NULL);
+
+	if (check_timeout(2, 0, 200000) < 0 || check_timeout(0, 50000, 50000) < 0 || check_interchar() < 0 || check_fullline() < 0)
+		err = 1;
+
+	printf("total %zu B, burst %zu B, buffer %u B, VMIN %u, line %zu B\n",
+		bench.total, bench.burst, bench.bufsz, bench.vmin, bench.linelen);
+	printf("%-14s %10s %10s %10s %12s\n", "mode", "MB/s", "p50[us]", "p99[us]", "wakeups/KB");
+
+	for (mode = 0; mode < sizeof(mode_names) / sizeof(mode_names[0]); ++mode) {
+		if (any && !selected[mode])
+			continue;
+
+		if (bench_run(mode) < 0) {
+			printf("%-14s FAILED\n", mode_names[mode]);
+			err = 1;
+		}
+	}
+
+	free(bench.pattern);
+	free(bench.stamps);
+	free(bench.lat);
+
+	return err;
+}
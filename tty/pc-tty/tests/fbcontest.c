@@ -0,0 +1,190 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Framebuffer text console renderer - host test and benchmark
+ *
+ * Renders cell grids into an in-memory framebuffer and compares every pixel
+ * against a straightforward reference renderer.
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ttypc_fbcon.h"
+
+
+#define WIDTH  1024
+#define HEIGHT 768
+#define PITCH  1040
+#define FONTH  16
+
+
+static const uint32_t palette[] = {
+	0x000000, 0x0000aa, 0x00aa00, 0x00aaaa, 0xaa0000, 0xaa00aa, 0xaa5500, 0xaaaaaa,
+	0x555555, 0x5555ff, 0x55ff55, 0x55ffff, 0xff5555, 0xff55ff, 0xffff55, 0xffffff
+};
+
+
+static struct {
+	uint8_t font[256 * FBCON_GLYPHSZ];
+	uint32_t fb[PITCH * HEIGHT];
+	uint16_t *cells;
+	unsigned int cols;
+	unsigned int rows;
+	unsigned int errors;
+} test_common;
+
+
+/* Compares framebuffer with reference rendering of cells */
+static void test_verify(const char *name, const uint16_t *cells, unsigned int cpos, int cst)
+{
+	unsigned int pos, x, y, errors = 0;
+	uint32_t fg, bg, exp;
+	uint8_t bits;
+
+	for (pos = 0; pos < test_common.cols * test_common.rows; pos++) {
+		fg = palette[(cells[pos] >> 8) & 0x0f];
+		bg = palette[(cells[pos] >> 12) & 0x07];
+
+		for (y = 0; y < FONTH; y++) {
+			bits = test_common.font[(cells[pos] & 0xff) * FBCON_GLYPHSZ + y];
+			if (cst && (pos == cpos) && (y >= FONTH - 2))
+				bits = 0xff;
+
+			for (x = 0; x < FBCON_GLYPHW; x++) {
+				exp = (bits & (0x80 >> x)) ? fg : bg;
+				if (test_common.fb[((pos / test_common.cols) * FONTH + y) * PITCH + (pos % test_common.cols) * FBCON_GLYPHW + x] != exp)
+					errors++;
+			}
+		}
+	}
+
+	printf("%-24s %s\n", name, errors ? "FAIL" : "ok");
+	test_common.errors += !!errors;
+}
+
+
+/* Emulates terminal roll up of rows top + n .. bottom */
+static void test_rollup(uint16_t *cells, unsigned int top, unsigned int bottom, unsigned int n, uint16_t blank)
+{
+	unsigned int i;
+
+	memmove(cells + top * test_common.cols, cells + (top + n) * test_common.cols, (bottom + 1 - top - n) * test_common.cols * sizeof(*cells));
+	for (i = (bottom + 1 - n) * test_common.cols; i < (bottom + 1) * test_common.cols; i++)
+		cells[i] = blank;
+}
+
+
+static double test_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int main(void)
+{
+	ttypc_fbcon_t fbcon;
+	unsigned int i, j, ncells, lines;
+	uint16_t *cells;
+	double t;
+
+	srand(1);
+	for (i = 0; i < 256; i++) {
+		for (j = 0; j < FBCON_GLYPHSZ; j++)
+			test_common.font[i * FBCON_GLYPHSZ + j] = (i == 0) ? 0 : rand();
+	}
+
+	if (ttypc_fbcon_init(&fbcon, test_common.fb, WIDTH, HEIGHT, PITCH, test_common.font, FONTH) < 0) {
+		fprintf(stderr, "fbcontest: init failed\n");
+		return 1;
+	}
+
+	test_common.cols = fbcon.cols;
+	test_common.rows = fbcon.rows;
+	ncells = fbcon.cols * fbcon.rows;
+	printf("fbcontest: %ux%u framebuffer, %ux%u cells\n", WIDTH, HEIGHT, fbcon.cols, fbcon.rows);
+
+	if ((cells = calloc(ncells, sizeof(*cells))) == NULL)
+		return 1;
+
+	test_verify("init", cells, 0, 0);
+
+	/* Full screen of random cells (more color pairs than the cache holds) */
+	for (i = 0; i < ncells; i++)
+		cells[i] = rand() & 0x7fff;
+	ttypc_fbcon_draw(&fbcon, cells);
+	test_verify("full redraw", cells, 0, 0);
+
+	/* Sparse updates */
+	for (i = 0; i < 200; i++)
+		cells[rand() % ncells] = rand() & 0x7fff;
+	ttypc_fbcon_draw(&fbcon, cells);
+	test_verify("dirty spans", cells, 0, 0);
+
+	/* Cursor show, move and hide */
+	ttypc_fbcon_cursor(&fbcon, 5 * fbcon.cols + 7, 1);
+	test_verify("cursor show", cells, 5 * fbcon.cols + 7, 1);
+	ttypc_fbcon_cursor(&fbcon, ncells - 1, 1);
+	test_verify("cursor move", cells, ncells - 1, 1);
+	cells[ncells - 1] = 0x1f41;
+	ttypc_fbcon_draw(&fbcon, cells);
+	test_verify("cursor cell redraw", cells, ncells - 1, 1);
+
+	/* Scroll whole screen and a region */
+	test_rollup(cells, 0, fbcon.rows - 1, 1, 0x0720);
+	ttypc_fbcon_scroll(&fbcon, 0, fbcon.rows - 1, 1);
+	ttypc_fbcon_draw(&fbcon, cells);
+	test_verify("scroll screen", cells, ncells - 1, 1);
+
+	test_rollup(cells, 3, 20, 4, 0x1720);
+	ttypc_fbcon_scroll(&fbcon, 3, 20, 4);
+	cells[4 * fbcon.cols] = 0x2f42;
+	ttypc_fbcon_draw(&fbcon, cells);
+	test_verify("scroll region", cells, ncells - 1, 1);
+
+	ttypc_fbcon_cursor(&fbcon, 0, 0);
+	test_verify("cursor hide", cells, 0, 0);
+
+	/* Benchmark - log output, one new line per scroll */
+	lines = 20000;
+	t = test_time();
+	for (i = 0; i < lines; i++) {
+		test_rollup(cells, 0, fbcon.rows - 1, 1, 0x0720);
+		ttypc_fbcon_scroll(&fbcon, 0, fbcon.rows - 1, 1);
+		for (j = 0; j < fbcon.cols; j++)
+			cells[ncells - fbcon.cols + j] = 0x0700 | (0x20 + (i + j) % 95);
+		ttypc_fbcon_draw(&fbcon, cells);
+	}
+	t = test_time() - t;
+	printf("scrolling output: %.0f lines/s\n", lines / t);
+	test_verify("after benchmark", cells, 0, 0);
+
+	/* Benchmark - full redraw */
+	lines = 2000;
+	t = test_time();
+	for (i = 0; i < lines; i++) {
+		for (j = 0; j < ncells; j++)
+			cells[j] = ((i & 7) << 12) | 0x0f00 | (0x20 + (i + j) % 95);
+		ttypc_fbcon_draw(&fbcon, cells);
+	}
+	t = test_time() - t;
+	printf("full redraw: %.0f frames/s, %.1f Mcells/s\n", lines / t, lines * ncells / t / 1e6);
+
+	ttypc_fbcon_destroy(&fbcon);
+	free(cells);
+
+	return test_common.errors ? 1 : 0;
+}
@@ -28,6 +28,7 @@
 
 #include "ttypc.h"
 #include "ttypc_bioskbd.h"
+#include "ttypc_fb.h"
 #include "ttypc_kbd.h"
 #include "ttypc_vga.h"
 
@@ -35,6 +36,14 @@
 ttypc_t ttypc_common;
 
 
+static void ttypc_usage(const char *progname)
+{
+	printf("Usage: %s [options]\n", progname);
+	printf("\t-f <width>x<height>  - use linear framebuffer console (Bochs/QEMU VGA) instead of VGA text mode\n");
+	printf("\t-h                   - print this help message\n");
+}
+
+
 static void ttypc_poolthr(void *arg)
 {
 	ttypc_t* ttypc = (ttypc_t *)arg;
@@ -95,12 +104,28 @@ static void ttypc_poolthr(void *arg)
 }
 
 
-int main(void)
+int main(int argc, char *argv[])
 {
-	unsigned int i;
+	unsigned int i, width = 0, height = 0;
 	char path[12];
 	oid_t oid;
-	int err;
+	int c, err;
+
+	while ((c = getopt(argc, argv, "f:h")) != -1) {
+		switch (c) {
+		case 'f':
+			if ((sscanf(optarg, "%ux%u", &width, &height) != 2) || !width || !height) {
+				ttypc_usage(argv[0]);
+				return -EINVAL;
+			}
+			break;
+
+		case 'h':
+		default:
+			ttypc_usage(argv[0]);
+			return EOK;
+		}
+	}
 
 	/* Initialize driver */
 	memset(&ttypc_common, 0, sizeof(ttypc_t));
@@ -111,24 +136,35 @@ int main(void)
 	if ((err = mutexCreate(&ttypc_common.lock)) < 0)
 		return err;
 
+	/* Initialize VGA display */
+	if ((err = ttypc_vga_init(&ttypc_common)) < 0)
+		return err;
+
+	/* Initialize framebuffer display (sets screen size) */
+	if (width && ((err = ttypc_fb_init(&ttypc_common, width, height)) < 0))
+		fprintf(stderr, "pc-tty: failed to initialize %ux%u framebuffer (%d), using VGA text mode\n", width, height, err);
+
 	/* Initialize VTs */
 	for (i = 0; i < NVTS; i++) {
 		if ((err = ttypc_vt_init(&ttypc_common, _PAGE_SIZE, ttypc_common.vts + i)) < 0)
 			return err;
 	}
 
-	/* Initialize VGA display */
-	if ((err = ttypc_vga_init(&ttypc_common)) < 0)
-		return err;
-
 	/* Set active virtual terminal */
 	ttypc_common.vt = ttypc_common.vts;
-	ttypc_common.vt->vram = ttypc_common.vga;
 
-	/* Initialize cursor */
-	_ttypc_vga_getcursor(ttypc_common.vt);
-	/* Set default cursor color */
-	_ttypc_vga_set(ttypc_common.vt->vram + ttypc_common.vt->cpos, FG_LIGHTGREY << 8, ttypc_common.vt->rows * ttypc_common.vt->cols - ttypc_common.vt->cpos);
+	if (!ttypc_common.fb) {
+		/* Initialize cursor */
+		_ttypc_vga_getcursor(ttypc_common.vt);
+		/* Take over current screen contents (the only VGA memory read) */
+		_ttypc_vga_read(ttypc_common.vga, ttypc_common.vt->mem, ttypc_common.vt->rows * ttypc_common.vt->cols);
+		_ttypc_vga_read(ttypc_common.vga, ttypc_common.vgacache, ttypc_common.vt->rows * ttypc_common.vt->cols);
+		/* Set default cursor color */
+		_ttypc_vga_set(ttypc_common.vt->vram + ttypc_common.vt->cpos, FG_LIGHTGREY << 8, ttypc_common.vt->rows * ttypc_common.vt->cols - ttypc_common.vt->cpos);
+		_ttypc_vga_dirty(ttypc_common.vt, 0, ttypc_common.vt->rows * ttypc_common.vt->cols);
+	}
+	_ttypc_vga_flush(ttypc_common.vt);
+	_ttypc_vga_togglecursor(ttypc_common.vt, ttypc_common.vt->cst);
 
 	/* Run pool threads */
 	if ((err = beginthread(ttypc_poolthr, 1, ttypc_common.pstack, sizeof(ttypc_common.pstack), &ttypc_common)) < 0)
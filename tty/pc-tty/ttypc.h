@@ -17,6 +17,7 @@
 
 #include <sys/types.h>
 
+#include "ttypc_fbcon.h"
 #include "ttypc_vt.h"
 
 
@@ -53,9 +54,21 @@ struct _ttypc_t {
 
 	/* VGA */
 	volatile void *vga;    /* VGA screen memory */
+	uint16_t *vgacache;    /* Copy of VGA screen memory contents */
 	void *crtc;            /* Video Display Controller (CRTC) */
 	unsigned color;        /* Color support */
 
+	/* Framebuffer */
+	unsigned fb;           /* Framebuffer display in use */
+	volatile void *fbmem;  /* Framebuffer memory */
+	size_t fbsz;           /* Framebuffer memory size */
+	uint8_t *font;         /* Font data (read from VGA plane 2) */
+	ttypc_fbcon_t fbcon;   /* Framebuffer console renderer */
+
+	/* Screen */
+	uint8_t rows;          /* Screen height - number of rows */
+	uint8_t cols;          /* Screen width - number of columns */
+
 	/* KBD */
 	volatile void *kbd;    /* Keyboard controller */
 	unsigned char ktype;   /* Keyboard type */
@@ -0,0 +1,194 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Linear framebuffer display (Bochs/QEMU VBE)
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include <sys/io.h>
+#include <sys/minmax.h>
+#include <sys/mman.h>
+
+#include "ttypc.h"
+#include "ttypc_fb.h"
+#include "ttypc_fbcon.h"
+#include "ttypc_vga.h"
+
+
+/* Reads VBE registers */
+static uint16_t _ttypc_fb_readreg(uint16_t reg)
+{
+	outw((void *)VBE_DISPI_INDEX, reg);
+
+	return inw((void *)VBE_DISPI_DATA);
+}
+
+
+/* Writes to VBE registers */
+static void _ttypc_fb_writereg(uint16_t reg, uint16_t val)
+{
+	outw((void *)VBE_DISPI_INDEX, reg);
+	outw((void *)VBE_DISPI_DATA, val);
+}
+
+
+/* Reads PCI configuration space register (bus 0, function 0) */
+static uint32_t _ttypc_fb_pciread(unsigned int dev, uint8_t reg)
+{
+	outl((void *)PCI_CFGADDR, 0x80000000 | (dev << 11) | (reg & 0xfc));
+
+	return inl((void *)PCI_CFGDATA);
+}
+
+
+/* Returns physical address of Bochs/QEMU VGA framebuffer (PCI BAR0) */
+static uint32_t _ttypc_fb_find(void)
+{
+	unsigned int dev;
+
+	for (dev = 0; dev < 32; dev++) {
+		if (_ttypc_fb_pciread(dev, 0x00) == ((VBE_PCI_DEVICE << 16) | VBE_PCI_VENDOR))
+			return _ttypc_fb_pciread(dev, 0x10) & ~0xf;
+	}
+
+	return 0;
+}
+
+
+/* Reads VGA text mode font from plane 2 (has to be done before leaving text mode) */
+static int _ttypc_fb_readfont(ttypc_t *ttypc)
+{
+	static const struct {
+		uint16_t port;
+		uint8_t reg;
+		uint8_t val;
+	} regs[] = {
+		{ SEQ_ADDR, SEQ_MAPMASK, 0x04 }, /* Write plane 2 */
+		{ SEQ_ADDR, SEQ_MEMMODE, 0x07 }, /* Sequential addressing */
+		{ GC_ADDR,  GC_READMAP,  0x02 }, /* Read plane 2 */
+		{ GC_ADDR,  GC_MODE,     0x00 }, /* Disable odd/even addressing */
+		{ GC_ADDR,  GC_MISC,     0x04 }  /* Map plane at 0xa0000 */
+	};
+	uint8_t saved[sizeof(regs) / sizeof(regs[0])];
+	volatile uint8_t *plane;
+	unsigned int i;
+
+	if ((ttypc->font = malloc(256 * FBCON_GLYPHSZ)) == NULL)
+		return -ENOMEM;
+
+	if ((plane = mmap(NULL, 2 * _PAGE_SIZE, PROT_READ | PROT_WRITE, 0, OID_PHYSMEM, VGA_GRAPHICS)) == MAP_FAILED) {
+		free(ttypc->font);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < sizeof(regs) / sizeof(regs[0]); i++) {
+		outb((void *)(uintptr_t)regs[i].port, regs[i].reg);
+		saved[i] = inb((void *)(uintptr_t)(regs[i].port + 1));
+		outb((void *)(uintptr_t)(regs[i].port + 1), regs[i].val);
+	}
+
+	for (i = 0; i < 256 * FBCON_GLYPHSZ; i++)
+		ttypc->font[i] = plane[i];
+
+	for (i = sizeof(regs) / sizeof(regs[0]); i--;) {
+		outb((void *)(uintptr_t)regs[i].port, regs[i].reg);
+		outb((void *)(uintptr_t)(regs[i].port + 1), saved[i]);
+	}
+
+	munmap((void *)plane, 2 * _PAGE_SIZE);
+
+	return EOK;
+}
+
+
+void _ttypc_fb_flush(ttypc_vt_t *vt)
+{
+	ttypc_fbcon_draw(&vt->ttypc->fbcon, vt->mem);
+}
+
+
+void _ttypc_fb_rollup(ttypc_vt_t *vt, unsigned int n)
+{
+	ttypc_fbcon_scroll(&vt->ttypc->fbcon, vt->top, vt->bottom, n);
+}
+
+
+void _ttypc_fb_setcursor(ttypc_vt_t *vt, uint8_t state)
+{
+	ttypc_fbcon_cursor(&vt->ttypc->fbcon, vt->cpos, state);
+}
+
+
+void ttypc_fb_destroy(ttypc_t *ttypc)
+{
+	ttypc_fbcon_destroy(&ttypc->fbcon);
+	munmap((void *)ttypc->fbmem, ttypc->fbsz);
+	free(ttypc->font);
+	_ttypc_fb_writereg(VBE_DISPI_ENABLE, 0);
+	ttypc->fb = 0;
+}
+
+
+int ttypc_fb_init(ttypc_t *ttypc, unsigned int width, unsigned int height)
+{
+	unsigned int fonth, pitch;
+	uint16_t id;
+	uint32_t pa;
+	int err;
+
+	id = _ttypc_fb_readreg(VBE_DISPI_ID);
+	if ((id < VBE_DISPI_ID0) || (id > VBE_DISPI_ID5) || !(pa = _ttypc_fb_find()))
+		return -ENODEV;
+
+	/* Get font height */
+	outb(ttypc->crtc, CRTC_MAXROW);
+	fonth = (inb(ttypc->crtc + 1) & 0x1f) + 1;
+
+	if ((err = _ttypc_fb_readfont(ttypc)) < 0)
+		return err;
+
+	/* Set graphics mode */
+	_ttypc_fb_writereg(VBE_DISPI_ENABLE, 0);
+	_ttypc_fb_writereg(VBE_DISPI_XRES, width);
+	_ttypc_fb_writereg(VBE_DISPI_YRES, height);
+	_ttypc_fb_writereg(VBE_DISPI_BPP, 32);
+	_ttypc_fb_writereg(VBE_DISPI_ENABLE, VBE_DISPI_ENABLED | VBE_DISPI_LFB);
+
+	if ((_ttypc_fb_readreg(VBE_DISPI_XRES) != width) || (_ttypc_fb_readreg(VBE_DISPI_YRES) != height) || (_ttypc_fb_readreg(VBE_DISPI_BPP) != 32)) {
+		_ttypc_fb_writereg(VBE_DISPI_ENABLE, 0);
+		free(ttypc->font);
+		return -EINVAL;
+	}
+	pitch = _ttypc_fb_readreg(VBE_DISPI_VWIDTH);
+
+	/* Map framebuffer */
+	ttypc->fbsz = (pitch * height * sizeof(uint32_t) + _PAGE_SIZE - 1) & ~(_PAGE_SIZE - 1);
+	if ((ttypc->fbmem = mmap(NULL, ttypc->fbsz, PROT_READ | PROT_WRITE, 0, OID_PHYSMEM, pa)) == MAP_FAILED) {
+		_ttypc_fb_writereg(VBE_DISPI_ENABLE, 0);
+		free(ttypc->font);
+		return -ENOMEM;
+	}
+
+	/* VT screen size is limited to 255 rows and columns */
+	if ((err = ttypc_fbcon_init(&ttypc->fbcon, (uint32_t *)ttypc->fbmem, min(width, 255 * FBCON_GLYPHW), min(height, 255 * fonth), pitch, ttypc->font, fonth)) < 0) {
+		munmap((void *)ttypc->fbmem, ttypc->fbsz);
+		_ttypc_fb_writereg(VBE_DISPI_ENABLE, 0);
+		free(ttypc->font);
+		return err;
+	}
+
+	ttypc->cols = ttypc->fbcon.cols;
+	ttypc->rows = ttypc->fbcon.rows;
+	ttypc->color = 1;
+	ttypc->fb = 1;
+
+	return EOK;
+}
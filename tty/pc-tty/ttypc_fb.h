@@ -0,0 +1,78 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Linear framebuffer display (Bochs/QEMU VBE)
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _TTYPC_FB_H_
+#define _TTYPC_FB_H_
+
+#include "ttypc.h"
+
+
+/* Bochs VBE (DISPI) registers */
+enum {
+	VBE_DISPI_INDEX    = 0x1ce, /* Index register */
+	VBE_DISPI_DATA     = 0x1cf  /* Data register */
+};
+
+
+/* Bochs VBE (DISPI) register layout */
+enum {
+	VBE_DISPI_ID       = 0x00, /* Interface version */
+	VBE_DISPI_XRES     = 0x01, /* Horizontal resolution */
+	VBE_DISPI_YRES     = 0x02, /* Vertical resolution */
+	VBE_DISPI_BPP      = 0x03, /* Bits per pixel */
+	VBE_DISPI_ENABLE   = 0x04, /* Display enable */
+	VBE_DISPI_VWIDTH   = 0x06  /* Virtual width (framebuffer line length in pixels) */
+};
+
+
+/* Bochs VBE (DISPI) definitions */
+enum {
+	VBE_DISPI_ID0      = 0xb0c0, /* Lowest interface version */
+	VBE_DISPI_ID5      = 0xb0c5, /* Highest interface version */
+	VBE_DISPI_ENABLED  = 0x01,   /* Display enabled */
+	VBE_DISPI_LFB      = 0x40    /* Linear framebuffer enabled */
+};
+
+
+/* PCI configuration space access */
+enum {
+	PCI_CFGADDR        = 0xcf8, /* Configuration address register */
+	PCI_CFGDATA        = 0xcfc  /* Configuration data register */
+};
+
+
+/* Bochs/QEMU standard VGA PCI ID */
+#define VBE_PCI_VENDOR 0x1234
+#define VBE_PCI_DEVICE 0x1111
+
+
+/* Copies modified cells of active VT screen buffer to the framebuffer */
+extern void _ttypc_fb_flush(ttypc_vt_t *vt);
+
+
+/* Moves active VT rows top + n .. bottom n rows up in the framebuffer */
+extern void _ttypc_fb_rollup(ttypc_vt_t *vt, unsigned int n);
+
+
+/* Sets cursor position and visibility */
+extern void _ttypc_fb_setcursor(ttypc_vt_t *vt, uint8_t state);
+
+
+/* Destroys framebuffer display */
+extern void ttypc_fb_destroy(ttypc_t *ttypc);
+
+
+/* Initializes framebuffer display (switches from VGA text mode) */
+extern int ttypc_fb_init(ttypc_t *ttypc, unsigned int width, unsigned int height);
+
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Framebuffer text console renderer
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ttypc_fbcon.h"
+
+
+/* Standard VGA palette */
+static const uint32_t palette[] = {
+	0x000000, 0x0000aa, 0x00aa00, 0x00aaaa, 0xaa0000, 0xaa00aa, 0xaa5500, 0xaaaaaa,
+	0x555555, 0x5555ff, 0x55ff55, 0x55ffff, 0xff5555, 0xff55ff, 0xffff55, 0xffffff
+};
+
+
+/* Returns glyph rows expanded for attr color pair */
+static const uint32_t *_ttypc_fbcon_expand(ttypc_fbcon_t *fbcon, uint8_t attr)
+{
+	ttypc_fbcon_exp_t *exp = fbcon->exp, *lru = fbcon->exp;
+	uint32_t fg, bg;
+	unsigned int i, j;
+
+	for (i = 0; i < FBCON_CACHESZ; i++) {
+		if (exp[i].attr == attr) {
+			exp[i].stamp = ++fbcon->stamp;
+			return exp[i].rows[0];
+		}
+
+		if ((int32_t)(exp[i].stamp - lru->stamp) < 0)
+			lru = exp + i;
+	}
+
+	/* Replace least recently used color pair, blink bit selects blinking not bright background */
+	fg = palette[attr & 0x0f];
+	bg = palette[(attr >> 4) & 0x07];
+
+	for (i = 0; i < 256; i++) {
+		for (j = 0; j < FBCON_GLYPHW; j++)
+			lru->rows[i][j] = (i & (0x80 >> j)) ? fg : bg;
+	}
+	lru->attr = attr;
+	lru->stamp = ++fbcon->stamp;
+
+	return lru->rows[0];
+}
+
+
+/* Returns framebuffer address of cell at pos */
+static inline uint32_t *_ttypc_fbcon_celladdr(ttypc_fbcon_t *fbcon, unsigned int pos)
+{
+	return fbcon->fb + (pos / fbcon->cols) * fbcon->fonth * fbcon->pitch + (pos % fbcon->cols) * FBCON_GLYPHW;
+}
+
+
+/* Draws n cells starting at pos */
+static void _ttypc_fbcon_drawcells(ttypc_fbcon_t *fbcon, unsigned int pos, const uint16_t *cells, unsigned int n)
+{
+	const uint32_t *exp = NULL;
+	const uint8_t *glyph;
+	uint32_t *dst = _ttypc_fbcon_celladdr(fbcon, pos);
+	unsigned int i, j;
+	uint8_t attr = 0;
+
+	for (i = 0; i < n; i++, dst += FBCON_GLYPHW) {
+		if ((exp == NULL) || ((cells[i] >> 8) != attr)) {
+			attr = cells[i] >> 8;
+			exp = _ttypc_fbcon_expand(fbcon, attr);
+		}
+		glyph = fbcon->font + (cells[i] & 0xff) * FBCON_GLYPHSZ;
+
+		/* Whole glyph row per store (compiles to wide/SIMD moves) */
+		for (j = 0; j < fbcon->fonth; j++)
+			memcpy(dst + j * fbcon->pitch, exp + glyph[j] * FBCON_GLYPHW, FBCON_GLYPHW * sizeof(*dst));
+	}
+}
+
+
+/* Draws cursor (two bottom lines of the cell in foreground color) */
+static void _ttypc_fbcon_drawcursor(ttypc_fbcon_t *fbcon)
+{
+	uint32_t *dst = _ttypc_fbcon_celladdr(fbcon, fbcon->cpos) + (fbcon->fonth - 2) * fbcon->pitch;
+	const uint32_t *exp = _ttypc_fbcon_expand(fbcon, fbcon->cells[fbcon->cpos] >> 8);
+
+	memcpy(dst, exp + 0xff * FBCON_GLYPHW, FBCON_GLYPHW * sizeof(*dst));
+	memcpy(dst + fbcon->pitch, exp + 0xff * FBCON_GLYPHW, FBCON_GLYPHW * sizeof(*dst));
+}
+
+
+void ttypc_fbcon_draw(ttypc_fbcon_t *fbcon, const uint16_t *cells)
+{
+	unsigned int row, first, last, pos;
+	int cursor = 0;
+
+	for (row = 0, pos = 0; row < fbcon->rows; row++, pos += fbcon->cols) {
+		for (first = 0; (first < fbcon->cols) && (cells[pos + first] == fbcon->cells[pos + first]); first++);
+		if (first == fbcon->cols)
+			continue;
+
+		for (last = fbcon->cols - 1; cells[pos + last] == fbcon->cells[pos + last]; last--);
+
+		memcpy(fbcon->cells + pos + first, cells + pos + first, (last - first + 1) * sizeof(*cells));
+		_ttypc_fbcon_drawcells(fbcon, pos + first, cells + pos + first, last - first + 1);
+
+		if ((fbcon->cpos >= pos + first) && (fbcon->cpos <= pos + last))
+			cursor = 1;
+	}
+
+	/* Cursor cell has been redrawn */
+	if (cursor && fbcon->cst)
+		_ttypc_fbcon_drawcursor(fbcon);
+}
+
+
+void ttypc_fbcon_scroll(ttypc_fbcon_t *fbcon, unsigned int top, unsigned int bottom, unsigned int n)
+{
+	unsigned int i, lines;
+	uint32_t *dst;
+
+	if ((n == 0) || (top + n > bottom) || (bottom >= fbcon->rows))
+		return;
+
+	/* Erase cursor, it would be moved with the screen */
+	if (fbcon->cst)
+		_ttypc_fbcon_drawcells(fbcon, fbcon->cpos, fbcon->cells + fbcon->cpos, 1);
+
+	/* Drawn cells are moved with the framebuffer, vacated rows keep their old contents in both */
+	memmove(fbcon->cells + top * fbcon->cols, fbcon->cells + (top + n) * fbcon->cols, (bottom + 1 - top - n) * fbcon->cols * sizeof(*fbcon->cells));
+
+	dst = fbcon->fb + top * fbcon->fonth * fbcon->pitch;
+	lines = (bottom + 1 - top - n) * fbcon->fonth;
+	for (i = 0; i < lines; i++, dst += fbcon->pitch)
+		memcpy(dst, dst + n * fbcon->fonth * fbcon->pitch, fbcon->cols * FBCON_GLYPHW * sizeof(*dst));
+
+	if (fbcon->cst)
+		_ttypc_fbcon_drawcursor(fbcon);
+}
+
+
+void ttypc_fbcon_cursor(ttypc_fbcon_t *fbcon, unsigned int cpos, uint8_t cst)
+{
+	if (cpos >= fbcon->rows * fbcon->cols)
+		cpos = fbcon->rows * fbcon->cols - 1;
+
+	if ((cpos == fbcon->cpos) && (cst == fbcon->cst))
+		return;
+
+	/* Erase old cursor */
+	if (fbcon->cst)
+		_ttypc_fbcon_drawcells(fbcon, fbcon->cpos, fbcon->cells + fbcon->cpos, 1);
+
+	fbcon->cpos = cpos;
+	fbcon->cst = cst;
+
+	if (fbcon->cst)
+		_ttypc_fbcon_drawcursor(fbcon);
+}
+
+
+void ttypc_fbcon_destroy(ttypc_fbcon_t *fbcon)
+{
+	free(fbcon->exp);
+	free(fbcon->cells);
+}
+
+
+int ttypc_fbcon_init(ttypc_fbcon_t *fbcon, uint32_t *fb, unsigned int width, unsigned int height, unsigned int pitch, const uint8_t *font, unsigned int fonth)
+{
+	unsigned int i;
+
+	if ((fonth == 0) || (fonth > FBCON_GLYPHSZ) || (width < FBCON_GLYPHW) || (height < fonth))
+		return -EINVAL;
+
+	fbcon->fb = fb;
+	fbcon->pitch = pitch;
+	fbcon->font = font;
+	fbcon->fonth = fonth;
+	fbcon->cols = width / FBCON_GLYPHW;
+	fbcon->rows = height / fonth;
+	fbcon->cpos = 0;
+	fbcon->cst = 0;
+	fbcon->stamp = 0;
+
+	if ((fbcon->cells = malloc(fbcon->rows * fbcon->cols * sizeof(*fbcon->cells))) == NULL)
+		return -ENOMEM;
+
+	if ((fbcon->exp = malloc(FBCON_CACHESZ * sizeof(*fbcon->exp))) == NULL) {
+		free(fbcon->cells);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < FBCON_CACHESZ; i++) {
+		fbcon->exp[i].attr = 0xffff;
+		fbcon->exp[i].stamp = 0;
+	}
+
+	/* Clear screen, NUL on black is drawn as blank */
+	memset(fbcon->cells, 0, fbcon->rows * fbcon->cols * sizeof(*fbcon->cells));
+	for (i = 0; i < height; i++)
+		memset(fb + i * pitch, 0, width * sizeof(*fb));
+
+	return EOK;
+}
@@ -0,0 +1,81 @@
+/*
+ * Phoenix-RTOS
+ *
+ * Framebuffer text console renderer
+ *
+ * Renders VGA text mode cells (attribute << 8 | character) into a linear
+ * 32 bpp framebuffer. Doesn't access any hardware, so it can be run
+ * against an in-memory framebuffer on the host (see tests/).
+ *
+ * Copyright 2020 Phoenix Systems
+ *
+ * This file is part of Phoenix-RTOS.
+ *
+ * %LICENSE%
+ */
+
+#ifndef _TTYPC_FBCON_H_
+#define _TTYPC_FBCON_H_
+
+#include <stdint.h>
+
+
+/* Misc definitions */
+#define FBCON_GLYPHW   8   /* Glyph width in pixels */
+#define FBCON_GLYPHSZ  32  /* Bytes per glyph in font data (VGA plane 2 layout) */
+#define FBCON_CACHESZ  8   /* Number of cached color pairs */
+
+
+/* Glyph rows pre-expanded to pixels for one color pair */
+typedef struct {
+	uint32_t stamp;                           /* Last use stamp */
+	uint16_t attr;                            /* Color pair (VGA attribute), 0xffff if slot is empty */
+	uint32_t rows[256][FBCON_GLYPHW];         /* Pixels for every glyph row bit pattern */
+} ttypc_fbcon_exp_t;
+
+
+typedef struct {
+	/* Framebuffer */
+	uint32_t *fb;                             /* Framebuffer address */
+	unsigned int pitch;                       /* Framebuffer line length (in pixels) */
+
+	/* Font */
+	const uint8_t *font;                      /* Font data (256 glyphs, FBCON_GLYPHSZ bytes each) */
+	unsigned int fonth;                       /* Font height in pixels */
+
+	/* Screen */
+	unsigned int cols;                        /* Screen width - number of columns */
+	unsigned int rows;                        /* Screen height - number of rows */
+	uint16_t *cells;                          /* Cells currently drawn in the framebuffer */
+
+	/* Cursor */
+	unsigned int cpos;                        /* Cursor position offset */
+	uint8_t cst;                              /* Cursor state */
+
+	/* Glyph cache */
+	uint32_t stamp;                           /* Glyph cache use counter */
+	ttypc_fbcon_exp_t *exp;                   /* Expanded glyph rows (FBCON_CACHESZ color pairs) */
+} ttypc_fbcon_t;
+
+
+/* Draws cells that differ from the framebuffer contents (dirty spans of each row) */
+extern void ttypc_fbcon_draw(ttypc_fbcon_t *fbcon, const uint16_t *cells);
+
+
+/* Moves rows top + n .. bottom of the framebuffer n rows up */
+extern void ttypc_fbcon_scroll(ttypc_fbcon_t *fbcon, unsigned int top, unsigned int bottom, unsigned int n);
+
+
+/* Sets cursor position and visibility */
+extern void ttypc_fbcon_cursor(ttypc_fbcon_t *fbcon, unsigned int cpos, uint8_t cst);
+
+
+/* Destroys framebuffer console */
+extern void ttypc_fbcon_destroy(ttypc_fbcon_t *fbcon);
+
+
+/* Initializes framebuffer console, screen size is derived from framebuffer and font size */
+extern int ttypc_fbcon_init(ttypc_fbcon_t *fbcon, uint32_t *fb, unsigned int width, unsigned int height, unsigned int pitch, const uint8_t *font, unsigned int fonth);
+
+
+#endif
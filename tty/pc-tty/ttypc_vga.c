@@ -21,6 +21,7 @@
 #include <sys/threads.h>
 
 #include "ttypc.h"
+#include "ttypc_fb.h"
 #include "ttypc_vga.h"
 
 
@@ -108,30 +109,69 @@ volatile uint16_t *_ttypc_vga_move(volatile uint16_t *dvga, volatile uint16_t *s
 }
 
 
-void _ttypc_vga_switch(ttypc_vt_t *vt)
+void _ttypc_vga_dirty(ttypc_vt_t *vt, unsigned int offs, unsigned int n)
+{
+	if (!n)
+		return;
+
+	if (vt->dbeg == vt->dend) {
+		vt->dbeg = offs;
+		vt->dend = offs + n;
+	}
+	else {
+		vt->dbeg = min(vt->dbeg, offs);
+		vt->dend = max(vt->dend, offs + n);
+	}
+}
+
+
+void _ttypc_vga_flush(ttypc_vt_t *vt)
 {
 	ttypc_t *ttypc = vt->ttypc;
-	ttypc_vt_t *cvt = ttypc->vt;
+	unsigned int i, offs, end;
 
-	if (vt == cvt)
+	/* Inactive VT keeps its modified span until it's switched to */
+	if ((vt != ttypc->vt) || (vt->dbeg == vt->dend))
 		return;
 
-	/* VGA memory -> VT memory */
-	_ttypc_vga_read(cvt->vram, cvt->mem, cvt->rows * cvt->cols);
-	cvt->vram = cvt->mem;
+	if (ttypc->fb) {
+		_ttypc_fb_flush(vt);
+	}
+	else {
+		/* VGA memory is never read back, modified rows are compared against its cached copy */
+		offs = vt->dbeg - vt->dbeg % vt->cols;
+		end = min(vt->dend, vt->rows * vt->cols);
+		for (i = offs; i < end; i += vt->cols) {
+			if (memcmp(vt->mem + i, ttypc->vgacache + i, vt->cols * CHR_VGA)) {
+				memcpy(ttypc->vgacache + i, vt->mem + i, vt->cols * CHR_VGA);
+				_ttypc_vga_write(ttypc->vga + i, ttypc->vgacache + i, vt->cols);
+			}
+		}
+	}
+
+	vt->dbeg = 0;
+	vt->dend = 0;
+}
+
+
+void _ttypc_vga_switch(ttypc_vt_t *vt)
+{
+	ttypc_t *ttypc = vt->ttypc;
+
+	if (vt == ttypc->vt)
+		return;
 
 	mutexLock(vt->lock);
-	/* VT memory -> VGA memory */
-	vt->vram = ttypc->vga;
-	_ttypc_vga_write(vt->vram, vt->mem, vt->rows * vt->cols);
+	/* Set active VT */
+	ttypc->vt = vt;
+	/* VT memory -> VGA memory (holds the previous VT screen) */
+	_ttypc_vga_dirty(vt, 0, vt->rows * vt->cols);
+	_ttypc_vga_flush(vt);
 	/* Set cursor position... */
 	_ttypc_vga_setcursor(vt);
 	/* ... and visibility */
 	_ttypc_vga_togglecursor(vt, vt->cst);
 	mutexUnlock(vt->lock);
-
-	/* Set active VT */
-	ttypc->vt = vt;
 }
 
 
@@ -142,13 +182,35 @@ static unsigned int _ttypc_vga_scrollbackcapacity(ttypc_vt_t *vt)
 }
 
 
-/* Makes space for n new lines in the scrollback buffer */
+uint16_t *_ttypc_vga_scrbline(ttypc_vt_t *vt, unsigned int line)
+{
+	return vt->scrb + ((vt->scrbhead + line) % _ttypc_vga_scrollbackcapacity(vt)) * vt->cols;
+}
+
+
+/* Copies n screen lines to the scrollback buffer (starting at line) */
+static void _ttypc_vga_readscrollback(ttypc_vt_t *vt, volatile uint16_t *vga, unsigned int line, unsigned int n)
+{
+	for (; n; n--, line++, vga += vt->cols)
+		_ttypc_vga_read(vga, _ttypc_vga_scrbline(vt, line), vt->cols);
+}
+
+
+/* Copies n scrollback buffer lines (starting at line) to the screen */
+static void _ttypc_vga_writescrollback(ttypc_vt_t *vt, volatile uint16_t *vga, unsigned int line, unsigned int n)
+{
+	for (; n; n--, line++, vga += vt->cols)
+		_ttypc_vga_write(vga, _ttypc_vga_scrbline(vt, line), vt->cols);
+}
+
+
+/* Makes space for n new lines in the scrollback buffer (drops the oldest lines if full) */
 static void _ttypc_vga_allocscrollback(ttypc_vt_t *vt, unsigned int n)
 {
 	unsigned int scrbcap = _ttypc_vga_scrollbackcapacity(vt);
 
 	if (vt->scrbsz + n > scrbcap) {
-		memmove(vt->scrb, vt->scrb + (vt->scrbsz + n - scrbcap) * vt->cols, (scrbcap - n) * vt->cols * CHR_VGA);
+		vt->scrbhead = (vt->scrbhead + vt->scrbsz + n - scrbcap) % scrbcap;
 		vt->scrbsz = scrbcap;
 	}
 	else {
@@ -163,12 +225,17 @@ void _ttypc_vga_rollup(ttypc_vt_t *vt, unsigned int n)
 
 	/* Update scrollback buffer */
 	_ttypc_vga_allocscrollback(vt, k);
-	_ttypc_vga_read(vt->vram + (vt->top + n - k) * vt->cols, vt->scrb + (vt->scrbsz - k) * vt->cols, k * vt->cols);
+	_ttypc_vga_readscrollback(vt, vt->vram + (vt->top + n - k) * vt->cols, vt->scrbsz - k, k);
 
 	/* Roll up */
 	if (n < vt->bottom - vt->top) {
 		_ttypc_vga_move(vt->vram + vt->top * vt->cols, vt->vram + (vt->top + n) * vt->cols, (vt->bottom - vt->top + 1 - n) * vt->cols);
 		_ttypc_vga_set(vt->vram + (vt->bottom + 1 - n) * vt->cols, vt->attr | ' ', n * vt->cols);
+		_ttypc_vga_dirty(vt, vt->top * vt->cols, (vt->bottom - vt->top + 1) * vt->cols);
+
+		/* Scroll framebuffer contents instead of redrawing all rows */
+		if ((vt == vt->ttypc->vt) && vt->ttypc->fb)
+			_ttypc_fb_rollup(vt, n);
 	}
 }
 
@@ -183,7 +250,8 @@ void _ttypc_vga_rolldown(ttypc_vt_t *vt, unsigned int n)
 		l = min(k, vt->scrbsz);
 		_ttypc_vga_move(vt->vram + (vt->top + k) * vt->cols, vt->vram + vt->top * vt->cols, (vt->bottom - vt->top + 1 - k) * vt->cols);
 		_ttypc_vga_set(vt->vram + vt->top * vt->cols, vt->attr | ' ', (k - l) * vt->cols);
-		_ttypc_vga_write(vt->vram + (vt->top + k - l) * vt->cols, vt->scrb + (vt->scrbsz - l) * vt->cols, l * vt->cols);
+		_ttypc_vga_writescrollback(vt, vt->vram + (vt->top + k - l) * vt->cols, vt->scrbsz - l, l);
+		_ttypc_vga_dirty(vt, vt->top * vt->cols, (vt->bottom - vt->top + 1) * vt->cols);
 		vt->scrbsz -= l;
 	}
 }
@@ -209,12 +277,17 @@ void _ttypc_vga_scroll(ttypc_vt_t *vt, int n)
 
 	/* Copy scrollback */
 	vt->scrbpos += n;
-	_ttypc_vga_write(vt->vram, vt->scrb + (vt->scrbsz - vt->scrbpos) * vt->cols, min(vt->scrbpos, vt->rows) * vt->cols);
+	_ttypc_vga_writescrollback(vt, vt->vram, vt->scrbsz - vt->scrbpos, min(vt->scrbpos, vt->rows));
 
 	/* Copy scroll origin */
-	if (vt->scrbpos < vt->rows) {
+	if (vt->scrbpos < vt->rows)
 		_ttypc_vga_write(vt->vram + vt->scrbpos * vt->cols, vt->scro, (vt->rows - vt->scrbpos) * vt->cols);
 
+	/* Update screen */
+	_ttypc_vga_dirty(vt, 0, vt->rows * vt->cols);
+	_ttypc_vga_flush(vt);
+
+	if (vt->scrbpos < vt->rows) {
 		if ((vt == vt->ttypc->vt) && vt->cst) {
 			/* Show cursor */
 			_ttypc_vga_setcursor(vt);
@@ -235,6 +308,7 @@ void _ttypc_vga_scrollcancel(ttypc_vt_t *vt)
 
 	/* Restore scroll origin */
 	_ttypc_vga_write(vt->vram, vt->scro, vt->rows * vt->cols);
+	_ttypc_vga_dirty(vt, 0, vt->rows * vt->cols);
 
 	/* Restore cursor position... */
 	vt->cpos -= vt->scrbpos * vt->cols;
@@ -259,12 +333,24 @@ void _ttypc_vga_getcursor(ttypc_vt_t *vt)
 
 void _ttypc_vga_setcursor(ttypc_vt_t *vt)
 {
+	if (vt->ttypc->fb) {
+		if (vt == vt->ttypc->vt)
+			_ttypc_fb_setcursor(vt, vt->ttypc->fbcon.cst);
+		return;
+	}
+
 	_ttypc_vga_writereg(vt->ttypc, CRTC_CURSORH, vt->cpos);
 }
 
 
 void _ttypc_vga_togglecursor(ttypc_vt_t *vt, uint8_t state)
 {
+	if (vt->ttypc->fb) {
+		if (vt == vt->ttypc->vt)
+			_ttypc_fb_setcursor(vt, state);
+		return;
+	}
+
 	if (state) {
 		/* Show cursor */
 		_ttypc_vga_setctype(vt->ttypc, vt->ctype, CUR_DEFH);
@@ -279,6 +365,7 @@ void _ttypc_vga_togglecursor(ttypc_vt_t *vt, uint8_t state)
 
 void ttypc_vga_destroy(ttypc_t *ttypc)
 {
+	munmap(ttypc->vgacache, _PAGE_SIZE);
 	munmap((void *)ttypc->vga, _PAGE_SIZE);
 }
 
@@ -289,9 +376,19 @@ int ttypc_vga_init(ttypc_t *ttypc)
 	ttypc->color = inb((void *)GN_MISCOUTR) & 0x01;
 	ttypc->crtc = (ttypc->color) ? (void *)CRTC_COLOR : (void *)CRTC_MONO;
 
+	/* Text mode screen size */
+	ttypc->cols = 80;
+	ttypc->rows = 25;
+
 	/* Map video memory */
 	if ((ttypc->vga = mmap(NULL, _PAGE_SIZE, PROT_READ | PROT_WRITE, 0, OID_PHYSMEM, (ttypc->color) ? VGA_COLOR : VGA_MONO)) == MAP_FAILED)
 		return -ENOMEM;
 
+	/* Allocate VGA memory cache */
+	if ((ttypc->vgacache = mmap(NULL, _PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, NULL, 0)) == MAP_FAILED) {
+		munmap((void *)ttypc->vga, _PAGE_SIZE);
+		return -ENOMEM;
+	}
+
 	return EOK;
 }
@@ -67,6 +67,25 @@ enum {
 };
 
 
+/* VGA Sequencer and Graphics Controller Registers */
+enum {
+	SEQ_ADDR       = 0x3c4, /* Sequencer index register */
+	SEQ_DATA       = 0x3c5, /* Sequencer data register */
+	GC_ADDR        = 0x3ce, /* Graphics controller index register */
+	GC_DATA        = 0x3cf  /* Graphics controller data register */
+};
+
+
+/* VGA Sequencer and Graphics Controller register layout */
+enum {
+	SEQ_MAPMASK    = 0x02, /* Map mask (write planes) */
+	SEQ_MEMMODE    = 0x04, /* Memory mode */
+	GC_READMAP     = 0x04, /* Read map select */
+	GC_MODE        = 0x05, /* Graphics mode */
+	GC_MISC        = 0x06  /* Miscellaneous graphics */
+};
+
+
 /* VGA GENERAL/EXTERNAL Registers */
 enum {
 	GN_MISCOUTR    = 0x3cc, /* Misc output register read */
@@ -166,6 +185,18 @@ extern volatile uint16_t *_ttypc_vga_set(volatile uint16_t *vga, uint16_t val, s
 extern volatile uint16_t *_ttypc_vga_move(volatile uint16_t *dvga, volatile uint16_t *svga, size_t n);
 
 
+/* Returns scrollback buffer line (0 - oldest line) */
+extern uint16_t *_ttypc_vga_scrbline(ttypc_vt_t *vt, unsigned int line);
+
+
+/* Marks n VT screen buffer cells starting at offs as modified */
+extern void _ttypc_vga_dirty(ttypc_vt_t *vt, unsigned int offs, unsigned int n);
+
+
+/* Copies modified rows of active VT screen buffer to VGA memory */
+extern void _ttypc_vga_flush(ttypc_vt_t *vt);
+
+
 /* Switches to another VT */
 extern void _ttypc_vga_switch(ttypc_vt_t *vt);
 
@@ -16,6 +16,7 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <sys/minmax.h>
 #include <sys/mman.h>
 #include <sys/threads.h>
 
@@ -33,6 +34,7 @@ static void _ttypc_vt_sdraw(ttypc_vt_t *vt, char c)
 		c = (*vt->GR)[c - 0xa0];
 
 	*(vt->vram + vt->cpos) = vt->attr | c;
+	_ttypc_vga_dirty(vt, vt->cpos, 1);
 	vt->ss = 0;
 }
 
@@ -104,8 +106,6 @@ static int _ttypc_vt_sput(ttypc_vt_t *vt, char c)
 		case 0x0d: /* CR */
 			vt->cpos -= vt->ccol;
 			vt->ccol = 0;
-			if (vt == vt->ttypc->vt)
-				_ttypc_vga_setcursor(vt);
 			return ret;
 
 		case 0x0e: /* SO */
@@ -157,8 +157,10 @@ static int _ttypc_vt_sput(ttypc_vt_t *vt, char c)
 		switch (vt->escst) {
 		case ESC_INIT:
 			/* InseRt Mode */
-			if (vt->irm)
+			if (vt->irm) {
 				_ttypc_vga_move(vt->vram + vt->cpos + 1, vt->vram + vt->cpos, vt->cols - vt->ccol - 1);
+				_ttypc_vga_dirty(vt, vt->cpos + 1, vt->cols - vt->ccol - 1);
+			}
 
 			_ttypc_vt_sdraw(vt, c);
 
@@ -172,8 +174,6 @@ static int _ttypc_vt_sput(ttypc_vt_t *vt, char c)
 				vt->crow = vt->cpos / vt->cols;
 				vt->lc = 1;
 				_ttypc_vt_updatescroll(vt);
-				if (vt == vt->ttypc->vt)
-					_ttypc_vga_setcursor(vt);
 				return ret;
 			}
 			break;
@@ -620,13 +620,37 @@ static int _ttypc_vt_sput(ttypc_vt_t *vt, char c)
 	vt->crow = vt->cpos / vt->cols;
 	vt->lc = 0;
 
-	if (vt == vt->ttypc->vt)
-		_ttypc_vga_setcursor(vt);
-
 	return ret;
 }
 
 
+/* Draws run of printable characters up to the last column of the current row, returns number of characters drawn */
+static size_t _ttypc_vt_sdrawrun(ttypc_vt_t *vt, const char *buff, size_t n)
+{
+	const uint16_t *gl = *vt->GL;
+	volatile uint16_t *vram;
+	size_t i;
+
+	/* Cancel scrolling */
+	_ttypc_vga_scrollcancel(vt);
+
+	vram = vt->vram + vt->cpos;
+	n = min(n, vt->cols - 1 - vt->ccol);
+
+	for (i = 0; (i < n) && (buff[i] >= 0x20) && (buff[i] < 0x7f); i++)
+		vram[i] = vt->attr | (char)gl[buff[i] - 0x20];
+
+	if (i) {
+		_ttypc_vga_dirty(vt, vt->cpos, i);
+		vt->ccol += i;
+		vt->cpos += i;
+		vt->lc = 0;
+	}
+
+	return i;
+}
+
+
 ssize_t ttypc_vt_read(ttypc_vt_t *vt, int mode, char *buff, size_t len)
 {
 	return libtty_read(&vt->tty, buff, len, mode);
@@ -651,14 +675,23 @@ int ttypc_vt_ioctl(ttypc_vt_t *vt, pid_t pid, unsigned int cmd, const void *idat
 }
 
 
+/* Returns screen buffer size */
+static size_t _ttypc_vt_memsz(ttypc_t *ttypc)
+{
+	return (ttypc->rows * ttypc->cols * CHR_VGA + _PAGE_SIZE - 1) & ~(_PAGE_SIZE - 1);
+}
+
+
 void ttypc_vt_destroy(ttypc_vt_t *vt)
 {
+	size_t memsz = _ttypc_vt_memsz(vt->ttypc);
+
 	libtty_destroy(&vt->tty);
 	if (SCRB_PAGES) {
 		munmap(vt->scrb, SCRB_PAGES * _PAGE_SIZE);
-		munmap(vt->scro, _PAGE_SIZE);
+		munmap(vt->scro, memsz);
 	}
-	munmap(vt->mem, _PAGE_SIZE);
+	munmap(vt->mem, memsz);
 	resourceDestroy(vt->lock);
 }
 
@@ -678,9 +711,24 @@ static void _ttypc_vt_setcflag(void *arg, tcflag_t *cflag)
 static void _ttypc_vt_signaltxready(void *arg)
 {
 	ttypc_vt_t *vt = (ttypc_vt_t *)arg;
+	char buff[128];
+	size_t i, k, n;
+
+	while ((n = libtty_getchars(&vt->tty, (unsigned char *)buff, sizeof(buff), NULL)) > 0) {
+		for (i = 0; i < n; i += k) {
+			/* Plain text goes directly to the screen buffer, anything else through the emulator */
+			if ((vt->escst != ESC_INIT) || vt->irm || vt->ss || !(k = _ttypc_vt_sdrawrun(vt, buff + i, n - i))) {
+				_ttypc_vt_sput(vt, buff[i]);
+				k = 1;
+			}
+		}
+	}
 
-	while (libtty_txready(&vt->tty))
-		_ttypc_vt_sput(vt, (char)libtty_getchar(&vt->tty, NULL));
+	/* Update screen and cursor once per batch */
+	if (vt == vt->ttypc->vt) {
+		_ttypc_vga_flush(vt);
+		_ttypc_vga_setcursor(vt);
+	}
 }
 
 
@@ -692,36 +740,37 @@ int ttypc_vt_init(ttypc_t *ttypc, unsigned int ttybuffsz, ttypc_vt_t *vt)
 		.set_cflag      = _ttypc_vt_setcflag,
 		.signal_txready = _ttypc_vt_signaltxready
 	};
+	size_t memsz = _ttypc_vt_memsz(ttypc);
 	int err;
 
 	if ((err = mutexCreate(&vt->lock)) < 0)
 		return err;
 
-	if ((vt->vram = vt->mem = mmap(NULL, _PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, NULL, 0)) == MAP_FAILED) {
+	if ((vt->vram = vt->mem = mmap(NULL, memsz, PROT_READ | PROT_WRITE, MAP_PRIVATE, NULL, 0)) == MAP_FAILED) {
 		resourceDestroy(vt->lock);
 		return -ENOMEM;
 	}
 
 	if (SCRB_PAGES) {
-		if ((vt->scro = mmap(NULL, _PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, NULL, 0)) == MAP_FAILED) {
+		if ((vt->scro = mmap(NULL, memsz, PROT_READ | PROT_WRITE, MAP_PRIVATE, NULL, 0)) == MAP_FAILED) {
 			resourceDestroy(vt->lock);
-			munmap(vt->mem, _PAGE_SIZE);
+			munmap(vt->mem, memsz);
 			return -ENOMEM;
 		}
 
 		if ((vt->scrb = mmap(NULL, SCRB_PAGES * _PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, NULL, 0)) == MAP_FAILED) {
 			resourceDestroy(vt->lock);
-			munmap(vt->mem, _PAGE_SIZE);
-			munmap(vt->scro, _PAGE_SIZE);
+			munmap(vt->mem, memsz);
+			munmap(vt->scro, memsz);
 			return -ENOMEM;
 		}
 	}
 
 	if ((err = libtty_init(&vt->tty, &cb, ttybuffsz)) < 0) {
 		resourceDestroy(vt->lock);
-		munmap(vt->mem, _PAGE_SIZE);
+		munmap(vt->mem, memsz);
 		if (SCRB_PAGES) {
-			munmap(vt->scro, _PAGE_SIZE);
+			munmap(vt->scro, memsz);
 			munmap(vt->scrb, SCRB_PAGES * _PAGE_SIZE);
 		}
 		return err;
@@ -729,12 +778,13 @@ int ttypc_vt_init(ttypc_t *ttypc, unsigned int ttybuffsz, ttypc_vt_t *vt)
 
 	/* Init emulator */
 	vt->ttypc = ttypc;
-	vt->cols = 80;
-	vt->rows = 25;
+	vt->cols = ttypc->cols;
+	vt->rows = ttypc->rows;
 	_ttypc_vtf_str(vt);
 
 	/* Clear screen */
 	_ttypc_vga_set(vt->vram, vt->attr | ' ', vt->cols * vt->rows);
+	_ttypc_vga_dirty(vt, 0, vt->cols * vt->rows);
 
 	return EOK;
 }
@@ -51,7 +51,7 @@ enum {
 
 
 /* Misc definitions */
-#define MAXTABS    132       /* Max number of possible tab stops */
+#define MAXTABS    256       /* Max number of possible tab stops */
 #define MAXPARMS   10        /* Max number of escape sequence parameters */
 #define SCRB_PAGES 32        /* Number of scrollback buffer pages */
 
@@ -64,12 +64,14 @@ typedef struct {
 	ttypc_t *ttypc;          /* Parent ttypc_t object */
 
 	/* Screen */
-	volatile uint16_t *vram; /* Screen buffer address (if VT is active points to ttypc->vga, mem otherwise) */
+	volatile uint16_t *vram; /* Screen buffer address (points to mem, copied to ttypc->vga by _ttypc_vga_flush() if VT is active) */
 	uint16_t *mem;           /* Screen memory buffer */
 	uint8_t rows;            /* Screen height - number of rows */
 	uint8_t cols;            /* Screen width - number of columns */
 	uint8_t top;             /* Screen top margin */
 	uint8_t bottom;          /* Screen bottom margin */
+	uint16_t dbeg;           /* Modified screen buffer cells start offset (not flushed yet) */
+	uint16_t dend;           /* Modified screen buffer cells end offset (equal to dbeg if none) */
 
 	/* Cursor */
 	uint8_t ctype;           /* Cursor type */
@@ -80,7 +82,8 @@ typedef struct {
 
 	/* Scrollback */
 	uint16_t *scro;          /* Scroll origin buffer */
-	uint16_t *scrb;          /* Scrollback buffer */
+	uint16_t *scrb;          /* Scrollback buffer (circular, in lines) */
+	uint16_t scrbhead;       /* Scrollback oldest line index */
 	uint16_t scrbsz;         /* Scrollback size (in lines) */
 	uint16_t scrbpos;        /* Scrollback position offset */
 
@@ -295,6 +295,7 @@ void _ttypc_vtf_aln(ttypc_vt_t *vt)
 	vt->ccol = 0;
 	vt->crow = 0;
 	_ttypc_vga_set(vt->vram, vt->attr | 'E' , vt->rows * vt->cols);
+	_ttypc_vga_dirty(vt, 0, vt->rows * vt->cols);
 }
 
 
@@ -389,14 +390,17 @@ void _ttypc_vtf_clreos(ttypc_vt_t *vt)
 	switch (vt->parms[0]) {
 	case 0:
 		_ttypc_vga_set(vt->vram + vt->cpos, vt->attr | ' ', vt->cols * vt->rows - vt->cpos);
+		_ttypc_vga_dirty(vt, vt->cpos, vt->cols * vt->rows - vt->cpos);
 		break;
 
 	case 1:
 		_ttypc_vga_set(vt->vram, vt->attr | ' ', vt->cpos + 1);
+		_ttypc_vga_dirty(vt, 0, vt->cpos + 1);
 		break;
 
 	case 2:
 		_ttypc_vga_set(vt->vram, vt->attr | ' ', vt->cols * vt->rows);
+		_ttypc_vga_dirty(vt, 0, vt->cols * vt->rows);
 		break;
 	}
 }
@@ -407,14 +411,17 @@ void _ttypc_vtf_clreol(ttypc_vt_t *vt)
 	switch (vt->parms[0]) {
 	case 0:
 		_ttypc_vga_set(vt->vram + vt->cpos, vt->attr | ' ', vt->cols - vt->ccol);
+		_ttypc_vga_dirty(vt, vt->cpos, vt->cols - vt->ccol);
 		break;
 
 	case 1:
 		_ttypc_vga_set(vt->vram + vt->cpos - vt->ccol, vt->attr | ' ', vt->ccol + 1);
+		_ttypc_vga_dirty(vt, vt->cpos - vt->ccol, vt->ccol + 1);
 		break;
 
 	case 2:
 		_ttypc_vga_set(vt->vram + vt->cpos - vt->ccol, vt->attr | ' ', vt->cols);
+		_ttypc_vga_dirty(vt, vt->cpos - vt->ccol, vt->cols);
 		break;
 	}
 }
@@ -462,6 +469,7 @@ void _ttypc_vtf_il(ttypc_vt_t *vt)
 		else {
 			_ttypc_vga_move(vt->vram + vt->cpos + p * vt->cols, vt->vram + vt->cpos, (vt->bottom - vt->crow + 1 - p) * vt->cols);
 			_ttypc_vga_set(vt->vram + vt->cpos, vt->attr | ' ', p * vt->cols);
+			_ttypc_vga_dirty(vt, vt->cpos, (vt->bottom - vt->crow + 1) * vt->cols);
 		}
 	}
 }
@@ -478,6 +486,7 @@ void _ttypc_vtf_ic(ttypc_vt_t *vt)
 
 	_ttypc_vga_move(vt->vram + vt->cpos + p, vt->vram + vt->cpos, vt->cols - vt->ccol - p);
 	_ttypc_vga_set(vt->vram + vt->cpos, vt->attr | ' ', p);
+	_ttypc_vga_dirty(vt, vt->cpos, vt->cols - vt->ccol);
 }
 
 
@@ -500,6 +509,7 @@ void _ttypc_vtf_dl(ttypc_vt_t *vt)
 		else {
 			_ttypc_vga_move(vt->vram + vt->cpos, vt->vram + vt->cpos + p * vt->cols, (vt->bottom - vt->crow + 1 - p) * vt->cols);
 			_ttypc_vga_set(vt->vram + (vt->bottom + 1 - p) * vt->cols, vt->attr | ' ', p * vt->cols);
+			_ttypc_vga_dirty(vt, vt->cpos, (vt->bottom - vt->crow + 1) * vt->cols);
 		}
 	}
 }
@@ -516,6 +526,7 @@ void _ttypc_vtf_dch(ttypc_vt_t *vt)
 
 	_ttypc_vga_move(vt->vram + vt->cpos, vt->vram + vt->cpos + p, vt->cols - vt->ccol - p);
 	_ttypc_vga_set(vt->vram + vt->cpos + vt->cols - p, vt->attr | ' ', p);
+	_ttypc_vga_dirty(vt, vt->cpos, vt->cols - vt->ccol);
 }
 
 
@@ -571,11 +582,13 @@ void _ttypc_vtf_ris(ttypc_vt_t *vt)
 	vt->cpos = 0;
 	vt->ccol = 0;
 	vt->crow = 0;
+	vt->scrbhead = 0;
 	vt->scrbsz = 0;
 	vt->scrbpos = 0;
 
 	/* Clear screen */
 	_ttypc_vga_set(vt->vram, vt->attr | ' ', vt->cols * vt->rows);
+	_ttypc_vga_dirty(vt, 0, vt->cols * vt->rows);
 	/* Soft reset */
 	_ttypc_vtf_str(vt);
 }
@@ -592,6 +605,7 @@ void _ttypc_vtf_ech(ttypc_vt_t *vt)
 		p = vt->cols - vt->ccol;
 
 	_ttypc_vga_set(vt->vram + vt->cpos, vt->attr | ' ', p);
+	_ttypc_vga_dirty(vt, vt->cpos, p);
 }
 
 
@@ -801,13 +815,20 @@ static void _ttypc_vtf_applyattr(volatile uint16_t *begin, volatile uint16_t *en
 /* Applies SGR mode globally */
 static void _ttypc_vtf_applysgr(ttypc_vt_t *vt, uint8_t sgr)
 {
+	uint16_t *line;
+	unsigned int i;
+
 	vt->sgr = sgr;
 	vt->attr = ((vt->ttypc->color) ? csgr[sgr] : msgr[sgr]) << 8;
 
 	/* Apply attr to vram */
 	_ttypc_vtf_applyattr(vt->vram, vt->vram + vt->rows * vt->cols, vt->attr);
+	_ttypc_vga_dirty(vt, 0, vt->rows * vt->cols);
 	/* Apply attr to scrollback */
-	_ttypc_vtf_applyattr(vt->scrb, vt->scrb + vt->scrbsz * vt->cols, vt->attr);
+	for (i = 0; i < vt->scrbsz; i++) {
+		line = _ttypc_vga_scrbline(vt, i);
+		_ttypc_vtf_applyattr(line, line + vt->cols, vt->attr);
+	}
 	/* Apply attr to scroll origin */
 	if (vt->scrbpos)
 		_ttypc_vtf_applyattr(vt->scro, vt->scro + vt->rows * vt->cols, vt->attr);
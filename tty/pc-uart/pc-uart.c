@@ -33,6 +33,7 @@
 typedef struct {
 	void *base;
 	unsigned int irq;
+	unsigned int fifosz;
 
 	handle_t mutex;
 	handle_t intcond;
@@ -60,13 +61,55 @@ static int uart_interrupt(unsigned int n, void *arg)
 
 static void set_baudrate(void *_uart, speed_t baud)
 {
-	/* TODO */
+	uart_t *uart = _uart;
+	int baud_rate = libtty_baudrate_to_int(baud);
+	unsigned int div;
+	uint8_t lcr;
+
+	if (baud_rate <= 0)
+		return;
+
+	div = (BPS_CLK + baud_rate / 2) / baud_rate;
+	if (div == 0 || div > 0xffff) {
+		printf("pc-uart: baudrate %d not supported\n", baud_rate);
+		return;
+	}
+
+	mutexLock(uart->mutex);
+	lcr = inb(uart->base + REG_LCR) & ~LCR_DLAB;
+	outb(uart->base + REG_LCR, lcr | LCR_DLAB);
+	outb(uart->base + REG_LSB, div & 0xff);
+	outb(uart->base + REG_MSB, div >> 8);
+	outb(uart->base + REG_LCR, lcr);
+	mutexUnlock(uart->mutex);
 }
 
 
 static void set_cflag(void *_uart, tcflag_t *cflag)
 {
-	/* TODO */
+	uart_t *uart = _uart;
+	uint8_t lcr;
+
+	/* word length: CS5 - CS8 */
+	switch (*cflag & CSIZE) {
+	case CS5: lcr = 0; break;
+	case CS6: lcr = 1; break;
+	case CS7: lcr = 2; break;
+	default: lcr = 3; break;
+	}
+
+	if (*cflag & CSTOPB)
+		lcr |= LCR_STOP2;
+
+	if (*cflag & PARENB) {
+		lcr |= LCR_PEN;
+		if (!(*cflag & PARODD))
+			lcr |= LCR_EPS;
+	}
+
+	mutexLock(uart->mutex);
+	outb(uart->base + REG_LCR, lcr);
+	mutexUnlock(uart->mutex);
 }
 
 
@@ -82,7 +125,8 @@ void uart_intthr(void *arg)
 {
 	uart_t *uart = (uart_t *)arg;
 	uint8_t iir, lsr;
-	char c;
+	unsigned char buff[64];
+	unsigned int i, n;
 
 	mutexLock(uart->mutex);
 	for (;;) {
@@ -91,22 +135,26 @@ void uart_intthr(void *arg)
 
 		/* Receive */
 		if ((iir & IIR_DR) == IIR_DR) {
-			while (1) {
-				lsr = inb(uart->base + REG_LSR);
+			do {
+				for (n = 0; n < sizeof(buff); n++) {
+					lsr = inb(uart->base + REG_LSR);
 
-				if ((lsr & 1) == 0)
-					break;
+					if ((lsr & LSR_DR) == 0)
+						break;
 
-				c = inb(uart->base + REG_RBR);
-				libtty_putchar(&uart->tty, c, NULL);
-			}
+					buff[n] = inb(uart->base + REG_RBR);
+				}
+
+				libtty_putchars(&uart->tty, buff, n, NULL);
+			} while (n == sizeof(buff));
 		}
 
-		/* Transmit */
+		/* Transmit - THRE means the whole TX FIFO is empty, refill it in one burst */
 		if ((iir & IIR_THRE) == IIR_THRE) {
 			if (libtty_txready(&uart->tty)) {
-				c = libtty_getchar(&uart->tty, NULL);
-				outb(uart->base + REG_THR, c);
+				n = libtty_getchars(&uart->tty, buff, uart->fifosz, NULL);
+				for (i = 0; i < n; i++)
+					outb(uart->base + REG_THR, buff[i]);
 			}
 			else {
 				outb(uart->base + REG_IMR, IMR_DR);
@@ -206,7 +254,7 @@ static void uart_ioctl(unsigned port, msg_t *msg)
 
 int _uart_init(void *base, unsigned int irq, unsigned int speed, uart_t **uart)
 {
-	libtty_callbacks_t callbacks;
+	libtty_callbacks_t callbacks = { 0 };
 
 	/* Test if device exist */
 	if (inb(base + REG_IIR) == 0xff)
@@ -229,6 +277,10 @@ int _uart_init(void *base, unsigned int irq, unsigned int speed, uart_t **uart)
 
 	(*uart)->base = base;
 	(*uart)->irq = irq;
+	(*uart)->fifosz = 1;
+
+	/* Report the speed programmed below to termios */
+	(*uart)->tty.term.c_ispeed = (*uart)->tty.term.c_ospeed = libtty_int_to_baudrate(BPS_CLK / speed);
 
 	condCreate(&(*uart)->intcond);
 	mutexCreate(&(*uart)->mutex);
@@ -254,11 +306,26 @@ int _uart_init(void *base, unsigned int irq, unsigned int speed, uart_t **uart)
 	outb(base + REG_LSB, speed);
 	outb(base + REG_MSB, 0);
 
+	/* Enable FIFO - this is required for Transmeta Crusoe (MOD), 64 byte mode can be set only with DLAB */
+	outb(base + REG_FCR, FCR_ENABLE | FCR_FIFO64);
+
 	/* Set data format (MOD) */
 	outb(base + REG_LCR, LCR_D8N1);
 
-	/* Enable FIFO - this is required for Transmeta Crusoe (MOD) */
-	outb(base + 2, 0x01);
+	/* 16550A reports working FIFO in IIR, 16750 additionally the 64 byte mode */
+	if ((inb(base + REG_IIR) & IIR_FIFO) != IIR_FIFO) {
+		(*uart)->fifosz = 1;
+		outb(base + REG_FCR, 0);
+	}
+	else {
+		(*uart)->fifosz = (inb(base + REG_IIR) & IIR_FIFO64) ? 64 : 16;
+
+		outb(base + REG_LCR, LCR_DLAB);
+		outb(base + REG_FCR, FCR_ENABLE | FCR_RXRESET | FCR_TXRESET | FCR_RXTRIG_HALF | (((*uart)->fifosz == 64) ? FCR_FIFO64 : 0));
+		outb(base + REG_LCR, LCR_D8N1);
+	}
+
+	printf("pc-uart: %u byte FIFO\n", (*uart)->fifosz);
 
 	/* Enable hardware interrupts */
 	outb(base + REG_MCR, MCR_OUT2);
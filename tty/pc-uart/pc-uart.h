@@ -26,6 +26,7 @@
 #define REG_THR     0
 #define REG_IMR     1
 #define REG_IIR     2
+#define REG_FCR     2
 #define REG_LCR     3
 #define REG_MCR     4
 #define REG_LSR     5
@@ -42,10 +43,21 @@
 #define IIR_IRQPEND   0x01
 #define IIR_THRE      0x02
 #define IIR_DR        0x04
+#define IIR_FIFO64    0x20
+#define IIR_FIFO      0xc0
+
+#define FCR_ENABLE    0x01
+#define FCR_RXRESET   0x02
+#define FCR_TXRESET   0x04
+#define FCR_FIFO64    0x20  /* 16750 only, writable with LCR_DLAB set */
+#define FCR_RXTRIG_HALF 0x80  /* 8 bytes (16 byte FIFO), 32 bytes (64 byte FIFO) */
 
 #define LCR_DLAB      0x80
 #define LCR_D8N1      0x03
 #define LCR_D8N2      0x07
+#define LCR_STOP2     0x04
+#define LCR_PEN       0x08
+#define LCR_EPS       0x10
 
 #define MCR_OUT2      0x08
 
@@ -53,6 +65,8 @@
 #define LSR_THRE      0x20
 
 
+#define BPS_CLK       115200  /* 1.8432 MHz / 16 */
+
 #define BPS_28800     4
 #define BPS_38400     3
 #define BPS_57600     2
@@ -28,8 +28,15 @@
 #include <libtty.h>
 
 
+/* HTIF/SBI console has no RX interrupt - poll interval in us backs off from min to max when idle */
+#define SPIKETTY_POLL_MIN  500
+#define SPIKETTY_POLL_MAX  100000
+
+
 typedef struct {
-//	handle_t mutex;
+	handle_t mutex;
+	handle_t cond;
+	int txready;
 	oid_t oid;
 	libtty_common_t tty;
 } spiketty_t;
@@ -53,9 +60,12 @@ static void set_cflag(void *_uart, tcflag_t *cflag)
 
 static void signal_txready(void *_uart)
 {
-/*	uart_t *uart = _uart;
-	outb(uart->base + REG_IMR, IMR_THRE | IMR_DR);
-	condSignal(uart->intcond);*/
+	spiketty_t *spiketty = _uart;
+
+	mutexLock(spiketty->mutex);
+	spiketty->txready = 1;
+	condSignal(spiketty->cond);
+	mutexUnlock(spiketty->mutex);
 }
 
 
@@ -184,36 +194,58 @@ void poolthr(void *arg)
 void spiketty_thr(void *arg)
 {
 	spiketty_t *spiketty = (spiketty_t *)arg;
-
-	int c;
+	unsigned char buff[64];
+	time_t delay = SPIKETTY_POLL_MIN;
+	size_t i, n;
+	int c, rx;
 
 	for (;;) {
+		/* Receive */
+		rx = 0;
 		do {
-			c = sbi_getchar();
-			if (c > 0) {
-				libtty_putchar(&spiketty->tty, c, NULL);
+			for (n = 0; n < sizeof(buff); n++) {
+				if ((c = sbi_getchar()) <= 0)
+					break;
+				buff[n] = c;
 			}
-		} while (c > 0);
+
+			libtty_putchars(&spiketty->tty, buff, n, NULL);
+			rx += n;
+		} while (n == sizeof(buff));
 
 		/* Transmit */
-		while (libtty_txready(&spiketty->tty)) {
-			c = libtty_getchar(&spiketty->tty, NULL);
-			sbi_putchar(c);
+		while ((n = libtty_getchars(&spiketty->tty, buff, sizeof(buff), NULL)) > 0) {
+			for (i = 0; i < n; i++)
+				sbi_putchar(buff[i]);
 		}
-		usleep(100000);
+
+		/* Poll quickly while input is flowing, back off exponentially when idle */
+		if (rx > 0)
+			delay = SPIKETTY_POLL_MIN;
+		else if ((delay *= 2) > SPIKETTY_POLL_MAX)
+			delay = SPIKETTY_POLL_MAX;
+
+		mutexLock(spiketty->mutex);
+		if (!spiketty->txready)
+			condWait(spiketty->cond, spiketty->mutex, delay);
+		spiketty->txready = 0;
+		mutexUnlock(spiketty->mutex);
 	}
 }
 
 
 int _spiketty_init(spiketty_t **spiketty)
 {
-	libtty_callbacks_t callbacks;
+	libtty_callbacks_t callbacks = { 0 };
 
 	callbacks.arg = *spiketty;
 	callbacks.set_baudrate = set_baudrate;
 	callbacks.set_cflag = set_cflag;
 	callbacks.signal_txready = signal_txready;
 
+	mutexCreate(&(*spiketty)->mutex);
+	condCreate(&(*spiketty)->cond);
+
 	libtty_init(&(*spiketty)->tty, &callbacks, _PAGE_SIZE);
 
 	uint8_t *stack;